@@ -0,0 +1,171 @@
+#include "cshell.h"
+#include <stdarg.h>
+
+// Per-command arena
+//
+// Memory that only lives for one command - the input line, joined
+// arguments, formatted URLs, network response buffers - comes from a bump
+// allocator instead of malloc. process_command() resets it after every
+// command in one step: the first block is kept for the next command and
+// any extra blocks are freed, so nothing allocated here is ever freed
+// individually.
+//
+// Each thread has its own arena (like shell_in/shell_out), so builtins
+// running on pipeline or parallel worker threads need no locking. Those
+// threads call arena_release() before they exit.
+
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGN 16
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;        // Older blocks
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *current;
+    void *last;                     // Most recent allocation, for arena_grow()
+    size_t allocations;             // Since the last reset
+    size_t bytes;
+} Arena;
+
+static __thread Arena thread_arena;
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static ArenaBlock *new_block(size_t min_size) {
+    size_t size = min_size > ARENA_BLOCK_SIZE ? min_size : ARENA_BLOCK_SIZE;
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+    if (block == NULL) return NULL;
+
+    block->size = size;
+    block->used = 0;
+    block->next = thread_arena.current;
+    thread_arena.current = block;
+    return block;
+}
+
+void *arena_alloc(size_t size) {
+    Arena *arena = &thread_arena;
+    size = align_up(size ? size : 1);
+
+    ArenaBlock *block = arena->current;
+    if (block == NULL || block->size - block->used < size) {
+        block = new_block(size);
+        if (block == NULL) {
+            printf("Error: Memory allocation failed\n");
+            exit(1);
+        }
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    arena->last = ptr;
+    arena->allocations++;
+    arena->bytes += size;
+
+    return ptr;
+}
+
+// Resize an arena allocation. The most recent one grows in place when its
+// block has room; anything else is copied to a new allocation.
+void *arena_grow(void *ptr, size_t old_size, size_t new_size) {
+    Arena *arena = &thread_arena;
+    ArenaBlock *block = arena->current;
+
+    if (ptr != NULL && ptr == arena->last && block != NULL) {
+        size_t offset = (size_t)((char *)ptr - block->data);
+        size_t needed = align_up(new_size);
+        if (offset + needed <= block->size) {
+            arena->bytes += offset + needed - block->used;
+            block->used = offset + needed;
+            return ptr;
+        }
+    }
+
+    void *grown = arena_alloc(new_size);
+    if (ptr != NULL && old_size > 0) memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+    return grown;
+}
+
+char *arena_strdup(const char *s) {
+    size_t len = strlen(s);
+    char *copy = arena_alloc(len + 1);
+    memcpy(copy, s, len + 1);
+    return copy;
+}
+
+// Join strings with a separator in one allocation, with no length limit
+char *arena_join(char **parts, const char *separator) {
+    size_t sep_len = strlen(separator);
+    size_t total = 1;
+
+    for (int i = 0; parts[i] != NULL; i++) {
+        total += strlen(parts[i]) + (i > 0 ? sep_len : 0);
+    }
+
+    char *joined = arena_alloc(total);
+    char *p = joined;
+    for (int i = 0; parts[i] != NULL; i++) {
+        if (i > 0) {
+            memcpy(p, separator, sep_len);
+            p += sep_len;
+        }
+        size_t len = strlen(parts[i]);
+        memcpy(p, parts[i], len);
+        p += len;
+    }
+    *p = '\0';
+
+    return joined;
+}
+
+char *arena_printf(const char *format, ...) {
+    va_list ap, retry;
+
+    va_start(ap, format);
+    va_copy(retry, ap);
+    int len = vsnprintf(NULL, 0, format, ap);
+    va_end(ap);
+
+    char *text = arena_alloc(len > 0 ? (size_t)len + 1 : 1);
+    vsnprintf(text, len > 0 ? (size_t)len + 1 : 1, format, retry);
+    va_end(retry);
+
+    return text;
+}
+
+// Allocation count and bytes since the last reset
+void arena_usage(size_t *allocations, size_t *bytes) {
+    *allocations = thread_arena.allocations;
+    *bytes = thread_arena.bytes;
+}
+
+// Free everything at once, keeping the oldest block for reuse
+void arena_reset(void) {
+    Arena *arena = &thread_arena;
+    ArenaBlock *block = arena->current;
+
+    while (block != NULL && block->next != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    if (block != NULL) block->used = 0;
+
+    arena->current = block;
+    arena->last = NULL;
+    arena->allocations = 0;
+    arena->bytes = 0;
+}
+
+// Return all of the calling thread's arena memory (before a thread exits)
+void arena_release(void) {
+    arena_reset();
+    free(thread_arena.current);
+    thread_arena.current = NULL;
+}
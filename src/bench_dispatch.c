@@ -0,0 +1,63 @@
+// Micro-benchmark for builtin command dispatch
+//
+// Build together with the shell sources, without the shell's main():
+//   gcc -O2 -DCSHELL_NO_MAIN -o bench_dispatch src/bench_dispatch.c $(ls src/*.c | grep -v 'test_\|bench_') -lcurl -lpthread -lm
+//
+// Compares the old linear strcmp scan over builtin_commands[] with
+// find_builtin() for a hit near the end of the table and for a miss.
+
+#include "cshell.h"
+
+#define ITERATIONS 10000000
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// The lookup execute_command used before the hash table
+static BuiltinCommand *linear_lookup(const char *name) {
+    for (int i = 0; builtin_commands[i].name != NULL; i++) {
+        if (strcmp(name, builtin_commands[i].name) == 0) {
+            return &builtin_commands[i];
+        }
+    }
+    return NULL;
+}
+
+// Keep the compiler from hoisting the lookups out of the loop
+static volatile const char *sink_name;
+static BuiltinCommand *volatile sink;
+
+static void run(const char *label, BuiltinCommand *(*lookup)(const char *), const char *name) {
+    sink_name = name;
+
+    double start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        sink = lookup((const char *)sink_name);
+    }
+    double elapsed = now_ns() - start;
+
+    printf("  %-8s %-12s %7.2f ns/lookup  (%s)\n", label, name,
+           elapsed / ITERATIONS, sink ? "hit" : "miss");
+}
+
+int main(int argc, char **argv) {
+    // The last builtin is the worst case for the linear scan
+    int count = 0;
+    while (builtin_commands[count].name != NULL) count++;
+
+    const char *hit = argc > 1 ? argv[1] : builtin_commands[count - 1].name;
+    const char *miss = argc > 2 ? argv[2] : "grep";
+
+    init_builtin_table();
+
+    printf("Builtin dispatch benchmark (%d builtins, %d iterations)\n", count, ITERATIONS);
+    run("linear", linear_lookup, hit);
+    run("hash", find_builtin, hit);
+    run("linear", linear_lookup, miss);
+    run("hash", find_builtin, miss);
+
+    return 0;
+}
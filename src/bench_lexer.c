@@ -0,0 +1,99 @@
+// Throughput benchmark for the command line lexer
+//
+// Build together with the shell sources, without the shell's main():
+//   gcc -O2 -DCSHELL_NO_MAIN -o bench_lexer src/bench_lexer.c $(ls src/*.c | grep -v 'test_\|bench_') -lcurl -lpthread -lm
+//   ./bench_lexer [iterations]
+//
+// Lexes multi-KB command lines with each scan implementation the CPU
+// supports and reports MB/s, next to the old strtok() split (which knows
+// nothing about quotes) as a baseline. The lines mix long words, quoted
+// arguments and pipes, roughly like a generated `xargs`-style command.
+
+#include "cshell.h"
+
+#define DEFAULT_ITERATIONS 20000
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Build a line of about size bytes out of repeated argument patterns
+static char *make_line(size_t size, int quoted) {
+    static const char *plain[] = {
+        "--output-directory=/var/tmp/build/artifacts/release",
+        "src/components/renderer/pipeline/shader_cache.c",
+        "-DCONFIG_ENABLE_EXPERIMENTAL_FEATURES=1",
+        "x",
+    };
+    static const char *quotes[] = {
+        "\"a message with several words in it\"",
+        "'/path with spaces/and | pipes/file.txt'",
+        "escaped\\ space",
+        "|",
+    };
+
+    char *line = malloc(size + 128);
+    size_t len = 0;
+    for (int i = 0; len < size; i++) {
+        const char *word = quoted && i % 3 == 0 ? quotes[i % 4] : plain[i % 4];
+        len += (size_t)sprintf(line + len, "%s ", word);
+    }
+    line[len] = '\0';
+    return line;
+}
+
+// The tokenizer process_command used before the lexer
+static int strtok_split(char *line) {
+    int count = 0;
+    for (char *tok = strtok(line, " \t\n"); tok != NULL; tok = strtok(NULL, " \t\n")) count++;
+    return count;
+}
+
+static volatile int sink;
+
+static void run(const char *label, const char *line, int iterations, int use_strtok) {
+    size_t len = strlen(line);
+    char *copy = malloc(len + 1);
+    int tokens = 0;
+
+    double start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        memcpy(copy, line, len + 1);
+        if (use_strtok) {
+            tokens = strtok_split(copy);
+        } else {
+            char **args;
+            tokens = tokenize_command(copy, &args);
+            arena_reset();
+        }
+        sink = tokens;
+    }
+    double elapsed = now_ns() - start;
+
+    printf("  %-8s %7.0f MB/s  %8.2f us/line  (%d tokens)\n", label,
+           (double)len * iterations / (elapsed / 1e9) / 1e6, elapsed / iterations / 1e3, tokens);
+    free(copy);
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+    static const char *impls[] = {"scalar", "sse2", "avx2"};
+    size_t sizes[] = {1024, 4096, 16384};
+
+    for (int q = 0; q < 2; q++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            char *line = make_line(sizes[s], q);
+            printf("%zu-byte line, %s:\n", strlen(line), q ? "with quotes and pipes" : "plain words");
+
+            run("strtok", line, iterations, 1);
+            for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+                if (lexer_select(impls[i]) != NULL) run(impls[i], line, iterations, 0);
+            }
+            free(line);
+        }
+    }
+
+    return 0;
+}
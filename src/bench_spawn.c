@@ -0,0 +1,82 @@
+// Benchmark: fork()+execv() versus posix_spawn() at different RSS sizes
+//
+//   gcc -O2 -o bench_spawn src/bench_spawn.c
+//   ./bench_spawn [iterations]
+//
+// For each size the process first allocates and touches that much memory,
+// then launches /bin/true repeatedly with both methods. fork() has to copy
+// the page tables covering the whole heap, so its cost grows with RSS;
+// posix_spawn() (clone with CLONE_VM|CLONE_VFORK in glibc) does not.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double time_fork_exec(char **argv, int iterations) {
+    double start = now_us();
+    for (int i = 0; i < iterations; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            execv(argv[0], argv);
+            _exit(127);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+    }
+    return (now_us() - start) / iterations;
+}
+
+static double time_posix_spawn(char **argv, int iterations) {
+    double start = now_us();
+    for (int i = 0; i < iterations; i++) {
+        pid_t pid;
+        if (posix_spawn(&pid, argv[0], NULL, NULL, argv, environ) != 0) {
+            perror("posix_spawn");
+            exit(1);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+    }
+    return (now_us() - start) / iterations;
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    const size_t sizes_mb[] = {1, 16, 64, 256, 1024};
+    char *child_argv[] = {"/bin/true", NULL};
+
+    printf("%10s %16s %16s %8s\n", "RSS (MB)", "fork+exec (us)", "posix_spawn (us)", "ratio");
+
+    for (size_t i = 0; i < sizeof(sizes_mb) / sizeof(sizes_mb[0]); i++) {
+        size_t bytes = sizes_mb[i] * 1024 * 1024;
+        char *ballast = malloc(bytes);
+        if (ballast == NULL) {
+            printf("%10zu (allocation failed, stopping)\n", sizes_mb[i]);
+            break;
+        }
+
+        // Touch every page so it is resident and mapped
+        memset(ballast, 1, bytes);
+
+        double fork_us = time_fork_exec(child_argv, iterations);
+        double spawn_us = time_posix_spawn(child_argv, iterations);
+
+        printf("%10zu %16.1f %16.1f %7.1fx\n", sizes_mb[i], fork_us, spawn_us, fork_us / spawn_us);
+
+        free(ballast);
+    }
+
+    return 0;
+}
@@ -20,6 +20,8 @@ int cmd_help(char **args) {
 
 // Exit command - Exit the shell
 int cmd_exit(char **args) {
+    // exit [status]; without one, the last command's status is kept
+    if (args[1] != NULL) last_exit_status = atoi(args[1]) & 0xff;
     shell_running = 0;
     return 0;
 }
@@ -78,19 +80,19 @@ int cmd_clear(char **args) {
 // Echo command
 int cmd_echo(char **args) {
     if (args[1] == NULL || strcmp(args[1], "--help") == 0) {
-        printf("Usage: echo [text]\n");
-        printf("Display a line of text.\n");
+        sh_printf("Usage: echo [text]\n");
+        sh_printf("Display a line of text.\n");
         return 1;
     }
     
     // Start from args[1] to skip the command name
     for (int i = 1; args[i] != NULL; i++) {
-        printf("%s", args[i]);
+        sh_write(args[i], strlen(args[i]));
         if (args[i + 1] != NULL) {
-            printf(" ");
+            sh_write(" ", 1);
         }
     }
-    printf("\n");
+    sh_write("\n", 1);
     
     return 1;
 }
@@ -244,30 +246,136 @@ int cmd_rm(char **args) {
 
 // Cat command - Display file content
 int cmd_cat(char **args) {
-    if (args[1] == NULL || strcmp(args[1], "--help") == 0) {
-        printf("Usage: cat [file]\n");
-        printf("Display the contents of a file.\n");
+    int from_input = args[1] == NULL || strcmp(args[1], "-") == 0;
+    
+    if ((args[1] == NULL && !stream_input_is_piped()) ||
+        (args[1] != NULL && strcmp(args[1], "--help") == 0)) {
+        sh_printf("Usage: cat [file | -]\n");
+        sh_printf("Display the contents of a file.\n");
+        sh_printf("Without a file (or with -), copies piped input to the output.\n");
+        return 1;
+    }
+    
+    // Piped input: pass it through (an in-process buffer just changes hands)
+    if (from_input) {
+        stream_forward(shell_in, shell_out);
         return 1;
     }
     
     FILE *file = fopen(args[1], "r");
     if (file == NULL) {
-        perror("cat");
+        sh_perror("cat");
+        last_exit_status = 1;
         return 1;
     }
     
-    char buffer[MAX_LINE_LENGTH];
+    // Blank lines around the content are for the terminal only
+    int decorate = stream_output_is_terminal();
     
-    printf("\n");
-    while (fgets(buffer, sizeof(buffer), file) != NULL) {
-        printf("%s", buffer);
-    }
-    printf("\n");
+    if (decorate) sh_write("\n", 1);
+    stream_write_file(shell_out, file);
+    if (decorate) sh_write("\n", 1);
     
     fclose(file);
     return 1;
 }
 
+// True and false commands - Succeed or fail, for conditions and loops
+int cmd_true(char **args) {
+    (void)args;
+    return 1;
+}
+
+int cmd_false(char **args) {
+    (void)args;
+    last_exit_status = 1;
+    return 1;
+}
+
+// Evaluate one test expression of argc words; 0 true, 1 false, 2 error
+static int test_expression(char **args, int argc) {
+    if (argc > 0 && strcmp(args[0], "!") == 0) {
+        int result = test_expression(args + 1, argc - 1);
+        return result == 2 ? 2 : !result;
+    }
+    
+    if (argc == 0) return 1;
+    if (argc == 1) return args[0][0] == '\0';
+    
+    if (argc == 2) {
+        const char *op = args[0];
+        const char *arg = args[1];
+        struct stat st;
+        
+        if (strcmp(op, "-n") == 0) return arg[0] == '\0';
+        if (strcmp(op, "-z") == 0) return arg[0] != '\0';
+        if (strcmp(op, "-e") == 0) return stat(arg, &st) != 0;
+        if (strcmp(op, "-f") == 0) return stat(arg, &st) != 0 || !S_ISREG(st.st_mode);
+        if (strcmp(op, "-d") == 0) return stat(arg, &st) != 0 || !S_ISDIR(st.st_mode);
+        if (strcmp(op, "-s") == 0) return stat(arg, &st) != 0 || st.st_size == 0;
+        if (strcmp(op, "-r") == 0) return access(arg, R_OK) != 0;
+        if (strcmp(op, "-w") == 0) return access(arg, W_OK) != 0;
+        if (strcmp(op, "-x") == 0) return access(arg, X_OK) != 0;
+        printf("test: %s: unary operator expected\n", op);
+        return 2;
+    }
+    
+    if (argc == 3) {
+        const char *op = args[1];
+        
+        if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(args[0], args[2]) != 0;
+        if (strcmp(op, "!=") == 0) return strcmp(args[0], args[2]) == 0;
+        
+        static const char *numeric[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+        for (int i = 0; i < 6; i++) {
+            if (strcmp(op, numeric[i]) != 0) continue;
+            
+            char *end_a, *end_b;
+            long a = strtol(args[0], &end_a, 10);
+            long b = strtol(args[2], &end_b, 10);
+            if (*args[0] == '\0' || *end_a != '\0' || *args[2] == '\0' || *end_b != '\0') {
+                printf("test: integer expression expected\n");
+                return 2;
+            }
+            int results[] = {a == b, a != b, a < b, a <= b, a > b, a >= b};
+            return !results[i];
+        }
+        printf("test: %s: binary operator expected\n", op);
+        return 2;
+    }
+    
+    printf("test: too many arguments\n");
+    return 2;
+}
+
+// Test command - Check strings, numbers and files (also spelled [ ... ])
+int cmd_test(char **args) {
+    int argc = 0;
+    while (args[argc] != NULL) argc++;
+    
+    if (strcmp(args[0], "[") == 0) {
+        if (strcmp(args[argc - 1], "]") != 0) {
+            printf("[: missing ']'\n");
+            last_exit_status = 2;
+            return 1;
+        }
+        argc--;
+    }
+    
+    if (argc == 2 && strcmp(args[1], "--help") == 0) {
+        printf("Usage: test EXPRESSION   or   [ EXPRESSION ]\n");
+        printf("Succeeds if the expression is true:\n");
+        printf("  STRING, -n STRING, -z STRING, S1 = S2, S1 != S2\n");
+        printf("  N1 -eq N2 (also -ne -lt -le -gt -ge)\n");
+        printf("  -e FILE, -f FILE, -d FILE, -s FILE, -r FILE, -w FILE, -x FILE\n");
+        printf("  ! EXPRESSION\n");
+        return 1;
+    }
+    
+    last_exit_status = test_expression(args + 1, argc - 1);
+    return 1;
+}
+
 // Count files command - Count files in current directory
 int cmd_countfiles(char **args) {
     if (args[1] != NULL && strcmp(args[1], "--help") == 0) {
@@ -55,6 +55,9 @@ int cmd_todo(char **args) {
         return 1;
     }
     
+    // The list is read from disk on first use
+    ensure_todo_list();
+    
     if (strcmp(args[1], "add") == 0) {
         if (args[2] == NULL) {
             printf("Error: Missing todo item content\n");
@@ -342,6 +345,9 @@ int cmd_note(char **args) {
         return 1;
     }
     
+    // The list is read from disk on first use
+    ensure_notes();
+    
     if (strcmp(args[1], "new") == 0) {
         if (args[2] == NULL) {
             printf("Error: Missing note title\n");
@@ -367,7 +373,8 @@ int cmd_note(char **args) {
         // Set the timestamp
         notes[note_count].timestamp = time(NULL);
         
-        // Prompt for content
+        // Prompt for content, read with the terminal's own line editing
+        terminal_restore();
         printf("Enter note content (end with a line containing only '.' or press Ctrl+D):\n");
         
         // Read multiple lines of content
@@ -475,6 +482,7 @@ int cmd_note(char **args) {
         }
         
         printf("Editing note: %s\n", notes[note_num].title);
+        terminal_restore();
         
         // Prompt for new title
         printf("New title (leave empty to keep current): ");
@@ -10,20 +10,13 @@ int cmd_weather(char **args) {
     }
     
     // Build the location string
-    char location[MAX_LINE_LENGTH] = "";
-    for (int i = 1; args[i] != NULL; i++) {
-        strcat(location, args[i]);
-        if (args[i + 1] != NULL) {
-            strcat(location, "+");
-        }
-    }
+    char *location = arena_join(args + 1, "+");
     
     // First, get the basic weather data without emojis (more reliable)
-    char url[MAX_LINE_LENGTH];
-    snprintf(url, sizeof(url), "https://wttr.in/%s?format=%%l:+%%C+%%t+%%w+%%h+%%p+%%m&m", location);
+    char *url = arena_printf("https://wttr.in/%s?format=%%l:+%%C+%%t+%%w+%%h+%%p+%%m&m", location);
     
     // Initialize CURL
-    CURL *curl = curl_easy_init();
+    CURL *curl = shell_curl_init();
     if (!curl) {
         printf("Error: Failed to initialize CURL\n");
         return 1;
@@ -31,9 +24,7 @@ int cmd_weather(char **args) {
     
     // Set up response data
     ResponseData resp;
-    resp.size = 0;
-    resp.data = malloc(1);
-    resp.data[0] = '\0';
+    response_init(&resp);
     
     // Set CURL options
     curl_easy_setopt(curl, CURLOPT_URL, url);
@@ -43,7 +34,7 @@ int cmd_weather(char **args) {
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10);
     
     // Perform the request
-    CURLcode res = curl_easy_perform(curl);
+    CURLcode res = shell_curl_perform(curl, url);
     
     // Check for errors
     if (res != CURLE_OK) {
@@ -140,20 +131,16 @@ int cmd_weather(char **args) {
             printf("Humidity:    %s\n", humidity);
             
             // Get a more detailed forecast just for precipitation
-            char detailed_url[MAX_LINE_LENGTH];
-            snprintf(detailed_url, sizeof(detailed_url), "https://wttr.in/%s?format=%%p&m", location);
+            char *detailed_url = arena_printf("https://wttr.in/%s?format=%%p&m", location);
             
             // Reset response data
-            free(resp.data);
-            resp.size = 0;
-            resp.data = malloc(1);
-            resp.data[0] = '\0';
+            response_init(&resp);
             
             // Set new URL
             curl_easy_setopt(curl, CURLOPT_URL, detailed_url);
             
             // Perform the request
-            res = curl_easy_perform(curl);
+            res = shell_curl_perform(curl, detailed_url);
             
             // Get additional info for sunrise/sunset times
             if (res == CURLE_OK && resp.data && strlen(resp.data) > 0) {
@@ -167,20 +154,16 @@ int cmd_weather(char **args) {
             }
             
             // Get sunrise and sunset times
-            char times_url[MAX_LINE_LENGTH];
-            snprintf(times_url, sizeof(times_url), "https://wttr.in/%s?format=%%S,%%s,%%D", location);
+            char *times_url = arena_printf("https://wttr.in/%s?format=%%S,%%s,%%D", location);
             
             // Reset response data
-            free(resp.data);
-            resp.size = 0;
-            resp.data = malloc(1);
-            resp.data[0] = '\0';
+            response_init(&resp);
             
             // Set new URL
             curl_easy_setopt(curl, CURLOPT_URL, times_url);
             
             // Perform the request
-            res = curl_easy_perform(curl);
+            res = shell_curl_perform(curl, times_url);
             
             if (res == CURLE_OK && resp.data && strlen(resp.data) > 0) {
                 char *details = resp.data;
@@ -243,7 +226,6 @@ int cmd_weather(char **args) {
     
     // Cleanup
     curl_easy_cleanup(curl);
-    free(resp.data);
     
     return 1;
 }
@@ -304,17 +286,11 @@ int cmd_reminder(char **args) {
         }
         
         // Build the message
-        char message[MAX_LINE_LENGTH] = "";
-        for (int i = 3; args[i] != NULL; i++) {
-            strcat(message, args[i]);
-            if (args[i + 1] != NULL) {
-                strcat(message, " ");
-            }
-        }
+        char *message = arena_join(args + 3, " ");
         
         // Set up the reminder
         Reminder *rem = &reminders[reminder_count];
-        strcpy(rem->message, message);
+        snprintf(rem->message, sizeof(rem->message), "%s", message);
         rem->timestamp = time(NULL) + (minutes * 60);
         rem->active = 1;
         
@@ -222,7 +222,7 @@ int cmd_news(char **args) {
     printf("Fetching news from: %s\n", url);
     
     // Initialize CURL
-    CURL *curl = curl_easy_init();
+    CURL *curl = shell_curl_init();
     if (!curl) {
         printf("Error: Failed to initialize CURL\n");
         return 1;
@@ -230,9 +230,7 @@ int cmd_news(char **args) {
     
     // Set up response data
     ResponseData resp;
-    resp.size = 0;
-    resp.data = malloc(1);
-    resp.data[0] = '\0';
+    response_init(&resp);
     
     // Set CURL options
     curl_easy_setopt(curl, CURLOPT_URL, url);
@@ -243,7 +241,7 @@ int cmd_news(char **args) {
     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
     
     // Perform the request
-    CURLcode res = curl_easy_perform(curl);
+    CURLcode res = shell_curl_perform(curl, url);
     
     // Check for errors
     if (res != CURLE_OK) {
@@ -454,7 +452,6 @@ int cmd_news(char **args) {
     
     // Cleanup
     curl_easy_cleanup(curl);
-    free(resp.data);
     
     return 1;
 }
@@ -93,7 +93,7 @@ int cmd_meme(char **args) {
     // Verify URL accessibility using curl before opening
     printf("Verifying URL accessibility...\n");
     
-    CURL *curl = curl_easy_init();
+    CURL *curl = shell_curl_init();
     if (curl) {
         // Set up curl to just check the headers without downloading content
         curl_easy_setopt(curl, CURLOPT_URL, meme_url);
@@ -104,7 +104,7 @@ int cmd_meme(char **args) {
         // Use a more standard user agent
         curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/91.0.4472.124 Safari/537.36");
         
-        CURLcode res = curl_easy_perform(curl);
+        CURLcode res = shell_curl_perform(curl, meme_url);
         long http_code = 0;
         curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
         curl_easy_cleanup(curl);
@@ -266,59 +266,65 @@ int cmd_meme(char **args) {
 
 // Word count command - Count words in text
 int cmd_wordcount(char **args) {
-    if (args[1] == NULL || strcmp(args[1], "--help") == 0) {
-        printf("Usage: wordcount [text | -f filename]\n");
-        printf("Count the number of characters, words, and lines in the text.\n");
-        printf("Use -f flag to count from a file.\n");
+    if ((args[1] == NULL && !stream_input_is_piped()) ||
+        (args[1] != NULL && strcmp(args[1], "--help") == 0)) {
+        sh_printf("Usage: wordcount [text | -f filename]\n");
+        sh_printf("Count the number of characters, words, and lines in the text.\n");
+        sh_printf("Use -f flag to count from a file.\n");
+        sh_printf("Without arguments, counts piped input.\n");
         return 1;
     }
     
-    char text[MAX_LINE_LENGTH * 10] = "";
+    const char *text = NULL;
+    size_t text_len = 0;
+    ShellStream file_stream;
     int from_file = 0;
+    char joined[MAX_LINE_LENGTH * 10] = "";
     
-    if (strcmp(args[1], "-f") == 0) {
+    if (args[1] == NULL) {
+        // Piped input is counted in place, whatever its size
+        text = stream_read_all(shell_in, &text_len);
+    } else if (strcmp(args[1], "-f") == 0) {
         if (args[2] == NULL) {
-            printf("Error: Missing filename\n");
+            sh_printf("Error: Missing filename\n");
+            last_exit_status = 1;
             return 1;
         }
         
         from_file = 1;
-        FILE *file = fopen(args[2], "r");
-        if (file == NULL) {
-            perror("wordcount");
+        int fd = open(args[2], O_RDONLY);
+        if (fd < 0) {
+            sh_perror("wordcount");
+            last_exit_status = 1;
             return 1;
         }
         
-        size_t total_read = 0;
-        size_t bytes_read;
-        while ((bytes_read = fread(text + total_read, 1, 
-                                   (MAX_LINE_LENGTH * 10) - total_read - 1, file)) > 0) {
-            total_read += bytes_read;
-            if (total_read >= (MAX_LINE_LENGTH * 10) - 1) {
-                break;
-            }
-        }
-        
-        text[total_read] = '\0';
-        fclose(file);
+        stream_init_fd(&file_stream, fd);
+        text = stream_read_all(&file_stream, &text_len);
+        close(fd);
     } else {
         // Concatenate all arguments
         for (int i = 1; args[i] != NULL; i++) {
-            strcat(text, args[i]);
+            strcat(joined, args[i]);
             if (args[i + 1] != NULL) {
-                strcat(text, " ");
+                strcat(joined, " ");
             }
         }
+        text = joined;
+        text_len = strlen(joined);
     }
     
-    // Count characters (excluding null terminator)
-    int char_count = strlen(text);
-    
-    // Count words
-    int word_count = 0;
+    // Count characters, words and lines in one pass
+    size_t char_count = text_len;
+    size_t word_count = 0;
+    size_t line_count = 0;
     int in_word = 0;
     
-    for (int i = 0; text[i] != '\0'; i++) {
+    for (size_t i = 0; i < text_len; i++) {
+        if (text[i] == '\n') {
+            line_count++;
+        }
+        
         if (isspace((unsigned char)text[i])) {
             in_word = 0;
         } else if (!in_word) {
@@ -327,29 +333,25 @@ int cmd_wordcount(char **args) {
         }
     }
     
-    // Count lines
-    int line_count = 0;
-    for (int i = 0; text[i] != '\0'; i++) {
-        if (text[i] == '\n') {
-            line_count++;
-        }
-    }
-    
     // Add one for the last line if there are characters and no trailing newline
     if (char_count > 0 && text[char_count - 1] != '\n') {
         line_count++;
     }
     
-    printf("\n");
     if (from_file) {
-        printf("Word count for file: %s\n", args[2]);
+        stream_free(&file_stream);
+    }
+    
+    sh_printf("\n");
+    if (from_file) {
+        sh_printf("Word count for file: %s\n", args[2]);
     } else {
-        printf("Word count for input text:\n");
+        sh_printf("Word count for input text:\n");
     }
-    printf("Characters: %d\n", char_count);
-    printf("Words: %d\n", word_count);
-    printf("Lines: %d\n", line_count);
-    printf("\n");
+    sh_printf("Characters: %zu\n", char_count);
+    sh_printf("Words: %zu\n", word_count);
+    sh_printf("Lines: %zu\n", line_count);
+    sh_printf("\n");
     
     return 1;
 }
@@ -433,6 +435,7 @@ int cmd_mathquiz(char **args) {
     printf("Answer %d questions. Type your answer after each question.\n", num_questions);
     printf("For decimal answers, round to 2 decimal places (e.g., 3.14).\n");
     printf("For fraction answers, use the format a/b (e.g., 1/2).\n\n");
+    terminal_restore();
     
     for (int i = 0; i < num_questions; i++) {
         // Choose a simple question type for better compatibility with the shell
@@ -648,17 +651,18 @@ int cmd_dayfact(char **args) {
 // Colorize command - Colorize text output
 int cmd_colorize(char **args) {
     if (args[1] == NULL || strcmp(args[1], "--help") == 0) {
-        printf("Usage: colorize [color] [text]\n");
-        printf("Display colored text.\n\n");
-        printf("Available colors:\n");
-        printf(COLOR_RED "red " COLOR_RESET);
-        printf(COLOR_GREEN "green " COLOR_RESET);
-        printf(COLOR_YELLOW "yellow " COLOR_RESET);
-        printf(COLOR_BLUE "blue " COLOR_RESET);
-        printf(COLOR_MAGENTA "magenta " COLOR_RESET);
-        printf(COLOR_CYAN "cyan " COLOR_RESET);
-        printf(COLOR_WHITE "white " COLOR_RESET);
-        printf(COLOR_BOLD "bold\n" COLOR_RESET);
+        sh_printf("Usage: colorize [color] [text]\n");
+        sh_printf("Display colored text.\n");
+        sh_printf("Without text, colorizes piped input.\n\n");
+        sh_printf("Available colors:\n");
+        sh_printf(COLOR_RED "red " COLOR_RESET);
+        sh_printf(COLOR_GREEN "green " COLOR_RESET);
+        sh_printf(COLOR_YELLOW "yellow " COLOR_RESET);
+        sh_printf(COLOR_BLUE "blue " COLOR_RESET);
+        sh_printf(COLOR_MAGENTA "magenta " COLOR_RESET);
+        sh_printf(COLOR_CYAN "cyan " COLOR_RESET);
+        sh_printf(COLOR_WHITE "white " COLOR_RESET);
+        sh_printf(COLOR_BOLD "bold\n" COLOR_RESET);
         return 1;
     }
     
@@ -682,27 +686,29 @@ int cmd_colorize(char **args) {
     } else if (strcmp(args[1], "bold") == 0) {
         color_code = COLOR_BOLD;
     } else {
-        printf("Unknown color: %s\n", args[1]);
-        printf("Available colors: red, green, yellow, blue, magenta, cyan, white, bold\n");
+        sh_printf("Unknown color: %s\n", args[1]);
+        sh_printf("Available colors: red, green, yellow, blue, magenta, cyan, white, bold\n");
         return 1;
     }
     
     if (args[2] == NULL) {
-        printf("Error: Missing text to colorize\n");
+        if (!stream_input_is_piped()) {
+            sh_printf("Error: Missing text to colorize\n");
+            return 1;
+        }
+        
+        // Wrap the piped input in the color codes
+        sh_printf("%s", color_code);
+        stream_forward(shell_in, shell_out);
+        sh_printf("%s", COLOR_RESET);
         return 1;
     }
     
     // Build the text
-    char text[MAX_LINE_LENGTH] = "";
-    for (int i = 2; args[i] != NULL; i++) {
-        strcat(text, args[i]);
-        if (args[i + 1] != NULL) {
-            strcat(text, " ");
-        }
-    }
+    char *text = arena_join(args + 2, " ");
     
     // Print colored text
-    printf("%s%s%s\n", color_code, text, COLOR_RESET);
+    sh_printf("%s%s%s\n", color_code, text, COLOR_RESET);
     
     return 1;
 }
@@ -739,12 +745,10 @@ int cmd_calculator(char **args) {
     }
 
     // Build the expression string
-    char expression[MAX_LINE_LENGTH] = "";
-    for (int i = 1; args[i] != NULL; i++) {
-        strcat(expression, args[i]);
-        if (args[i + 1] != NULL) {
-            strcat(expression, " ");
-        }
+    char *expression = arena_join(args + 1, " ");
+    if (strlen(expression) >= MAX_LINE_LENGTH) {
+        printf("Error: Expression too long\n");
+        return 1;
     }
     
     // Handle some common functions and constants that aren't part of the standard C library
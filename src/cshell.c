@@ -8,7 +8,10 @@ int note_count = 0;
 Reminder reminders[MAX_REMINDERS];
 int reminder_count = 0;
 int shell_running = 1;
+volatile sig_atomic_t shell_interrupted = 0;  // Ctrl-C, for loops that run only builtins
+int interactive = 1;        // Prompt, line editing and history (off for scripts)
 int debug_mode = DEBUG_OFF; // Default debug mode is off
+__thread int last_exit_status = 0;  // Exit status of the last command or pipeline
 char shell_directory[MAX_PATH_LENGTH];
 char *command_history[MAX_HISTORY] = {NULL};
 int history_count = 0;
@@ -16,55 +19,84 @@ int history_position = 0;
 
 // Built-in command array
 BuiltinCommand builtin_commands[] = {
-    {"help", cmd_help, "Display help information"},
-    {"exit", cmd_exit, "Exit the shell"},
-    {"quit", cmd_exit, "Exit the shell"},
-    {"cd", cmd_cd, "Change directory"},
-    {"pwd", cmd_pwd, "Print working directory"},
-    {"clear", cmd_clear, "Clear the screen"},
-    {"echo", cmd_echo, "Echo a message"},
-    {"ls", cmd_ls, "List directory contents"},
-    {"mkdir", cmd_mkdir, "Create a directory"},
-    {"rm", cmd_rm, "Remove a file or directory"},
-    {"cat", cmd_cat, "Display file content"},
-    {"history", cmd_history, "Display command history"},
+    {"help", cmd_help, "Display help information", 0},
+    {"exit", cmd_exit, "Exit the shell", 0},
+    {"quit", cmd_exit, "Exit the shell", 0},
+    {"cd", cmd_cd, "Change directory", 0},
+    {"pwd", cmd_pwd, "Print working directory", 0},
+    {"clear", cmd_clear, "Clear the screen", 0},
+    {"echo", cmd_echo, "Echo a message", BUILTIN_STREAMS | BUILTIN_THREADS},
+    {"ls", cmd_ls, "List directory contents", 0},
+    {"mkdir", cmd_mkdir, "Create a directory", 0},
+    {"rm", cmd_rm, "Remove a file or directory", 0},
+    {"cat", cmd_cat, "Display file content", BUILTIN_STREAMS | BUILTIN_THREADS},
+    {"history", cmd_history, "Display command history", 0},
+    {"hash", cmd_hash, "Show or reset remembered command paths", 0},
+    {"true", cmd_true, "Do nothing, successfully", 0},
+    {"false", cmd_false, "Do nothing, unsuccessfully", 0},
+    {"test", cmd_test, "Check strings, numbers and files", 0},
+    {"[", cmd_test, "Check strings, numbers and files", 0},
     
     // Feature commands
-    {"todo", cmd_todo, "Manage a to-do list"},
-    {"note", cmd_note, "Create and manage notes"},
-    {"weather", cmd_weather, "Display weather information"},
-    {"timer", cmd_timer, "Set a timer"},
-    {"reminder", cmd_reminder, "Set and manage reminders"},
-    {"quote", cmd_quote, "Display a random quote"},
-    {"search", cmd_search, "Search the web"},
-    {"news", cmd_news, "Display news headlines"},
-    {"joke", cmd_joke, "Display a random joke"},
-    {"ascii", cmd_ascii, "Generate ASCII art"},
-    {"sysinfo", cmd_sysinfo, "Display system information"},
-    {"meme", cmd_meme, "Fetch a random meme"},
-    {"wordcount", cmd_wordcount, "Count words in text"},
-    {"mathquiz", cmd_mathquiz, "Take a math quiz"},
-    {"dayfact", cmd_dayfact, "Display a fact about today"},
-    {"colorize", cmd_colorize, "Colorize text output"},
-    {"debug", cmd_debug, "Toggle debug mode"},
+    {"todo", cmd_todo, "Manage a to-do list", 0},
+    {"note", cmd_note, "Create and manage notes", 0},
+    {"weather", cmd_weather, "Display weather information", 0},
+    {"timer", cmd_timer, "Set a timer", 0},
+    {"reminder", cmd_reminder, "Set and manage reminders", 0},
+    {"quote", cmd_quote, "Display a random quote", 0},
+    {"search", cmd_search, "Search the web", 0},
+    {"news", cmd_news, "Display news headlines", 0},
+    {"joke", cmd_joke, "Display a random joke", 0},
+    {"ascii", cmd_ascii, "Generate ASCII art", 0},
+    {"sysinfo", cmd_sysinfo, "Display system information", 0},
+    {"meme", cmd_meme, "Fetch a random meme", 0},
+    {"wordcount", cmd_wordcount, "Count words in text", BUILTIN_STREAMS | BUILTIN_THREADS},
+    {"mathquiz", cmd_mathquiz, "Take a math quiz", 0},
+    {"dayfact", cmd_dayfact, "Display a fact about today", 0},
+    {"colorize", cmd_colorize, "Colorize text output", BUILTIN_STREAMS | BUILTIN_THREADS},
+    {"debug", cmd_debug, "Toggle debug mode", 0},
+    
+    // Job control
+    {"jobs", cmd_jobs, "List background jobs", 0},
+    {"fg", cmd_fg, "Bring a job to the foreground", 0},
+    {"bg", cmd_bg, "Continue a job in the background", 0},
+    {"wait", cmd_wait, "Wait for background jobs", 0},
+    {"kill", cmd_kill, "Send a signal to a job or process", 0},
+    {"stats", cmd_stats, "Show per-command latency and resource statistics", 0},
+    {"parallel", cmd_parallel, "Run a command for many arguments in parallel", BUILTIN_STREAMS},
     
     // New custom commands
-    {"countfiles", cmd_countfiles, "Count files in directory"},
-    {"uptime", cmd_uptime, "Show system uptime"},
-    {"processes", cmd_processes, "Display running processes"},
-    {"memory", cmd_memory, "Show memory usage information"},
-    {"thankyou", cmd_thankyou, "Display a thank you message"},
-    {"explorer", cmd_explorer, "Open file explorer"},
-    
-    {NULL, NULL, NULL} // End marker
+    {"countfiles", cmd_countfiles, "Count files in directory", 0},
+    {"uptime", cmd_uptime, "Show system uptime", 0},
+    {"processes", cmd_processes, "Display running processes", 0},
+    {"memory", cmd_memory, "Show memory usage information", 0},
+    {"thankyou", cmd_thankyou, "Display a thank you message", 0},
+    {"explorer", cmd_explorer, "Open file explorer", 0},
+    
+    {NULL, NULL, NULL, 0} // End marker
 };
 
 // Debug command - Toggle debug mode
 int cmd_debug(char **args) {
     if (args[1] != NULL && strcmp(args[1], "--help") == 0) {
         printf("Usage: debug [on|off]\n");
+        printf("       debug trace <file.json>|off\n");
         printf("Toggle debug mode for the shell.\n");
         printf("Without arguments, toggles the current state.\n");
+        printf("'debug trace' records command phases as Chrome trace-event JSON\n");
+        printf("(open the file in chrome://tracing or Perfetto).\n");
+        return 1;
+    }
+    
+    if (args[1] != NULL && strcmp(args[1], "trace") == 0) {
+        if (args[2] == NULL) {
+            printf("Tracing is %s\n", trace_active() ? "on" : "off");
+        } else if (strcmp(args[2], "off") == 0) {
+            trace_close();
+            printf("Tracing stopped\n");
+        } else if (trace_open(args[2]) == 0) {
+            printf("Tracing to %s\n", args[2]);
+        }
         return 1;
     }
     
@@ -88,35 +120,106 @@ int cmd_debug(char **args) {
     return 1;
 }
 
+#ifndef CSHELL_NO_MAIN
 // Main function
-int main(void) {
+int main(int argc, char **argv) {
+    const char *command_string = NULL;
+    const char *script_path = NULL;
+    
+    startup_profile_begin();
+    
+    // --startup-profile reports where the time to the first prompt goes
+    if (argc > 1 && strcmp(argv[1], "--startup-profile") == 0) {
+        startup_profile = 1;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    
+    // The client stays lightweight: no shell state at all
+    if (argc > 2 && strcmp(argv[1], "--connect") == 0) {
+        if (argc > 4 && strcmp(argv[3], "-c") == 0) {
+            return run_client(argv[2], argv[4]);
+        }
+        return run_client(argv[2], NULL);
+    }
+    
+    // cshell --serve socket: one warm shell answering many clients
+    if (argc > 2 && strcmp(argv[1], "--serve") == 0) {
+        interactive = 0;
+        init_shell();
+        return run_server(argv[2]);
+    }
+    
+    // cshell [-c commands | script]
+    if (argc > 2 && strcmp(argv[1], "-c") == 0) {
+        command_string = argv[2];
+    } else if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        fprintf(stderr, "cshell: -c: option requires an argument\n");
+        return 2;
+    } else if (argc > 1) {
+        script_path = argv[1];
+        
+        // $0 is the script, $1 onwards its arguments
+        set_positional_args(argv + 1);
+    }
+    
+    // Anything but a terminal on stdin is batch input as well
+    interactive = command_string == NULL && script_path == NULL && isatty(STDIN_FILENO);
+    
     // Initialize shell
     init_shell();
     
     // Run the shell
-    run_shell();
+    if (command_string != NULL) {
+        run_command_string(command_string);
+    } else if (script_path != NULL) {
+        last_exit_status = run_script_file(script_path);
+    } else if (!interactive) {
+        run_script_fd(STDIN_FILENO);
+    } else {
+        run_shell();
+    }
     
     // Cleanup before exit
     cleanup_shell();
     
-    return 0;
+    return last_exit_status;
 }
+#endif
 
 // Initialize the shell
 void init_shell(void) {
     // Save the shell directory
     getcwd(shell_directory, MAX_PATH_LENGTH);
     
-    // Set up signal handling
-    signal(SIGINT, signal_handler);
+    startup_profile_mark("working directory");
+    
+    // Set up signal handling (a script is simply interrupted)
+    if (interactive) signal(SIGINT, signal_handler);
+#ifndef _WIN32
+    // Writes to a closed pipe should fail with EPIPE, not kill the shell
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    startup_profile_mark("signals");
+    
+    // Set up job control and background job reaping
+    init_jobs(interactive);
+    startup_profile_mark("job control");
     
-    // Initialize the todo list, notes, and reminders
+    // Initialize the todo list, notes, and reminders. Todo items and notes
+    // are loaded by their commands on first use.
     todo_count = 0;
     note_count = 0;
     reminder_count = 0;
     
-    // Load history from file
-    load_history();
+    // Scripts get no banner, prompt or history; the dispatch table is
+    // built by the first command
+    if (!interactive) return;
+    
+    // History and the dispatch table are prepared behind the first prompt
+    start_background_init();
+    startup_profile_mark("background init");
     
     printf(COLOR_CYAN "\n");
     printf(" ------------------------------------------\n");
@@ -129,6 +232,20 @@ void init_shell(void) {
     
     // Print the prompt
     printf(COLOR_GREEN "cshell> " COLOR_RESET);
+    fflush(stdout);
+    startup_profile_mark("banner and prompt");
+    startup_profile_report();
+}
+
+// Microseconds on a clock that only moves forward
+static int64_t monotonic_us(void) {
+#ifdef _WIN32
+    return (int64_t)GetTickCount64() * 1000;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
 }
 
 // Main shell loop
@@ -139,115 +256,18 @@ void run_shell(void) {
         // Get input with history support
         line = get_input_with_history();
         
+        // End of input (Ctrl-D on an empty line)
         if (line == NULL) {
-            continue;
+            printf("\n");
+            break;
         }
         
-        // Process the command
+        // Process the command; this also releases the line. Its history
+        // entry gets the exit status and how long it took.
+        int64_t started = monotonic_us();
         process_command(line);
-        
-        // Free the line
-        free(line);
-    }
-}
-
-// Add command to history
-void add_to_history(const char *command) {
-    // Don't add empty commands or duplicates of the last command
-    if (command[0] == '\0' || 
-        (history_count > 0 && strcmp(command, command_history[history_count - 1]) == 0)) {
-        return;
-    }
-    
-    // If history is full, remove the oldest entry
-    if (history_count >= MAX_HISTORY) {
-        free(command_history[0]);
-        for (int i = 0; i < MAX_HISTORY - 1; i++) {
-            command_history[i] = command_history[i + 1];
-        }
-        history_count--;
-    }
-    
-    // Add the command to history
-    command_history[history_count] = strdup(command);
-    history_count++;
-    history_position = history_count;
-    
-    // Save history to file
-    save_history();
-}
-
-// Save command history to file
-void save_history(void) {
-    char history_path[MAX_PATH_LENGTH];
-    
-    // Create the history file path in the user's home directory
-#ifdef _WIN32
-    char *home_dir = getenv("USERPROFILE");
-#else
-    char *home_dir = getenv("HOME");
-#endif
-    
-    if (home_dir == NULL) {
-        if (debug_mode) printf("Error: Could not get home directory\n");
-        return;
-    }
-    
-    snprintf(history_path, sizeof(history_path), "%s/.cshell_history", home_dir);
-    
-    FILE *history_file = fopen(history_path, "w");
-    if (history_file == NULL) {
-        if (debug_mode) printf("Error: Could not save history to %s\n", history_path);
-        return;
-    }
-    
-    for (int i = 0; i < history_count; i++) {
-        fprintf(history_file, "%s\n", command_history[i]);
-    }
-    
-    fclose(history_file);
-}
-
-// Load command history from file
-void load_history(void) {
-    char history_path[MAX_PATH_LENGTH];
-    
-    // Create the history file path in the user's home directory
-#ifdef _WIN32
-    char *home_dir = getenv("USERPROFILE");
-#else
-    char *home_dir = getenv("HOME");
-#endif
-    
-    if (home_dir == NULL) {
-        if (debug_mode) printf("Error: Could not get home directory\n");
-        return;
-    }
-    
-    snprintf(history_path, sizeof(history_path), "%s/.cshell_history", home_dir);
-    
-    FILE *history_file = fopen(history_path, "r");
-    if (history_file == NULL) {
-        // It's okay if the file doesn't exist yet
-        return;
+        history_finish(last_exit_status, monotonic_us() - started);
     }
-    
-    char buffer[MAX_COMMAND_LENGTH];
-    while (fgets(buffer, sizeof(buffer), history_file) != NULL && history_count < MAX_HISTORY) {
-        // Remove newline character
-        size_t len = strlen(buffer);
-        if (len > 0 && buffer[len - 1] == '\n') {
-            buffer[len - 1] = '\0';
-        }
-        
-        // Add to history array
-        command_history[history_count] = strdup(buffer);
-        history_count++;
-    }
-    
-    history_position = history_count;
-    
-    fclose(history_file);
 }
 
 // Get completions for tab completion
@@ -258,11 +278,12 @@ char **get_completions(const char *partial_cmd) {
     
     int count = 0;
     
-    // Check for built-in commands
-    for (int i = 0; builtin_commands[i].name != NULL; i++) {
-        if (strncmp(builtin_commands[i].name, partial_cmd, strlen(partial_cmd)) == 0) {
-            completions[count++] = strdup(builtin_commands[i].name);
-        }
+    // Check for built-in commands (a contiguous range of the sorted index)
+    const char **names;
+    int first;
+    int matches = completion_range(partial_cmd, &names, &first);
+    for (int i = first; i < first + matches && count < MAX_ARGS; i++) {
+        completions[count++] = strdup(names[i]);
     }
     
     // TODO: Add completion for filenames and directories if needed
@@ -331,11 +352,33 @@ int handle_tab_completion(char *input, int *position) {
     return 1;
 }
 
-// Display command history
-void print_history(void) {
+// Display the newest count history entries; with details, also when each
+// was entered, its exit status, how long it ran and where
+void print_history(int count, int details) {
+    ensure_history();
+    int first = count < history_count ? history_count - count : 0;
+
     printf("\nCommand History:\n");
-    for (int i = 0; i < history_count; i++) {
-        printf("%3d  %s\n", i + 1, command_history[i]);
+    for (int i = first; i < history_count; i++) {
+        const HistoryRecord *record = details ? history_details(i) : NULL;
+        if (record == NULL) {
+            printf("%3d  %s\n", i + 1, history_entry(i));
+            continue;
+        }
+
+        char when[32] = "-";
+        time_t entered = (time_t)record->time;
+        struct tm *local = entered != 0 ? localtime(&entered) : NULL;
+        if (local != NULL) strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", local);
+
+        char status[16] = "-";
+        if (record->exit_status >= 0) snprintf(status, sizeof(status), "%d", record->exit_status);
+
+        char duration[32] = "-";
+        if (record->duration_us >= 0) snprintf(duration, sizeof(duration), "%.3fs", record->duration_us / 1e6);
+
+        printf("%3d  %-19s  %3s  %8s  %s  %s\n", i + 1, when, status, duration,
+               history_record_cwd(record), history_record_command(record));
     }
     printf("\n");
 }
@@ -343,214 +386,122 @@ void print_history(void) {
 // History command implementation
 int cmd_history(char **args) {
     if (args[1] != NULL && strcmp(args[1], "--help") == 0) {
-        printf("Usage: history\n");
-        printf("Display the command history.\n");
+        printf("Usage: history [-l] [count]\n");
+        printf("       history --import file\n");
+        printf("Display the newest command history entries (%d by default).\n", MAX_HISTORY);
+        printf("  -l             Also show when each ran, its exit status, duration and directory\n");
+        printf("  --import file  Add the lines of a plain-text history file\n");
         return 1;
     }
-    
-    print_history();
-    return 1;
-}
 
-// Get input with history and tab completion support
-char *get_input_with_history(void) {
-    char *input = malloc(MAX_COMMAND_LENGTH);
-    if (input == NULL) return NULL;
-    
-    input[0] = '\0';  // Empty string
-    int position = 0;
-    
-#ifdef _WIN32
-    // Windows implementation
-    int ch;
-    while ((ch = _getch()) != '\r') {  // '\r' is Enter key on Windows
-        if (ch == 224 || ch == 0) {  // Special key prefix
-            ch = _getch();  // Get the actual key code
-            
-            // Handle arrow keys
-            if (ch == 72) {  // Up arrow
-                if (history_position > 0) {
-                    history_position--;
-                    
-                    // Clear the current line
-                    printf("\r" COLOR_GREEN "cshell> " COLOR_RESET);
-                    for (int i = 0; i < strlen(input); i++) {
-                        printf(" ");
-                    }
-                    
-                    // Copy the command from history
-                    strcpy(input, command_history[history_position]);
-                    position = strlen(input);
-                    
-                    // Redisplay the line
-                    printf("\r" COLOR_GREEN "cshell> " COLOR_RESET "%s", input);
-                }
-            } else if (ch == 80) {  // Down arrow
-                if (history_position < history_count) {
-                    history_position++;
-                    
-                    // Clear the current line
-                    printf("\r" COLOR_GREEN "cshell> " COLOR_RESET);
-                    for (int i = 0; i < strlen(input); i++) {
-                        printf(" ");
-                    }
-                    
-                    // If at the end of history, clear the line
-                    if (history_position == history_count) {
-                        input[0] = '\0';
-                        position = 0;
-                    } else {
-                        // Copy the command from history
-                        strcpy(input, command_history[history_position]);
-                        position = strlen(input);
-                    }
-                    
-                    // Redisplay the line
-                    printf("\r" COLOR_GREEN "cshell> " COLOR_RESET "%s", input);
-                }
-            }
-        } else if (ch == '\b' || ch == 127) {  // Backspace
-            if (position > 0) {
-                input[--position] = '\0';
-                printf("\b \b");  // Erase character on screen
-            }
-        } else if (ch == KEY_TAB) {  // Tab for completion
-            handle_tab_completion(input, &position);
-        } else if (ch >= 32 && ch <= 126) {  // Printable characters
-            if (position < MAX_COMMAND_LENGTH - 1) {
-                input[position++] = ch;
-                input[position] = '\0';
-                printf("%c", ch);
-            }
+    if (args[1] != NULL && strcmp(args[1], "--import") == 0) {
+        if (args[2] == NULL) {
+            printf("Error: history --import needs a file\n");
+            last_exit_status = 1;
+            return 1;
+        }
+        int count = history_import(args[2]);
+        if (count < 0) {
+            printf("Error: Could not import history from %s\n", args[2]);
+            last_exit_status = 1;
+            return 1;
         }
+        printf("Imported %d history entries\n", count);
+        return 1;
     }
-    
-    printf("\n");
-#else
-    // Unix implementation
-    struct termios old_tio, new_tio;
-    tcgetattr(STDIN_FILENO, &old_tio);
-    new_tio = old_tio;
-    new_tio.c_lflag &= ~(ICANON | ECHO);  // Turn off canonical mode and echo
-    tcsetattr(STDIN_FILENO, TCSANOW, &new_tio);
-    
-    int ch;
-    while ((ch = getchar()) != '\n') {
-        if (ch == KEY_ESCAPE) {
-            // Handle escape sequences for arrow keys
-            if (getchar() == '[') {
-                ch = getchar();
-                
-                if (ch == KEY_UP) {  // Up arrow
-                    if (history_position > 0) {
-                        history_position--;
-                        
-                        // Clear the current line
-                        printf("\r" COLOR_GREEN "cshell> " COLOR_RESET);
-                        for (int i = 0; i < strlen(input); i++) {
-                            printf(" ");
-                        }
-                        
-                        // Copy the command from history
-                        strcpy(input, command_history[history_position]);
-                        position = strlen(input);
-                        
-                        // Redisplay the line
-                        printf("\r" COLOR_GREEN "cshell> " COLOR_RESET "%s", input);
-                    }
-                } else if (ch == KEY_DOWN) {  // Down arrow
-                    if (history_position < history_count) {
-                        history_position++;
-                        
-                        // Clear the current line
-                        printf("\r" COLOR_GREEN "cshell> " COLOR_RESET);
-                        for (int i = 0; i < strlen(input); i++) {
-                            printf(" ");
-                        }
-                        
-                        // If at the end of history, clear the line
-                        if (history_position == history_count) {
-                            input[0] = '\0';
-                            position = 0;
-                        } else {
-                            // Copy the command from history
-                            strcpy(input, command_history[history_position]);
-                            position = strlen(input);
-                        }
-                        
-                        // Redisplay the line
-                        printf("\r" COLOR_GREEN "cshell> " COLOR_RESET "%s", input);
-                    }
-                }
-            }
-        } else if (ch == KEY_BACKSPACE) {  // Backspace
-            if (position > 0) {
-                input[--position] = '\0';
-                printf("\b \b");  // Erase character on screen
-            }
-        } else if (ch == KEY_TAB) {  // Tab for completion
-            handle_tab_completion(input, &position);
-        } else if (ch >= 32 && ch <= 126) {  // Printable characters
-            if (position < MAX_COMMAND_LENGTH - 1) {
-                input[position++] = ch;
-                input[position] = '\0';
-                printf("%c", ch);
-            }
+
+    int details = 0;
+    int count = MAX_HISTORY;
+    for (int i = 1; args[i] != NULL; i++) {
+        if (strcmp(args[i], "-l") == 0) {
+            details = 1;
+        } else if (isdigit((unsigned char)args[i][0])) {
+            count = atoi(args[i]);
+        } else {
+            printf("Error: Unknown history option: %s\n", args[i]);
+            last_exit_status = 1;
+            return 1;
         }
     }
-    
-    // Restore terminal settings
-    tcsetattr(STDIN_FILENO, TCSANOW, &old_tio);
-    printf("\n");
-#endif
-    
-    // Add command to history if not empty
-    if (strlen(input) > 0) {
-        add_to_history(input);
+
+    print_history(count, details);
+    return 1;
+}
+
+// Everything a command allocated from the arena is released at once
+void finish_command(void) {
+    if (debug_mode) {
+        size_t allocations, bytes;
+        arena_usage(&allocations, &bytes);
+        printf(COLOR_YELLOW "Debug: arena: %zu allocations, %zu bytes\n" COLOR_RESET, allocations, bytes);
     }
-    
-    return input;
+    arena_reset();
 }
 
 // Process a command
 void process_command(char *command) {
     if (debug_mode) printf(COLOR_YELLOW "Debug: Processing command: %s\n" COLOR_RESET, command);
     
-    // Parse the command and arguments
-    char *args[MAX_ARGS];
-    char *token;
-    int arg_count = 0;
-    
-    token = strtok(command, " \t\n");
-    while (token != NULL && arg_count < MAX_ARGS - 1) {
-        args[arg_count++] = token;
-        token = strtok(NULL, " \t\n");
-    }
-    args[arg_count] = NULL;
-    
-    // If no command was entered, just return
-    if (arg_count == 0) {
-        printf(COLOR_GREEN "cshell> " COLOR_RESET);
-        return;
+    // The whole command is one trace span, the phases nest inside it
+    uint64_t command_trace = trace_start();
+    char trace_detail[64] = "";
+    if (command_trace != 0) snprintf(trace_detail, sizeof(trace_detail), "%s", command);
+    
+    // Compile the line (or reuse it from the last few): a simple command,
+    // a pipeline or a whole loop
+    uint64_t trace = trace_start();
+    Program *program = compile_line(command, strlen(command));
+    trace_span("compile", trace, NULL);
+    
+    // Run it; the VM releases the arena after each command, which includes
+    // the line itself
+    if (program != NULL) {
+        run_program(program);
+        free_program(program);
+        trace_span("command", command_trace, trace_detail);
+    } else {
+        last_exit_status = 2;
     }
+    arena_reset();
     
-    // Execute the command
-    execute_command(args);
+    // Report background jobs that finished meanwhile
+    jobs_notify();
     
     // Print the prompt
-    printf(COLOR_GREEN "cshell> " COLOR_RESET);
+    if (interactive) printf(COLOR_GREEN "cshell> " COLOR_RESET);
+}
+
+// Run a builtin in the shell process, measured like any other command
+void run_builtin(BuiltinCommand *builtin, char **args, const SpawnOptions *io) {
+#ifndef _WIN32
+    // Builtins report failure by setting last_exit_status themselves
+    StatsMark mark;
+    stats_begin(&mark, RUSAGE_THREAD);
+    last_exit_status = 0;
+    if (io != NULL) {
+        run_builtin_with_io(builtin, args, io);
+    } else {
+        builtin->func(args);
+    }
+    stats_end(&mark, args[0], NULL);
+#else
+    (void)io;
+    last_exit_status = 0;
+    builtin->func(args);
+#endif
 }
 
-// Execute a command
-void execute_command(char **args) {
+// Execute a command, with optional redirected stdin/stdout/stderr
+void execute_command(char **args, const SpawnOptions *io) {
     if (debug_mode) printf(COLOR_YELLOW "Debug: Executing command: %s\n" COLOR_RESET, args[0]);
     
     // Check for built-in commands
-    for (int i = 0; builtin_commands[i].name != NULL; i++) {
-        if (strcmp(args[0], builtin_commands[i].name) == 0) {
-            builtin_commands[i].func(args);
-            return;
-        }
+    uint64_t trace = trace_start();
+    BuiltinCommand *builtin = find_builtin(args[0]);
+    trace_span("builtin lookup", trace, args[0]);
+    if (builtin != NULL) {
+        run_builtin(builtin, args, io);
+        return;
     }
     
     // If not a built-in command, try to execute as an external command
@@ -567,29 +518,44 @@ void execute_command(char **args) {
     }
     
     int result = system(command);
+    last_exit_status = result;
     
     if (result != 0) {
         printf("Error: Command not found or could not be executed: %s\n", args[0]);
     }
 #else
     // Unix implementation
-    pid_t pid = fork();
+    char path[PATH_MAX];
+    if (!path_cache_lookup(args[0], path, sizeof(path))) {
+        printf("Error: Command not found or could not be executed: %s\n", args[0]);
+        last_exit_status = 127;
+        return;
+    }
     
-    if (pid == 0) {
-        // Child process
-        if (execvp(args[0], args) == -1) {
-            perror("execvp");
-            exit(EXIT_FAILURE);
-        }
-    } else if (pid < 0) {
-        // Fork error
-        perror("fork");
+    StatsMark mark;
+    stats_begin(&mark, STATS_CHILDREN);
+    
+    // Run in its own process group so terminal signals reach only the job
+    SpawnOptions opts = {-1, -1, -1, -1};
+    if (io != NULL) opts = *io;
+    if (job_control_enabled()) opts.pgid = 0;
+    
+    // The child gets the terminal in the mode the shell started with
+    terminal_restore();
+    pid_t pid = spawn_command(path, args, &opts);
+    
+    if (pid < 0) {
+        // Spawn error; a stale cached path fails here, so look it up afresh next time
+        perror(args[0]);
+        path_cache_forget(args[0]);
+        last_exit_status = 127;
     } else {
-        // Parent process
-        int status;
-        waitpid(pid, &status, 0);
+        // Parent process: wait until it exits (or is stopped with Ctrl-Z)
+        struct rusage usage;
+        last_exit_status = job_wait_foreground(opts.pgid == 0 ? pid : -1, &pid, 1, &usage);
+        stats_end(&mark, args[0], &usage);
         
-        if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        if (last_exit_status != 0 && last_exit_status < 128) {
             printf("Error: Command not found or could not be executed: %s\n", args[0]);
         }
     }
@@ -599,6 +565,7 @@ void execute_command(char **args) {
 // Signal handler
 void signal_handler(int signo) {
     if (signo == SIGINT) {
+        shell_interrupted = 1;
         printf("\nUse 'exit' to quit the shell\n");
         printf(COLOR_GREEN "cshell> " COLOR_RESET);
         fflush(stdout);
@@ -607,10 +574,16 @@ void signal_handler(int signo) {
 
 // Clean up resources
 void cleanup_shell(void) {
-    // Free command history
-    for (int i = 0; i < history_count; i++) {
+    // Finish a trace that is still being written
+    trace_close();
+    
+    // Free command history (the ring's slots; a structured store uses none)
+    for (int i = 0; i < MAX_HISTORY; i++) {
         free(command_history[i]);
     }
     
-    printf(COLOR_CYAN "\nThank you for using Custom CShell!\n" COLOR_RESET);
+    if (interactive) {
+        printf(COLOR_CYAN "\nThank you for using Custom CShell!\n" COLOR_RESET);
+    }
+    fflush(stdout);
 } 
\ No newline at end of file
@@ -1,6 +1,10 @@
 #ifndef CSHELL_H
 #define CSHELL_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // For pipe2() and other Linux extensions
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +14,7 @@
 #include <errno.h>
 #include <math.h>
 #include <signal.h>
+#include <stdint.h>
 
 #ifdef _WIN32
     #include <windows.h>
@@ -37,11 +42,15 @@
     #include <pthread.h>
     #include <curl/curl.h>
     #include <termios.h>    // For terminal settings on Unix
+    #include <sys/time.h>
+    #include <sys/resource.h>
+    #include <sys/uio.h>
 #endif
 
 // Constants
 #define MAX_COMMAND_LENGTH 1024
 #define MAX_ARGS 64
+#define MAX_PIPELINE_STAGES 64
 #define MAX_PATH_LENGTH 256
 #define MAX_LINE_LENGTH 1024
 #define MAX_TODO_ITEMS 100
@@ -58,6 +67,7 @@
 #define KEY_ENTER   13      // Enter key
 #define KEY_ESCAPE  27      // Escape key
 #define KEY_BACKSPACE 127   // Backspace
+#define KEY_EOF     4       // Ctrl-D
 
 // Debug mode
 #define DEBUG_OFF 0
@@ -74,11 +84,16 @@
 #define COLOR_WHITE "\033[37m"
 #define COLOR_BOLD "\033[1m"
 
+// Built-in command flags
+#define BUILTIN_STREAMS 1   // Uses shell_in/shell_out, can run in-process in a pipeline
+#define BUILTIN_THREADS 2   // Touches no shared state, can run on a parallel worker thread
+
 // Built-in command structure
 typedef struct {
     char *name;
     int (*func)(char **args);
     char *description;
+    int flags;
 } BuiltinCommand;
 
 // Data structures
@@ -103,18 +118,244 @@ typedef struct {
 
 typedef struct {
     size_t size;
-    char *data;
+    size_t capacity;
+    char *data;         // Allocated from the per-command arena
 } ResponseData;
 
+// A history entry in the history store, followed there by its command and
+// directory (histstore.c)
+typedef struct {
+    int64_t time;               // When it was entered, 0 if imported
+    int64_t duration_us;        // -1 until the command has finished
+    int32_t exit_status;        // -1 until the command has finished
+    uint32_t command_length;
+    uint32_t cwd_length;
+    uint32_t reserved;
+} HistoryRecord;
+
+// Builtin I/O stream kinds
+#define STREAM_FD 1         // Buffered writes to / reads from a descriptor
+#define STREAM_BUFFER 2     // In-memory buffer handed between pipeline stages
+
+typedef struct {
+    int kind;
+    int fd;
+    char *data;
+    size_t size;
+    size_t capacity;
+    size_t read_pos;
+    int error;
+} ShellStream;
+
+// Descriptors to install as a spawned child's stdin/stdout/stderr (-1 = inherit)
+// and the process group to put it in (-1 = the shell's, 0 = a new one)
+typedef struct {
+    int fd_in;
+    int fd_out;
+    int fd_err;
+    pid_t pgid;
+} SpawnOptions;
+
+// Command line tokens (lexer.c)
+typedef enum {
+    TOKEN_WORD,
+    TOKEN_PIPE,                 // |
+    TOKEN_BACKGROUND,           // &
+    TOKEN_REDIRECT_IN,          // <
+    TOKEN_REDIRECT_OUT,         // >
+    TOKEN_REDIRECT_APPEND,      // >>
+    TOKEN_REDIRECT_ERR,         // 2>
+    TOKEN_REDIRECT_ERR_APPEND,  // 2>>
+    TOKEN_REDIRECT_ERR_OUT,     // 2>&1
+    TOKEN_SEPARATOR             // ; or a newline
+} TokenKind;
+
+#define TOKEN_QUOTED 1          // Part of the word was in quotes
+#define TOKEN_ESCAPED 2         // The word contains a backslash escape
+#define TOKEN_EXPAND 4          // The word contains a $ expansion
+#define TOKEN_GLOB 8            // The word contains an unquoted * ? or [
+#define TOKEN_ASSIGN 16         // A leading NAME=value word (prepare_tokens())
+
+typedef struct {
+    const char *start;          // Into the command line, quotes included
+    size_t length;
+    TokenKind kind;
+    int flags;
+} Token;
+
+typedef struct {
+    char **args;                // NULL-terminated, in the per-command arena
+    int count;
+    int capacity;
+} ArgList;
+
+// A compiled command line or script (vm.c)
+typedef struct Program Program;
+
+#define COMPILE_FAILED ((size_t)-1)
+
+#ifndef _WIN32
+// Start of a measured command (stats.c)
+#define STATS_CHILDREN (-100)   // Only the rusage passed to stats_end() counts
+
+typedef struct {
+    struct timespec start;
+    struct rusage usage;
+    int who;                    // RUSAGE_THREAD, RUSAGE_SELF or STATS_CHILDREN
+} StatsMark;
+#endif
+
 // Function declarations
 // Shell core functions
 void init_shell(void);
 void run_shell(void);
 void process_command(char *command);
-void execute_command(char **args);
+void finish_command(void);
+void execute_command(char **args, const SpawnOptions *io);
+void run_builtin(BuiltinCommand *builtin, char **args, const SpawnOptions *io);
 void signal_handler(int signo);
 void cleanup_shell(void);
 
+// Script and batch mode (script.c)
+int run_script_fd(int fd);
+int run_script_file(const char *path);
+int run_command_string(const char *commands);
+
+// Startup profiling and lazy initialization (startup.c)
+void startup_profile_begin(void);
+void startup_profile_mark(const char *phase);
+void startup_profile_report(void);
+void start_background_init(void);
+void ensure_history(void);
+void ensure_todo_list(void);
+void ensure_notes(void);
+void ensure_network(void);
+int completion_range(const char *prefix, const char ***names, int *first);
+
+// Command server (server.c)
+int run_server(const char *socket_path);
+int run_client(const char *socket_path, const char *command);
+
+// Builtin dispatch (dispatch.c)
+void init_builtin_table(void);
+BuiltinCommand *find_builtin(const char *name);
+
+// PATH lookup cache (pathcache.c)
+int path_cache_lookup(const char *name, char *out, size_t out_size);
+void path_cache_forget(const char *name);
+void path_cache_clear(void);
+int cmd_hash(char **args);
+
+// Command line lexer (lexer.c)
+int lex_command(const char *line, size_t length, Token **tokens, const char **error);
+void prepare_tokens(Token *tokens, int count, int assignments);
+void expand_tokens(const Token *tokens, int count, ArgList *out);
+int tokenize_command(char *line, char ***args);
+TokenKind token_operator(const char *arg);
+const char *lexer_select(const char *name);
+const char *skip_substitution(const char *p, const char *end);
+void arg_list_init(ArgList *list);
+void arg_list_push(ArgList *list, char *arg);
+
+// Variable expansion and command substitution (expand.c)
+void expand_word(const char *word, size_t length, int split, int glob, ArgList *out);
+size_t assignment_name_length(const char *word, size_t length);
+int assign_variables(char **args);
+void set_variable(const char *name, const char *value);
+char **set_positional_args(char **args);
+char **get_positional_args(void);
+
+// Script compiler and VM (vm.c)
+Program *compile_program(const char *source, size_t length, size_t *complete);
+int run_program(Program *program);
+Program *retain_program(Program *program);
+void free_program(Program *program);
+unsigned function_generation(void);
+
+// Compiled line cache (linecache.c)
+Program *line_cache_lookup(const char *line, size_t length);
+void line_cache_insert(const char *line, size_t length, Program *program);
+Program *compile_line(const char *line, size_t length);
+
+// Command lines and pipelines (pipeline.c)
+void execute_pipeline(char **args);
+int exit_status_from_wait(int status);
+#ifndef _WIN32
+void run_builtin_with_io(BuiltinCommand *builtin, char **args, const SpawnOptions *io);
+pid_t start_process(char **args, const SpawnOptions *io);
+#endif
+
+// Parallel execution (parallel.c)
+int cmd_parallel(char **args);
+
+// Builtin stream I/O (stream.c)
+void stream_init_fd(ShellStream *s, int fd);
+void stream_init_buffer(ShellStream *s);
+void stream_free(ShellStream *s);
+int stream_flush(ShellStream *s);
+int stream_write(ShellStream *s, const void *data, size_t len);
+int stream_printf(ShellStream *s, const char *format, ...);
+ssize_t stream_read(ShellStream *s, char *buf, size_t len);
+const char *stream_read_all(ShellStream *s, size_t *len);
+int stream_forward(ShellStream *in, ShellStream *out);
+int stream_write_file(ShellStream *out, FILE *file);
+int stream_input_is_piped(void);
+int stream_output_is_terminal(void);
+int sh_printf(const char *format, ...);
+int sh_write(const void *data, size_t len);
+void sh_perror(const char *prefix);
+
+// Per-command resource accounting (stats.c)
+#ifndef _WIN32
+void stats_begin(StatsMark *mark, int who);
+void stats_end(StatsMark *mark, const char *name, const struct rusage *children);
+void stats_record(const char *name, double wall_us, const struct rusage *usage);
+#endif
+int cmd_stats(char **args);
+
+// Trace-event export (trace.c)
+uint64_t trace_start(void);
+void trace_span(const char *name, uint64_t start, const char *detail);
+int trace_open(const char *path);
+void trace_close(void);
+int trace_active(void);
+
+// Per-command arena (arena.c)
+void *arena_alloc(size_t size);
+void *arena_grow(void *ptr, size_t old_size, size_t new_size);
+char *arena_strdup(const char *s);
+char *arena_join(char **parts, const char *separator);
+char *arena_printf(const char *format, ...);
+void arena_usage(size_t *allocations, size_t *bytes);
+void arena_reset(void);
+void arena_release(void);
+
+// Glob expansion (glob.c)
+int glob_expand(const char *pattern, ArgList *out);
+int glob_match(const char *pattern, const char *name);
+void glob_unescape(char *pattern);
+
+// Job control (jobs.c)
+void init_jobs(int interactive);
+int job_control_enabled(void);
+void jobs_set_command_text(const char *line);
+void jobs_notify(void);
+#ifndef _WIN32
+void job_take_terminal(pid_t pgid);
+void job_background(pid_t pgid, const pid_t *pids, int count);
+int job_wait_foreground(pid_t pgid, const pid_t *pids, int count, struct rusage *usage);
+#endif
+int cmd_jobs(char **args);
+int cmd_fg(char **args);
+int cmd_bg(char **args);
+int cmd_wait(char **args);
+int cmd_kill(char **args);
+
+// Process launch (launch.c)
+#ifndef _WIN32
+pid_t spawn_command(const char *path, char **args, const SpawnOptions *opts);
+#endif
+
 // Built-in commands
 int cmd_help(char **args);
 int cmd_exit(char **args);
@@ -126,6 +367,9 @@ int cmd_ls(char **args);
 int cmd_mkdir(char **args);
 int cmd_rm(char **args);
 int cmd_cat(char **args);
+int cmd_true(char **args);
+int cmd_false(char **args);
+int cmd_test(char **args);
 
 // Feature commands
 int cmd_todo(char **args);
@@ -161,12 +405,38 @@ int cmd_debug(char **args);
 void add_to_history(const char *command);
 void save_history(void);
 void load_history(void);
-char *get_input_with_history(void);
 char **get_completions(const char *partial_cmd);
 void free_completions(char **completions);
 int handle_tab_completion(char *input, int *position);
-void print_history(void);
+void print_history(int count, int details);
 int cmd_history(char **args);
+const char *history_entry(int index);
+char *history_escape(const char *command);
+void history_unescape(char *line);
+const HistoryRecord *history_details(int index);
+void history_finish(int exit_status, int64_t duration_us);
+int history_import(const char *path);
+
+// Incremental history search (histsearch.c)
+int history_search(const char *query, int before, size_t *offset);
+void history_search_add(const char *command);
+void history_search_reset(void);
+
+// Structured history store (histstore.c)
+int history_store_open(void);
+int history_store_active(void);
+int history_store_count(void);
+const HistoryRecord *history_store_get(int index);
+const char *history_record_command(const HistoryRecord *record);
+const char *history_record_cwd(const HistoryRecord *record);
+const char *history_store_command(int index);
+int history_store_append(const char *command);
+void history_store_finish(int exit_status, int64_t duration_us);
+int history_store_import(const char *path);
+
+// Line editor (editor.c)
+char *get_input_with_history(void);
+void terminal_restore(void);
 
 // Utility functions
 char *get_input(void);
@@ -181,6 +451,10 @@ int check_file_exists(const char *filename);
 void create_directory_if_not_exists(const char *dirname);
 void trim_whitespace(char *str);
 size_t curl_callback(void *contents, size_t size, size_t nmemb, void *userp);
+void response_init(ResponseData *response);
+void init_curl_share(void);
+CURL *shell_curl_init(void);
+CURLcode shell_curl_perform(CURL *curl, const char *url);
 int open_url_in_browser(const char *url);
 void ensure_data_directory(void);
 char* wsl_to_windows_path(const char* wsl_path, char* win_path, size_t win_path_size);
@@ -195,11 +469,18 @@ extern int note_count;
 extern Reminder reminders[MAX_REMINDERS];
 extern int reminder_count;
 extern int shell_running;
+extern volatile sig_atomic_t shell_interrupted;
+extern int interactive;
+extern int startup_profile;
 extern int debug_mode;
+extern __thread int last_exit_status;  // Each thread running builtins has its own
 extern char shell_directory[MAX_PATH_LENGTH];
 extern BuiltinCommand builtin_commands[];
 extern char *command_history[MAX_HISTORY];
 extern int history_count;
 extern int history_position;
+extern __thread ShellStream *shell_in;     // NULL means the shell's stdin
+extern __thread ShellStream *shell_out;    // NULL means the shell's stdout
+extern __thread ShellStream *shell_err;    // NULL means the shell's stderr
 
 #endif /* CSHELL_H */ 
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include "cshell.h"
+
+// Builtin dispatch table
+//
+// builtin_commands[] stays the single source of truth for names, handlers and
+// help text. On first use we build a perfect hash over it: a seed is searched
+// so that every builtin name lands in its own slot of a power-of-two table.
+// A lookup is then one hash, one slot and at most one strcmp, whether the
+// name is a builtin or not.
+
+typedef struct {
+    const char *name;
+    unsigned int hash;
+    BuiltinCommand *command;
+} BuiltinSlot;
+
+static BuiltinSlot *builtin_table = NULL;
+static unsigned int builtin_mask = 0;
+static unsigned int builtin_seed = 0;
+static pthread_once_t builtin_table_once = PTHREAD_ONCE_INIT;
+
+// FNV-1a with a final avalanche step, seeded for the perfect-hash search
+static unsigned int hash_builtin_name(const char *name, unsigned int seed) {
+    unsigned int h = 2166136261u ^ seed;
+
+    while (*name != '\0') {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+
+    return h;
+}
+
+// Try to place every builtin with the given seed; returns 0 on a collision
+static int place_builtins(unsigned int seed) {
+    memset(builtin_table, 0, sizeof(BuiltinSlot) * (builtin_mask + 1));
+
+    for (int i = 0; builtin_commands[i].name != NULL; i++) {
+        unsigned int h = hash_builtin_name(builtin_commands[i].name, seed);
+        BuiltinSlot *slot = &builtin_table[h & builtin_mask];
+
+        if (slot->name != NULL) {
+            return 0;
+        }
+
+        slot->name = builtin_commands[i].name;
+        slot->hash = h;
+        slot->command = &builtin_commands[i];
+    }
+
+    return 1;
+}
+
+static void build_builtin_table(void) {
+    int count = 0;
+    while (builtin_commands[count].name != NULL) count++;
+
+    // A load factor of 1/8 keeps the seed search to a handful of attempts
+    unsigned int size = 16;
+    while (size < (unsigned int)count * 8) size <<= 1;
+
+    for (;;) {
+        builtin_table = calloc(size, sizeof(BuiltinSlot));
+        if (builtin_table == NULL) {
+            fprintf(stderr, "Error: Could not allocate builtin table\n");
+            return;
+        }
+        builtin_mask = size - 1;
+
+        for (unsigned int seed = 0; seed < 4096; seed++) {
+            if (place_builtins(seed)) {
+                builtin_seed = seed;
+                return;
+            }
+        }
+
+        // Extremely unlikely: grow the table and search again
+        free(builtin_table);
+        size <<= 1;
+    }
+}
+
+// Build the dispatch table (safe to call more than once)
+void init_builtin_table(void) {
+    pthread_once(&builtin_table_once, build_builtin_table);
+}
+
+// Find a builtin command by name, or NULL if it is not a builtin
+BuiltinCommand *find_builtin(const char *name) {
+    init_builtin_table();
+    if (builtin_table == NULL || name == NULL) return NULL;
+
+    unsigned int h = hash_builtin_name(name, builtin_seed);
+    BuiltinSlot *slot = &builtin_table[h & builtin_mask];
+
+    if (slot->name == NULL || slot->hash != h || strcmp(slot->name, name) != 0) {
+        return NULL;
+    }
+
+    return slot->command;
+}
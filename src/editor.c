@@ -0,0 +1,819 @@
+#include "cshell.h"
+
+// Line editor
+//
+// The editor keeps a copy of what the terminal shows of the line being
+// edited and, after every key, renders the smallest update that turns it
+// into the new line: move the cursor to the first column that differs,
+// rewrite the changed tail, erase what is left over with EL (ESC [K) if the
+// line got shorter, and move back to the editing position. The update is
+// built in one buffer and goes out in a single write(), so a keystroke costs
+// one system call and the terminal never shows half an update. A line wider
+// than the terminal scrolls horizontally within the columns right of the
+// prompt.
+//
+// The line itself is a gap buffer: the text before the cursor sits at the
+// start of one allocation and the text after it at the end, with the unused
+// space between them. Typing or deleting at the cursor only moves the edge
+// of the gap; moving the cursor carries the characters it passes across the
+// gap. The buffer doubles when the gap runs out, so a line can be as long as
+// memory allows.
+//
+// The terminal stays in raw mode (no canonical input, no echo) for the whole
+// session rather than being switched for every line; terminal_restore()
+// gives the original mode back only when something else needs the terminal,
+// such as an external command or a builtin reading a line from it, and the
+// next line switches to raw mode again. Keys are read one byte per read(),
+// so the editor never takes input typed after Enter: that belongs to the
+// command the line runs. The line is rendered only once no more input is
+// pending, so text typed faster than the screen updates costs one update
+// rather than one per character. Bracketed paste (ESC [ 200~ ... ESC [ 201~)
+// is read in bulk and inserts a whole paste in one step: pasted newlines and
+// tabs go into the line instead of running it or completing.
+//
+// Ctrl-R searches the history backwards as the query is typed
+// (histsearch.c), showing the newest match in the line with the query in
+// place of the prompt. Ctrl-R again goes to an older match, Ctrl-G gives the
+// original line back, and any other key takes the match and goes on editing.
+//
+// Debug mode reports the keystroke-to-echo latency after each line: the
+// time from a key being read to its update having been written.
+
+#define PROMPT COLOR_GREEN "cshell> " COLOR_RESET
+#define PROMPT_WIDTH 8                  // Columns PROMPT takes on screen
+#define DEFAULT_COLUMNS 80
+#define MIN_EDIT_COLUMNS 8
+#define SHORT_MOVE 4                    // Moves left this short are sent as backspaces
+#define OUTPUT_INITIAL_SIZE 256
+#define KEY_BUFFER_SIZE 4096
+#define LINE_INITIAL_SIZE 256
+
+// Keys decoded from escape sequences, above the byte values: ESC [ N final
+// (N is 1 in arrow keys with Ctrl, Alt or Shift), and ESC followed by a byte
+#define CSI_KEY(parameter, final) (0x10000 + (parameter) * 0x100 + (final))
+#define META_KEY(c) (0x20000 + (c))
+#define CTRL_KEY(c) ((c) & 0x1f)
+#define KEY_PASTE CSI_KEY(200, '~')
+
+#ifndef _WIN32
+
+// The update being built
+static char *output;
+static size_t output_length;
+static size_t output_capacity;
+
+// The line being edited
+typedef struct {
+    char *data;
+    size_t capacity;
+    size_t cursor;              // The gap starts here
+    size_t after;               // The text after the gap starts here
+} GapBuffer;
+
+static GapBuffer line;
+
+// What the terminal shows right of the prompt
+static char *shown;                     // The visible part of the line
+static size_t shown_length;
+static size_t shown_capacity;
+static size_t shown_cursor;             // Cursor column
+static size_t scroll;                   // Index of the line's first visible character
+static size_t edit_columns;             // Columns available to the line
+static size_t terminal_width;
+
+// The prompt in front of the line, PROMPT unless searching
+static const char *prompt = PROMPT;
+static size_t prompt_width = PROMPT_WIDTH;
+static int prompt_changed;
+
+// Ctrl-R search
+static int searching;
+static char *search_query;
+static size_t search_length;
+static size_t search_capacity;
+static int search_match;                // History index shown, or -1
+static int search_failed;
+static char *search_saved;              // The line from before the search
+
+// Terminal mode
+static struct termios cooked_tio;       // The mode the shell started with
+static int cooked_saved;
+static int raw_mode;
+
+// Raw input, decoded from keys_start
+static unsigned char keys[KEY_BUFFER_SIZE];
+static size_t keys_start;
+static size_t keys_end;
+static struct timespec keys_read;       // When the last read() returned
+
+// Keystroke-to-echo latency, over the whole session
+static unsigned long keystrokes;
+static unsigned long updates;
+static double latency_total_us;
+static double latency_max_us;
+
+// Give the terminal back its original mode (a no-op unless it is in raw mode)
+void terminal_restore(void) {
+    if (!raw_mode) return;
+
+    static const char paste_off[] = "\033[?2004l";
+    ssize_t n = write(STDOUT_FILENO, paste_off, sizeof(paste_off) - 1);
+    (void)n;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &cooked_tio);
+    raw_mode = 0;
+}
+
+static void terminal_raw(void) {
+    if (raw_mode) return;
+
+    if (!cooked_saved) {
+        if (tcgetattr(STDIN_FILENO, &cooked_tio) != 0) return;
+        cooked_saved = 1;
+        atexit(terminal_restore);
+    }
+
+    // Signals stay on, so Ctrl-C and Ctrl-Z still work
+    struct termios raw_tio = cooked_tio;
+    raw_tio.c_lflag &= ~(ICANON | ECHO | IEXTEN);
+    raw_tio.c_cc[VMIN] = 1;
+    raw_tio.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw_tio);
+
+    static const char paste_on[] = "\033[?2004h";
+    ssize_t n = write(STDOUT_FILENO, paste_on, sizeof(paste_on) - 1);
+    (void)n;
+    raw_mode = 1;
+}
+
+static void output_append(const char *data, size_t length) {
+    if (output_length + length > output_capacity) {
+        size_t capacity = output_capacity ? output_capacity : OUTPUT_INITIAL_SIZE;
+        while (capacity < output_length + length) capacity *= 2;
+
+        char *grown = realloc(output, capacity);
+        if (grown == NULL) return;
+        output = grown;
+        output_capacity = capacity;
+    }
+
+    memcpy(output + output_length, data, length);
+    output_length += length;
+}
+
+// Append part of the line; pasted tabs and newlines show as blanks
+static void output_append_text(const char *text, size_t length) {
+    const char *end = text + length;
+    while (text < end) {
+        const char *run = text;
+        while (text < end && (unsigned char)*text >= ' ') text++;
+        output_append(run, (size_t)(text - run));
+        if (text < end) {
+            output_append(" ", 1);
+            text++;
+        }
+    }
+}
+
+// Move the cursor between two columns of the line
+static void output_move(size_t from, size_t to) {
+    char sequence[32];
+
+    if (to < from && from - to <= SHORT_MOVE) {
+        output_append("\b\b\b\b", from - to);
+    } else if (to < from) {
+        output_append(sequence, (size_t)snprintf(sequence, sizeof(sequence), "\033[%zuD", from - to));
+    } else if (to > from) {
+        output_append(sequence, (size_t)snprintf(sequence, sizeof(sequence), "\033[%zuC", to - from));
+    }
+}
+
+// Send the update; anything printf() buffered must already be flushed
+static void output_flush(void) {
+    size_t done = 0;
+
+    while (done < output_length) {
+        ssize_t n = write(STDOUT_FILENO, output + done, output_length - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    output_length = 0;
+}
+
+static size_t terminal_columns(void) {
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) return size.ws_col;
+    return DEFAULT_COLUMNS;
+}
+
+static void fit_columns(void) {
+    // The last column stays free so the cursor never wraps
+    edit_columns = terminal_width > prompt_width + MIN_EDIT_COLUMNS ? terminal_width - prompt_width - 1 : MIN_EDIT_COLUMNS;
+}
+
+static void set_prompt(const char *text, size_t width) {
+    prompt = text;
+    prompt_width = width;
+    prompt_changed = 1;
+}
+
+// Start a line: the prompt has just been printed and nothing after it
+static void screen_begin(void) {
+    terminal_width = terminal_columns();
+    prompt = PROMPT;
+    prompt_width = PROMPT_WIDTH;
+    fit_columns();
+    shown_length = 0;
+    shown_cursor = 0;
+    scroll = 0;
+}
+
+static size_t line_length(void) {
+    return line.cursor + (line.capacity - line.after);
+}
+
+static char line_char(size_t index) {
+    return index < line.cursor ? line.data[index] : line.data[index + (line.after - line.cursor)];
+}
+
+static void line_clear(void) {
+    line.cursor = 0;
+    line.after = line.capacity;
+}
+
+// Make the gap at least size bytes long
+static int line_reserve(size_t size) {
+    if (line.after - line.cursor >= size) return 1;
+
+    size_t tail = line.capacity - line.after;
+    size_t capacity = line.capacity ? line.capacity : LINE_INITIAL_SIZE;
+    while (capacity - line.cursor - tail < size) capacity *= 2;
+
+    char *data = realloc(line.data, capacity);
+    if (data == NULL) return 0;
+    memmove(data + capacity - tail, data + line.after, tail);
+    line.data = data;
+    line.after = capacity - tail;
+    line.capacity = capacity;
+    return 1;
+}
+
+// Insert text before the cursor; pasted carriage returns become newlines
+static void line_insert(const char *text, size_t length) {
+    if (!line_reserve(length)) return;
+
+    char *to = line.data + line.cursor;
+    memcpy(to, text, length);
+    for (size_t i = 0; i < length; i++) {
+        if (to[i] == '\r') to[i] = '\n';
+    }
+    line.cursor += length;
+}
+
+static void line_delete_before(void) {
+    if (line.cursor > 0) line.cursor--;
+}
+
+static void line_delete_after(void) {
+    if (line.after < line.capacity) line.after++;
+}
+
+// Move the cursor, carrying the text it passes over to the other side of the gap
+static void line_move(size_t to) {
+    if (to < line.cursor) {
+        size_t count = line.cursor - to;
+        memmove(line.data + line.after - count, line.data + to, count);
+        line.cursor -= count;
+        line.after -= count;
+    } else if (to > line.cursor && to <= line_length()) {
+        size_t count = to - line.cursor;
+        memmove(line.data + line.cursor, line.data + line.after, count);
+        line.cursor += count;
+        line.after += count;
+    }
+}
+
+// Start of the word before the cursor, and end of the word after it
+static size_t word_left(void) {
+    size_t i = line.cursor;
+    while (i > 0 && isspace((unsigned char)line_char(i - 1))) i--;
+    while (i > 0 && !isspace((unsigned char)line_char(i - 1))) i--;
+    return i;
+}
+
+static size_t word_right(void) {
+    size_t i = line.cursor;
+    size_t length = line_length();
+    while (i < length && isspace((unsigned char)line_char(i))) i++;
+    while (i < length && !isspace((unsigned char)line_char(i))) i++;
+    return i;
+}
+
+// The finished line, as a string in the per-command arena
+static char *line_string(void) {
+    size_t tail = line.capacity - line.after;
+    char *text = arena_alloc(line.cursor + tail + 1);
+
+    if (line.cursor > 0) memcpy(text, line.data, line.cursor);
+    if (tail > 0) memcpy(text + line.cursor, line.data + line.after, tail);
+    text[line.cursor + tail] = '\0';
+    return text;
+}
+
+// Append characters [from, to) of the line to the update
+static void output_line(size_t from, size_t to) {
+    if (from < line.cursor) {
+        size_t end = to < line.cursor ? to : line.cursor;
+        output_append_text(line.data + from, end - from);
+        from = end;
+    }
+    if (from < to) output_append_text(line.data + from + (line.after - line.cursor), to - from);
+}
+
+// Bring the terminal up to date with the line and the cursor position in it.
+// With redraw set the prompt is drawn again first, on a fresh line.
+static void render(int redraw) {
+    size_t length = line_length();
+    size_t cursor = line.cursor;
+
+    if (prompt_changed) {
+        fit_columns();
+        prompt_changed = 0;
+        redraw = 1;
+    }
+
+    // Scroll only as far as needed to keep the cursor in view
+    if (length <= edit_columns) scroll = 0;
+    else if (cursor < scroll) scroll = cursor;
+    else if (cursor > scroll + edit_columns) scroll = cursor - edit_columns;
+    if (scroll > 0 && length - scroll < edit_columns) scroll = length - edit_columns;
+
+    size_t visible_length = length - scroll;
+    if (visible_length > edit_columns) visible_length = edit_columns;
+
+    if (redraw) {
+        output_append("\r", 1);
+        output_append(prompt, strlen(prompt));
+        shown_length = 0;
+        shown_cursor = 0;
+    }
+
+    size_t same = 0;
+    while (same < shown_length && same < visible_length && shown[same] == line_char(scroll + same)) same++;
+
+    size_t column = shown_cursor;
+    if (same < visible_length || same < shown_length || redraw) {
+        output_move(column, same);
+        output_line(scroll + same, scroll + visible_length);
+        column = visible_length;
+        if (shown_length > visible_length || redraw) output_append("\033[K", 3);
+    }
+    output_move(column, cursor - scroll);
+
+    if (visible_length > shown_capacity) {
+        char *grown = realloc(shown, visible_length);
+        if (grown == NULL) {
+            // Forget what is shown; the next update rewrites it all
+            output_flush();
+            shown_length = 0;
+            shown_cursor = 0;
+            return;
+        }
+        shown = grown;
+        shown_capacity = visible_length;
+    }
+    for (size_t i = same; i < visible_length; i++) shown[i] = line_char(scroll + i);
+    shown_length = visible_length;
+    shown_cursor = cursor - scroll;
+
+    output_flush();
+}
+
+static double microseconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+// Time from keys arriving to the update showing them having been written
+static void record_latency(void) {
+    double us = microseconds_since(&keys_read);
+
+    updates++;
+    latency_total_us += us;
+    if (us > latency_max_us) latency_max_us = us;
+}
+
+// Complete the command name before the cursor. Returns 1 if the candidates
+// were listed, which leaves the line to be drawn again below them.
+static int complete(void) {
+    if (line.cursor == 0) return 0;
+    for (size_t i = 0; i < line.cursor; i++) {
+        if (isspace((unsigned char)line.data[i])) return 0;
+    }
+
+    char **completions = get_completions(arena_printf("%.*s", (int)line.cursor, line.data));
+    if (completions == NULL || completions[0] == NULL) {
+        free_completions(completions);
+        return 0;
+    }
+
+    int listed = 0;
+    if (completions[1] == NULL) {
+        line.cursor = 0;
+        line_insert(completions[0], strlen(completions[0]));
+    } else {
+        printf("\n");
+        for (int i = 0; completions[i] != NULL; i++) {
+            printf("%s  ", completions[i]);
+        }
+        printf("\n");
+        fflush(stdout);
+        listed = 1;
+    }
+
+    free_completions(completions);
+    return listed;
+}
+
+// Replace the line with a history entry, or empty it past the newest one
+static void recall_history(void) {
+    line_clear();
+    if (history_position < history_count) {
+        const char *entry = history_entry(history_position);
+        line_insert(entry, strlen(entry));
+    }
+}
+
+// Look for the query in entries older than before, showing the match
+static void search_history(int before) {
+    size_t offset;
+    int match = search_length > 0 ? history_search(search_query, before, &offset) : -1;
+
+    search_failed = match < 0 && search_length > 0;
+    if (search_length == 0) {
+        // Nothing to look for yet: the line as it was
+        search_match = -1;
+        line_clear();
+        line_insert(search_saved, strlen(search_saved));
+    } else if (match >= 0) {
+        const char *entry = history_entry(match);
+        search_match = match;
+        line_clear();
+        line_insert(entry, strlen(entry));
+        line_move(offset);
+    }
+
+    char *text = arena_printf("(%sreverse-i-search)`%s': ", search_failed ? "failed " : "", search_query);
+    set_prompt(text, strlen(text));
+}
+
+static void start_search(void) {
+    ensure_history();
+    searching = 1;
+    search_length = 0;
+    search_match = -1;
+    search_saved = line_string();
+    if (search_capacity == 0) {
+        search_capacity = LINE_INITIAL_SIZE;
+        search_query = malloc(search_capacity);
+        if (search_query == NULL) {
+            search_capacity = 0;
+            searching = 0;
+            return;
+        }
+    }
+    search_query[0] = '\0';
+    search_history(history_count);
+}
+
+// Leave the search with the match in the line, or with the line as it was
+static void end_search(int keep) {
+    searching = 0;
+    if (!keep) {
+        line_clear();
+        line_insert(search_saved, strlen(search_saved));
+    } else if (search_match >= 0) {
+        history_position = search_match;
+    }
+    set_prompt(PROMPT, PROMPT_WIDTH);
+}
+
+// Handle a key while searching. Returns 0 if it ended the search and is
+// still to be handled as an editing key.
+static int search_key(int ch) {
+    if (ch == CTRL_KEY('R')) {
+        search_history(search_match >= 0 ? search_match : history_count);
+    } else if (ch == KEY_BACKSPACE || ch == CTRL_KEY('H')) {
+        // A shorter query starts again from the newest entry
+        if (search_length > 0) search_query[--search_length] = '\0';
+        search_history(history_count);
+    } else if (ch >= 32 && ch <= 126) {
+        if (search_length + 1 == search_capacity) {
+            char *query = realloc(search_query, search_capacity * 2);
+            if (query == NULL) return 1;
+            search_query = query;
+            search_capacity *= 2;
+        }
+        search_query[search_length++] = (char)ch;
+        search_query[search_length] = '\0';
+
+        // The match so far may still do
+        search_history(search_match >= 0 ? search_match + 1 : history_count);
+    } else if (ch == CTRL_KEY('G')) {
+        end_search(0);
+    } else {
+        end_search(1);
+        return 0;
+    }
+    return 1;
+}
+
+// Read up to limit bytes of input after what is buffered. Returns 0 at end
+// of input.
+static int fill_keys(size_t limit) {
+    if (keys_start > 0) {
+        memmove(keys, keys + keys_start, keys_end - keys_start);
+        keys_end -= keys_start;
+        keys_start = 0;
+    }
+
+    for (;;) {
+        size_t space = sizeof(keys) - keys_end;
+        ssize_t n = read(STDIN_FILENO, keys + keys_end, limit < space ? limit : space);
+        if (n > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &keys_read);
+            keys_end += (size_t)n;
+            return 1;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        return 0;
+    }
+}
+
+// Whether more keys have arrived than have been read
+static int input_pending(void) {
+    int pending = 0;
+    return keys_start < keys_end || (ioctl(STDIN_FILENO, FIONREAD, &pending) == 0 && pending > 0);
+}
+
+static int next_byte(void) {
+    if (keys_start == keys_end && !fill_keys(1)) return EOF;
+    return keys[keys_start++];
+}
+
+// Decode the next key: a byte, CSI_KEY() for an escape sequence or
+// META_KEY() for Alt with a key. A malformed sequence comes back as KEY_ESCAPE.
+static int read_key(void) {
+    int ch = next_byte();
+    if (ch != KEY_ESCAPE) return ch;
+
+    ch = next_byte();
+    if (ch == EOF) return KEY_ESCAPE;
+    if (ch != '[' && ch != 'O') return META_KEY(ch);
+
+    // Parameter bytes, of which only the first number matters, then the final byte
+    int parameter = 0;
+    int first = 1;
+    while ((ch = next_byte()) >= 0x30 && ch <= 0x3F) {
+        if (ch == ';') first = 0;
+        else if (first && isdigit(ch) && parameter < 1000) parameter = parameter * 10 + (ch - '0');
+    }
+    if (ch < 0x40 || ch > 0x7E) return KEY_ESCAPE;
+    return CSI_KEY(parameter, ch);
+}
+
+// Insert a bracketed paste up to its end marker, in as few pieces as the
+// reads deliver it
+static void paste(void) {
+    static const char end_marker[] = "\033[201~";
+    const size_t marker_length = sizeof(end_marker) - 1;
+
+    for (;;) {
+        const char *start = (const char *)keys + keys_start;
+        size_t available = keys_end - keys_start;
+        const char *end = memmem(start, available, end_marker, marker_length);
+
+        // Without the marker, hold back a tail that may be its beginning
+        size_t take = end != NULL ? (size_t)(end - start)
+                    : available >= marker_length ? available - (marker_length - 1) : 0;
+        line_insert(start, take);
+        keys_start += take;
+
+        if (end != NULL) {
+            keys_start += marker_length;
+            return;
+        }
+        if (!fill_keys(sizeof(keys))) return;
+    }
+}
+
+// Edit one line in raw mode. Returns it in the arena, or NULL at end of input.
+static char *edit_line(void) {
+    terminal_raw();
+    fflush(stdout);
+    screen_begin();
+    line_clear();
+
+    int redraw = 0;
+    int ch;
+    while ((ch = read_key()) != '\n') {
+        keystrokes++;
+
+        if (ch == EOF || (ch == KEY_EOF && line_length() == 0 && !searching)) {
+            if (line_length() > 0) break;
+            return NULL;
+        }
+
+        if (searching && search_key(ch)) ch = 0;
+
+        switch (ch) {
+        case 0:                             // Taken by the search
+            break;
+        case CTRL_KEY('R'):
+            start_search();
+            break;
+        case CSI_KEY(0, KEY_UP):
+            ensure_history();
+            if (history_position > 0) {
+                history_position--;
+                recall_history();
+            }
+            break;
+        case CSI_KEY(0, KEY_DOWN):
+            ensure_history();
+            if (history_position < history_count) {
+                history_position++;
+                recall_history();
+            }
+            break;
+        case CSI_KEY(0, KEY_LEFT):
+        case CTRL_KEY('B'):
+            if (line.cursor > 0) line_move(line.cursor - 1);
+            break;
+        case CSI_KEY(0, KEY_RIGHT):
+        case CTRL_KEY('F'):
+            line_move(line.cursor + 1);
+            break;
+        case CSI_KEY(1, KEY_LEFT):
+        case META_KEY('b'):
+            line_move(word_left());
+            break;
+        case CSI_KEY(1, KEY_RIGHT):
+        case META_KEY('f'):
+            line_move(word_right());
+            break;
+        case CSI_KEY(0, 'H'):               // Home, in its several encodings
+        case CSI_KEY(1, '~'):
+        case CSI_KEY(7, '~'):
+        case CTRL_KEY('A'):
+            line_move(0);
+            break;
+        case CSI_KEY(0, 'F'):               // End
+        case CSI_KEY(4, '~'):
+        case CSI_KEY(8, '~'):
+        case CTRL_KEY('E'):
+            line_move(line_length());
+            break;
+        case KEY_BACKSPACE:
+        case CTRL_KEY('H'):
+            line_delete_before();
+            break;
+        case CSI_KEY(3, '~'):               // Delete
+        case KEY_EOF:
+            line_delete_after();
+            break;
+        case KEY_TAB:
+            redraw |= complete();
+            break;
+        case KEY_PASTE:
+            paste();
+            break;
+        default:
+            if (ch >= 32 && ch <= 126) {  // Printable characters
+                char c = (char)ch;
+                line_insert(&c, 1);
+            }
+            break;
+        }
+
+        // Keys already typed are applied before the screen catches up
+        if (input_pending()) continue;
+
+        render(redraw);
+        record_latency();
+        redraw = 0;
+    }
+
+    // Keys typed just before Enter have not been shown yet; the terminal's
+    // cursor goes to the end of the line before moving on
+    if (searching) end_search(1);
+    line_move(line_length());
+    render(redraw);
+    printf("\n");
+
+    if (debug_mode && updates > 0) {
+        printf(COLOR_YELLOW "Debug: editor: %lu keystrokes in %lu updates, echo latency avg %.1f us, max %.1f us\n" COLOR_RESET,
+               keystrokes, updates, latency_total_us / updates, latency_max_us);
+    }
+    return line_string();
+}
+
+#else
+
+void terminal_restore(void) {
+}
+
+#endif
+
+// Get input with history and tab completion support
+char *get_input_with_history(void) {
+    uint64_t trace = trace_start();
+    
+#ifdef _WIN32
+    char *input = arena_alloc(MAX_COMMAND_LENGTH);
+    input[0] = '\0';  // Empty string
+    int position = 0;
+    
+    // Windows implementation
+    int ch;
+    while ((ch = _getch()) != '\r') {  // '\r' is Enter key on Windows
+        if (ch == 224 || ch == 0) {  // Special key prefix
+            ch = _getch();  // Get the actual key code
+            ensure_history();
+            
+            // Handle arrow keys
+            if (ch == 72) {  // Up arrow
+                if (history_position > 0) {
+                    history_position--;
+                    
+                    // Clear the current line
+                    printf("\r" COLOR_GREEN "cshell> " COLOR_RESET);
+                    for (int i = 0; i < strlen(input); i++) {
+                        printf(" ");
+                    }
+                    
+                    // Copy the command from history
+                    snprintf(input, MAX_COMMAND_LENGTH, "%s", history_entry(history_position));
+                    position = strlen(input);
+                    
+                    // Redisplay the line
+                    printf("\r" COLOR_GREEN "cshell> " COLOR_RESET "%s", input);
+                }
+            } else if (ch == 80) {  // Down arrow
+                if (history_position < history_count) {
+                    history_position++;
+                    
+                    // Clear the current line
+                    printf("\r" COLOR_GREEN "cshell> " COLOR_RESET);
+                    for (int i = 0; i < strlen(input); i++) {
+                        printf(" ");
+                    }
+                    
+                    // If at the end of history, clear the line
+                    if (history_position == history_count) {
+                        input[0] = '\0';
+                        position = 0;
+                    } else {
+                        // Copy the command from history
+                        snprintf(input, MAX_COMMAND_LENGTH, "%s", history_entry(history_position));
+                        position = strlen(input);
+                    }
+                    
+                    // Redisplay the line
+                    printf("\r" COLOR_GREEN "cshell> " COLOR_RESET "%s", input);
+                }
+            }
+        } else if (ch == '\b' || ch == 127) {  // Backspace
+            if (position > 0) {
+                input[--position] = '\0';
+                printf("\b \b");  // Erase character on screen
+            }
+        } else if (ch == KEY_TAB) {  // Tab for completion
+            handle_tab_completion(input, &position);
+        } else if (ch >= 32 && ch <= 126) {  // Printable characters
+            if (position < MAX_COMMAND_LENGTH - 1) {
+                input[position++] = ch;
+                input[position] = '\0';
+                printf("%c", ch);
+            }
+        }
+    }
+    
+    printf("\n");
+#else
+    char *input = edit_line();
+    if (input == NULL) return NULL;
+#endif
+    
+    trace_span("read input", trace, NULL);
+    
+    // Add command to history if not empty
+    if (strlen(input) > 0) {
+        trace = trace_start();
+        add_to_history(input);
+        trace_span("history save", trace, NULL);
+    }
+    
+    return input;
+}
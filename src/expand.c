@@ -0,0 +1,387 @@
+#include "cshell.h"
+
+// Variable expansion and command substitution
+//
+// Words the lexer marked with TOKEN_EXPAND are expanded here, outside
+// single quotes:
+//
+//   $NAME, ${NAME}   the environment variable, or nothing if unset
+//   $?               the exit status of the last command
+//   $1 ... $9, ${N}  the arguments of the running function or script
+//   $#, $@, $*       their count, and all of them
+//   $0               the function or script name
+//   $(command)       the output of a command line, trailing newlines removed
+//
+// As in sh, an unquoted expansion is split into separate arguments at
+// blanks, while one inside double quotes stays a single argument. Words
+// with an unquoted pattern character are then globbed (glob.c); quoted
+// characters and expanded values never act as patterns. A line of
+// only NAME=value words sets those variables (in the environment, so child
+// processes see them too) and is never split.
+//
+// $(...) compiles the command text and runs it (vm.c) with the shell's
+// stdout pointed at a pipe, the way the command server captures a command.
+// A reader thread drains the pipe into a growable buffer while the command
+// runs, so output of any size works and nothing is written to disk. Builtins
+// run in-process as always; only external commands fork.
+
+#define FIELD_INITIAL_SIZE 64
+#define CAPTURE_CHUNK 65536
+
+// $0, $1, ...: NULL-terminated, owned by the VM frame or main()
+static char **positional_args;
+
+// The argument being built
+typedef struct {
+    char *data;                 // In the per-command arena
+    size_t length;
+    size_t capacity;
+    int started;                // Exists even if empty, e.g. ""
+    int glob;                   // A pattern, with literal characters escaped
+} Field;
+
+// Append text as it is, pattern characters included
+static void field_append_raw(Field *field, const char *text, size_t length) {
+    if (field->length + length + 1 > field->capacity) {
+        size_t capacity = field->capacity ? field->capacity : FIELD_INITIAL_SIZE;
+        while (capacity < field->length + length + 1) capacity *= 2;
+
+        field->data = arena_grow(field->data, field->length, capacity);
+        field->capacity = capacity;
+    }
+
+    memcpy(field->data + field->length, text, length);
+    field->length += length;
+    field->data[field->length] = '\0';
+    field->started = 1;
+}
+
+// Append literal text: quoted, escaped or the value of an expansion
+static void field_append(Field *field, const char *text, size_t length) {
+    if (!field->glob) {
+        field_append_raw(field, text, length);
+        return;
+    }
+
+    const char *end = text + length;
+    while (text < end) {
+        const char *run = text;
+        while (text < end && *text != '*' && *text != '?' && *text != '[' && *text != '\\') text++;
+        field_append_raw(field, run, (size_t)(text - run));
+        if (text == end) break;
+
+        field_append_raw(field, "\\", 1);
+        field_append_raw(field, text++, 1);
+    }
+}
+
+// Add the current field to the argument list and start a new one
+static void field_finish(Field *field, ArgList *out) {
+    if (!field->started) return;
+    if (field->data == NULL) field_append_raw(field, "", 0);
+
+    if (!field->glob) {
+        arg_list_push(out, field->data);
+    } else if (glob_expand(field->data, out) == 0) {
+        glob_unescape(field->data);
+        arg_list_push(out, field->data);
+    }
+
+    int glob = field->glob;
+    memset(field, 0, sizeof(*field));
+    field->glob = glob;
+}
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+// Append an expansion's value; unquoted, blanks in it separate arguments
+static void field_append_value(Field *field, const char *value, size_t length, int split, ArgList *out) {
+    if (!split) {
+        field_append(field, value, length);
+        return;
+    }
+
+    const char *end = value + length;
+    while (value < end) {
+        if (is_blank(*value)) {
+            field_finish(field, out);
+            while (value < end && is_blank(*value)) value++;
+            continue;
+        }
+
+        const char *run = value;
+        while (value < end && !is_blank(*value)) value++;
+        field_append(field, run, (size_t)(value - run));
+    }
+}
+
+static int is_name_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static int is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// Length of NAME in a NAME=value word, or 0 if the word is not one
+size_t assignment_name_length(const char *word, size_t length) {
+    if (length == 0 || !is_name_start(word[0])) return 0;
+
+    size_t i = 1;
+    while (i < length && is_name_char(word[i])) i++;
+    return i < length && word[i] == '=' ? i : 0;
+}
+
+// Replace the positional arguments; returns the previous ones
+char **set_positional_args(char **args) {
+    char **previous = positional_args;
+    positional_args = args;
+    return previous;
+}
+
+char **get_positional_args(void) {
+    return positional_args;
+}
+
+void set_variable(const char *name, const char *value) {
+#ifdef _WIN32
+    _putenv_s(name, value);
+#else
+    setenv(name, value, 1);
+#endif
+}
+
+// Set the variables of a line made only of NAME=value words. Returns 1 if
+// it was such a line, 0 if it is an ordinary command.
+int assign_variables(char **args) {
+    for (int i = 0; args[i] != NULL; i++) {
+        if (assignment_name_length(args[i], strlen(args[i])) == 0) return 0;
+    }
+
+    for (int i = 0; args[i] != NULL; i++) {
+        char *equals = strchr(args[i], '=');
+        *equals = '\0';
+        set_variable(args[i], equals + 1);
+        *equals = '=';
+    }
+
+    last_exit_status = 0;
+    return 1;
+}
+
+#ifndef _WIN32
+
+// Output of a substituted command, collected by the reader thread
+typedef struct {
+    int fd;
+    char *data;
+    size_t size;
+    size_t capacity;
+} Capture;
+
+static void *capture_output(void *arg) {
+    Capture *capture = arg;
+
+    for (;;) {
+        if (capture->capacity - capture->size < CAPTURE_CHUNK) {
+            size_t capacity = capture->capacity ? capture->capacity * 2 : CAPTURE_CHUNK * 2;
+            char *data = realloc(capture->data, capacity);
+            if (data == NULL) break;
+            capture->data = data;
+            capture->capacity = capacity;
+        }
+
+        ssize_t n = read(capture->fd, capture->data + capture->size, capture->capacity - capture->size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        capture->size += (size_t)n;
+    }
+
+    return NULL;
+}
+
+// Run a command line and return its output, without trailing newlines
+static char *substitute_command(const char *command, size_t length, size_t *out_length) {
+    uint64_t trace = trace_start();
+    int fds[2];
+
+    *out_length = 0;
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        perror("pipe");
+        return "";
+    }
+
+    Capture capture = {fds[0], NULL, 0, 0};
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, capture_output, &capture) != 0) {
+        perror("pthread_create");
+        close(fds[0]);
+        close(fds[1]);
+        return "";
+    }
+
+    fflush(stdout);
+    int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[1]);
+
+    // The command text is compiled and run like any other line; in a loop
+    // it is the same text every time, which the line cache catches
+    Program *program = compile_line(command, length);
+    if (program != NULL) {
+        run_program(program);
+        free_program(program);
+    } else {
+        last_exit_status = 2;
+    }
+
+    // Restoring stdout closes the last write end, so the reader sees EOF
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    pthread_join(reader, NULL);
+    close(fds[0]);
+
+    while (capture.size > 0 && capture.data[capture.size - 1] == '\n') capture.size--;
+
+    char *output = arena_alloc(capture.size + 1);
+    if (capture.size > 0) memcpy(output, capture.data, capture.size);
+    output[capture.size] = '\0';
+    free(capture.data);
+
+    if (debug_mode) printf(COLOR_YELLOW "Debug: $(%.*s) produced %zu bytes\n" COLOR_RESET, (int)length, command, capture.size);
+    if (trace != 0) trace_span("substitution", trace, arena_printf("%.*s", (int)length, command));
+
+    *out_length = capture.size;
+    return output;
+}
+
+#else
+
+static char *substitute_command(const char *command, size_t length, size_t *out_length) {
+    (void)command;
+    (void)length;
+    printf("Command substitution is not supported on Windows\n");
+    *out_length = 0;
+    return "";
+}
+
+#endif
+
+// The value of $N, $#, $@ or $* (name is the text after the '$')
+static const char *positional_value(const char *name, size_t name_length, size_t *length) {
+    int count = 0;
+    while (positional_args != NULL && positional_args[count] != NULL) count++;
+
+    const char *value = "";
+    if (*name == '#') {
+        value = arena_printf("%d", count > 0 ? count - 1 : 0);
+    } else if (*name == '@' || *name == '*') {
+        // Quoted, they stay one argument: there is no "$@" list splitting
+        if (count > 1) value = arena_join(positional_args + 1, " ");
+    } else {
+        int index = atoi(arena_printf("%.*s", (int)name_length, name));
+        if (index < count) value = positional_args[index];
+        else if (index == 0) value = "cshell";
+    }
+
+    *length = strlen(value);
+    return value;
+}
+
+// Expand the $ item at *pos, advancing past it. Returns its value, or NULL
+// when the '$' is just a literal character.
+static const char *expand_dollar(const char **pos, const char *end, size_t *length) {
+    const char *p = *pos + 1;
+
+    if (p < end && *p == '(') {
+        const char *close = skip_substitution(*pos, end);
+        *pos = close;
+        return substitute_command(p + 1, (size_t)(close - 1 - (p + 1)), length);
+    }
+
+    if (p < end && *p == '?') {
+        char *status = arena_printf("%d", last_exit_status);
+        *pos = p + 1;
+        *length = strlen(status);
+        return status;
+    }
+
+    if (p < end && (*p == '#' || *p == '@' || *p == '*' || isdigit((unsigned char)*p))) {
+        *pos = p + 1;
+        return positional_value(p, 1, length);
+    }
+
+    const char *name = p;
+    const char *name_end;
+    if (p < end && *p == '{') {
+        name = p + 1;
+        name_end = name;
+        while (name_end < end && is_name_char(*name_end)) name_end++;
+        if (name_end == name || name_end == end || *name_end != '}') return NULL;
+        *pos = name_end + 1;
+        if (isdigit((unsigned char)*name)) return positional_value(name, (size_t)(name_end - name), length);
+    } else {
+        if (p == end || !is_name_start(*p)) return NULL;
+        name_end = p;
+        while (name_end < end && is_name_char(*name_end)) name_end++;
+        *pos = name_end;
+    }
+
+    char *key = arena_alloc((size_t)(name_end - name) + 1);
+    memcpy(key, name, (size_t)(name_end - name));
+    key[name_end - name] = '\0';
+
+    const char *value = getenv(key);
+    if (value == NULL) value = "";
+    *length = strlen(value);
+    return value;
+}
+
+// Expand one word: remove its quotes, substitute every $ item, glob if asked
+// and append the resulting argument(s) to out. With split off (assignments)
+// the word always gives exactly one argument. The lexer has already checked
+// that every quote and $( is closed.
+void expand_word(const char *word, size_t length, int split, int glob, ArgList *out) {
+    const char *p = word;
+    const char *end = word + length;
+    Field field = {NULL, 0, 0, 0, glob};
+    const char *value;
+    size_t value_length;
+
+    while (p < end) {
+        if (*p == '\'') {
+            const char *close = memchr(p + 1, '\'', (size_t)(end - p - 1));
+            field_append(&field, p + 1, (size_t)(close - p - 1));
+            p = close + 1;
+        } else if (*p == '"') {
+            field_append(&field, "", 0);
+            for (p++; *p != '"';) {
+                if (*p == '\\' && strchr("\"\\$`\n", p[1]) != NULL) {
+                    if (p[1] != '\n') field_append(&field, p + 1, 1);
+                    p += 2;
+                } else if (*p == '$' && (value = expand_dollar(&p, end, &value_length)) != NULL) {
+                    field_append(&field, value, value_length);
+                } else {
+                    field_append(&field, p, 1);
+                    p++;
+                }
+            }
+            p++;
+        } else if (*p == '\\' && p + 1 < end) {
+            if (p[1] != '\n') field_append(&field, p + 1, 1);
+            p += 2;
+        } else if (*p == '$' && (value = expand_dollar(&p, end, &value_length)) != NULL) {
+            field_append_value(&field, value, value_length, split, out);
+        } else {
+            field_append_raw(&field, p, 1);
+            p++;
+        }
+    }
+
+    // An unquoted expansion that came out empty leaves no argument at all
+    if (!split) field_append_raw(&field, "", 0);
+    field_finish(&field, out);
+}
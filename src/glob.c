@@ -0,0 +1,482 @@
+#include "cshell.h"
+
+// Glob expansion
+//
+// Words with an unquoted *, ? or [...] are replaced by the paths they
+// match, in sorted order; a word that matches nothing is kept as written,
+// as in sh. A `**` component matches any number of directories, and a
+// trailing '/' matches directories only. Names starting with '.' only match
+// a pattern that starts with '.' too.
+//
+// Patterns are matched against directory listings read with getdents64(),
+// whose d_type tells directories apart without a stat() per entry. Each
+// listing is sorted once when it is read and kept in a cache keyed by the
+// directory's device and inode, so scripts that glob the same directories
+// again only pay one stat() per directory. A listing is reused while the
+// directory's mtime is unchanged and older than the listing itself (a
+// change within the same second could otherwise go unnoticed). A `**`
+// walk finds a directory's own matches before those below it, so the paths
+// a pattern matched are sorted once more as a whole.
+//
+// Globbing happens while a command line is tokenized, on the shell's main
+// thread only, so the cache takes no locks.
+
+#define GLOB_CACHE_SLOTS 256
+#define GLOB_READ_BUFFER 32768
+
+// Match one [...] class at *pattern (just past the '['); advances past the
+// ']'. Returns 1 or 0, or -1 when there is no ']' and '[' is literal.
+static int match_class(const char **pattern, char c) {
+    const char *p = *pattern;
+    int negate = *p == '!' || *p == '^';
+    int matched = 0;
+
+    if (negate) p++;
+    for (int first = 1; *p != '\0' && (*p != ']' || first); first = 0) {
+        char low = *p;
+        if (low == '\\' && p[1] != '\0') low = *++p;
+        char high = low;
+        p++;
+
+        if (p[0] == '-' && p[1] != ']' && p[1] != '\0') {
+            high = p[1];
+            if (high == '\\' && p[2] != '\0') high = *++p;
+            p += 2;
+        }
+        if ((unsigned char)c >= (unsigned char)low && (unsigned char)c <= (unsigned char)high) matched = 1;
+    }
+
+    if (*p != ']') return -1;
+    *pattern = p + 1;
+    return matched != negate;
+}
+
+// Match a name against one path component pattern
+int glob_match(const char *pattern, const char *name) {
+    const char *star_pattern = NULL;
+    const char *star_name = NULL;
+
+    while (*name != '\0') {
+        if (*pattern == '*') {
+            while (*pattern == '*') pattern++;
+            star_pattern = pattern;
+            star_name = name;
+            continue;
+        }
+        if (*pattern == '?') {
+            pattern++;
+            name++;
+            continue;
+        }
+        if (*pattern == '[') {
+            const char *after = pattern + 1;
+            int result = match_class(&after, *name);
+            if (result == 1) {
+                pattern = after;
+                name++;
+                continue;
+            }
+            if (result < 0 && *name == '[') {
+                pattern++;
+                name++;
+                continue;
+            }
+        } else if (*pattern != '\0') {
+            const char *literal = pattern;
+            if (*literal == '\\' && literal[1] != '\0') literal++;
+            if (*literal == *name) {
+                pattern = literal + 1;
+                name++;
+                continue;
+            }
+        }
+
+        // Mismatch: let the last '*' swallow one more character
+        if (star_pattern == NULL) return 0;
+        pattern = star_pattern;
+        name = ++star_name;
+    }
+
+    while (*pattern == '*') pattern++;
+    return *pattern == '\0';
+}
+
+// Remove the backslashes that mark quoted characters
+void glob_unescape(char *pattern) {
+    char *dst = pattern;
+    for (const char *src = pattern; *src != '\0'; src++) {
+        if (*src == '\\' && src[1] != '\0') src++;
+        *dst++ = *src;
+    }
+    *dst = '\0';
+}
+
+// Whether a component has an unquoted pattern character
+static int has_magic(const char *component, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (component[i] == '\\') i++;
+        else if (component[i] == '*' || component[i] == '?' || component[i] == '[') return 1;
+    }
+    return 0;
+}
+
+#ifndef _WIN32
+
+#ifdef __linux__
+#include <sys/syscall.h>
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+typedef struct {
+    const char *name;
+    unsigned char type;             // DT_DIR, DT_REG, DT_LNK, ... or DT_UNKNOWN
+} DirEntry;
+
+typedef struct DirListing {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    time_t loaded;
+    unsigned long generation;       // The glob that read it
+    int count;
+    DirEntry *entries;              // Sorted by name
+    char *names;
+    struct DirListing *next;        // In the retired list
+} DirListing;
+
+static DirListing *dir_cache[GLOB_CACHE_SLOTS];
+
+// Listings evicted while a glob may still be walking them
+static DirListing *retired_listings = NULL;
+
+static unsigned long glob_generation = 0;
+static unsigned long cache_hits = 0;
+static unsigned long cache_reads = 0;
+
+static void free_listing(DirListing *listing) {
+    free(listing->entries);
+    free(listing->names);
+    free(listing);
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const DirEntry *)a)->name, ((const DirEntry *)b)->name);
+}
+
+// Names are collected into one buffer first; entries point into it once
+// it no longer moves
+typedef struct {
+    char *names;
+    size_t names_size;
+    size_t names_capacity;
+    size_t *offsets;
+    unsigned char *types;
+    int count;
+    int capacity;
+} ListingBuilder;
+
+static int add_entry(ListingBuilder *b, const char *name, unsigned char type) {
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) return 0;
+
+    size_t len = strlen(name) + 1;
+    if (b->names_size + len > b->names_capacity) {
+        size_t capacity = b->names_capacity ? b->names_capacity : 4096;
+        while (b->names_size + len > capacity) capacity *= 2;
+        char *names = realloc(b->names, capacity);
+        if (names == NULL) return -1;
+        b->names = names;
+        b->names_capacity = capacity;
+    }
+    if (b->count == b->capacity) {
+        int capacity = b->capacity ? b->capacity * 2 : 64;
+        size_t *offsets = realloc(b->offsets, capacity * sizeof(size_t));
+        if (offsets == NULL) return -1;
+        b->offsets = offsets;
+        unsigned char *types = realloc(b->types, capacity);
+        if (types == NULL) return -1;
+        b->types = types;
+        b->capacity = capacity;
+    }
+
+    memcpy(b->names + b->names_size, name, len);
+    b->offsets[b->count] = b->names_size;
+    b->types[b->count] = type;
+    b->count++;
+    b->names_size += len;
+    return 0;
+}
+
+// Read a directory's names and types; NULL if it cannot be read
+static DirListing *read_listing(const char *path) {
+    ListingBuilder b;
+    memset(&b, 0, sizeof(b));
+
+#ifdef __linux__
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    char buffer[GLOB_READ_BUFFER];
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0) {
+        for (long offset = 0; offset < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buffer + offset);
+            offset += d->d_reclen;
+            add_entry(&b, d->d_name, d->d_type);
+        }
+    }
+    close(fd);
+#else
+    DIR *dir = opendir(path);
+    if (dir == NULL) return NULL;
+
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) add_entry(&b, d->d_name, d->d_type);
+    closedir(dir);
+#endif
+
+    DirListing *listing = calloc(1, sizeof(DirListing));
+    if (listing != NULL) listing->entries = malloc((b.count + 1) * sizeof(DirEntry));
+    if (listing == NULL || listing->entries == NULL) {
+        free(listing);
+        free(b.names);
+        free(b.offsets);
+        free(b.types);
+        return NULL;
+    }
+
+    listing->names = b.names;
+    listing->count = b.count;
+    for (int i = 0; i < b.count; i++) {
+        listing->entries[i].name = b.names + b.offsets[i];
+        listing->entries[i].type = b.types[i];
+    }
+    qsort(listing->entries, listing->count, sizeof(DirEntry), compare_entries);
+
+    free(b.offsets);
+    free(b.types);
+    return listing;
+}
+
+// The sorted listing of a directory, from the cache when it is current
+static DirListing *get_listing(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) return NULL;
+
+    unsigned long slot = ((unsigned long)st.st_dev * 31 + (unsigned long)st.st_ino) % GLOB_CACHE_SLOTS;
+    DirListing *cached = dir_cache[slot];
+
+    // A directory changed in the second its listing was read may have
+    // changed after the read, except during the glob that read it
+    if (cached != NULL && cached->dev == st.st_dev && cached->ino == st.st_ino &&
+        cached->mtime.tv_sec == st.st_mtim.tv_sec && cached->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+        (st.st_mtim.tv_sec < cached->loaded || cached->generation == glob_generation)) {
+        cache_hits++;
+        return cached;
+    }
+
+    time_t loaded = time(NULL);
+    DirListing *listing = read_listing(path);
+    if (listing == NULL) return NULL;
+    cache_reads++;
+
+    listing->dev = st.st_dev;
+    listing->ino = st.st_ino;
+    listing->mtime = st.st_mtim;
+    listing->loaded = loaded;
+    listing->generation = glob_generation;
+
+    if (cached != NULL) {
+        cached->next = retired_listings;
+        retired_listings = cached;
+    }
+    dir_cache[slot] = listing;
+    return listing;
+}
+
+// Entry of a listing by exact name
+static DirEntry *find_entry(DirListing *listing, const char *name) {
+    DirEntry key = {name, 0};
+    return bsearch(&key, listing->entries, listing->count, sizeof(DirEntry), compare_entries);
+}
+
+typedef struct {
+    char **components;              // Escaped pattern text, one per path level
+    int count;
+    int dirs_only;                  // The pattern ended in '/'
+    char *path;                     // Current prefix, in the per-command arena
+    size_t capacity;
+    ArgList *out;
+    int matches;
+} GlobWalk;
+
+// Whether an entry is a directory, resolving symlinks only when asked
+static int entry_is_dir(GlobWalk *walk, unsigned char type, int follow) {
+    if (type == DT_DIR) return 1;
+    if (type != DT_UNKNOWN && !(follow && type == DT_LNK)) return 0;
+
+    struct stat st;
+    int result = follow ? stat(walk->path, &st) : lstat(walk->path, &st);
+    return result == 0 && S_ISDIR(st.st_mode);
+}
+
+// Append name (and a '/' if more components follow) to the prefix
+static size_t walk_append(GlobWalk *walk, size_t length, const char *name, int slash) {
+    size_t name_length = strlen(name);
+    size_t needed = length + name_length + 2;
+
+    if (needed > walk->capacity) {
+        size_t capacity = walk->capacity * 2;
+        while (capacity < needed) capacity *= 2;
+        walk->path = arena_grow(walk->path, length + 1, capacity);
+        walk->capacity = capacity;
+    }
+
+    memcpy(walk->path + length, name, name_length);
+    length += name_length;
+    if (slash) walk->path[length++] = '/';
+    walk->path[length] = '\0';
+    return length;
+}
+
+static void walk_emit(GlobWalk *walk, size_t length) {
+    char *match = arena_alloc(length + 2);
+    memcpy(match, walk->path, length);
+    if (walk->dirs_only) match[length++] = '/';
+    match[length] = '\0';
+
+    arg_list_push(walk->out, match);
+    walk->matches++;
+}
+
+// Match components from index onwards below the prefix path[0..length).
+// type is the d_type of the entry the prefix names.
+static void glob_walk(GlobWalk *walk, int index, size_t length, unsigned char type) {
+    if (index == walk->count) {
+        if (!walk->dirs_only || entry_is_dir(walk, type, 1)) walk_emit(walk, length);
+        return;
+    }
+
+    const char *component = walk->components[index];
+    int last = index == walk->count - 1;
+    walk->path[length] = '\0';
+    DirListing *listing = get_listing(length > 0 ? walk->path : ".");
+
+    // A literal component only has to exist
+    if (!has_magic(component, strlen(component))) {
+        char *name = arena_strdup(component);
+        glob_unescape(name);
+
+        // Listings leave out . and .., which always exist
+        unsigned char entry_type = DT_UNKNOWN;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            entry_type = DT_DIR;
+        } else if (listing != NULL) {
+            DirEntry *entry = find_entry(listing, name);
+            if (entry == NULL) return;
+            entry_type = entry->type;
+        } else {
+            struct stat st;
+            walk_append(walk, length, name, 0);
+            if (lstat(walk->path, &st) != 0) return;
+        }
+
+        glob_walk(walk, index + 1, walk_append(walk, length, name, !last), entry_type);
+        return;
+    }
+    if (listing == NULL) return;
+
+    // "**" matches this level itself and every directory below it.
+    // Symlinks are not followed, so there are no cycles.
+    if (strcmp(component, "**") == 0) {
+        if (!last) glob_walk(walk, index + 1, length, DT_DIR);
+
+        for (int i = 0; i < listing->count; i++) {
+            DirEntry *entry = &listing->entries[i];
+            if (entry->name[0] == '.') continue;
+
+            size_t next = walk_append(walk, length, entry->name, 0);
+            int is_dir = entry_is_dir(walk, entry->type, 0);
+
+            // A trailing "**" matches every entry at every level
+            if (last) glob_walk(walk, index + 1, next, entry->type);
+            if (is_dir) glob_walk(walk, index, walk_append(walk, length, entry->name, 1), DT_DIR);
+        }
+        return;
+    }
+
+    for (int i = 0; i < listing->count; i++) {
+        DirEntry *entry = &listing->entries[i];
+        if (entry->name[0] == '.' && component[0] != '.') continue;
+        if (!glob_match(component, entry->name)) continue;
+
+        glob_walk(walk, index + 1, walk_append(walk, length, entry->name, !last), entry->type);
+    }
+}
+
+// Expand a pattern (with quoted characters escaped by '\') into the paths
+// it matches. Returns the number of matches added to out.
+int glob_expand(const char *pattern, ArgList *out) {
+    size_t length = strlen(pattern);
+    if (!has_magic(pattern, length)) return 0;
+
+    uint64_t trace = trace_start();
+    unsigned long hits = cache_hits, reads = cache_reads;
+    glob_generation++;
+
+    // Split into components; empty ones (from "//" or a leading '/') vanish
+    char *copy = arena_strdup(pattern);
+    char **components = arena_alloc((length / 2 + 2) * sizeof(char *));
+    int count = 0;
+    for (char *p = copy; *p != '\0';) {
+        char *slash = strchr(p, '/');
+        if (slash != NULL) *slash = '\0';
+        if (*p != '\0') components[count++] = p;
+        if (slash == NULL) break;
+        p = slash + 1;
+    }
+
+    GlobWalk walk = {components, count, length > 1 && pattern[length - 1] == '/', NULL, 256, out, 0};
+    walk.path = arena_alloc(walk.capacity);
+    size_t prefix = 0;
+    if (pattern[0] == '/') walk.path[prefix++] = '/';
+    walk.path[prefix] = '\0';
+
+    int first = out->count;
+    if (count > 0) glob_walk(&walk, 0, prefix, DT_DIR);
+    qsort(out->args + first, (size_t)(out->count - first), sizeof(char *), compare_paths);
+
+    // Nothing walks the evicted listings any more
+    while (retired_listings != NULL) {
+        DirListing *next = retired_listings->next;
+        free_listing(retired_listings);
+        retired_listings = next;
+    }
+
+    if (debug_mode) {
+        printf(COLOR_YELLOW "Debug: glob %s: %d matches (%lu cached listings, %lu read)\n" COLOR_RESET,
+               pattern, walk.matches, cache_hits - hits, cache_reads - reads);
+    }
+    trace_span("glob", trace, pattern);
+    return walk.matches;
+}
+
+#else
+
+int glob_expand(const char *pattern, ArgList *out) {
+    (void)pattern;
+    (void)out;
+    return 0;
+}
+
+#endif
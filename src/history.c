@@ -0,0 +1,447 @@
+#include "cshell.h"
+
+// Command history storage
+//
+// The entries live in command_history[] as a ring: history_start is the
+// oldest, so once the history is full a new entry takes the oldest one's
+// slot and nothing else moves. history_entry() hides the wrap-around.
+//
+// ~/.cshell_history is a journal. Each new entry is appended with a single
+// write on a descriptor opened once with O_APPEND, so saving an entry costs
+// the same however long the history is, and shells sharing the file add
+// whole lines without overwriting each other. A newline or backslash in an
+// entry is written as \n or \\, so every entry stays one line (a pasted
+// line can hold newlines). Loading keeps the newest
+// MAX_HISTORY lines. Once the file is HISTORY_COMPACT_FACTOR times the size
+// of the lines kept, a background thread copies the file's newest
+// MAX_HISTORY lines to a temporary file and renames it over the journal.
+//
+// Several shells can share the journal. Appends hold a shared flock() on
+// it, and the compaction takes an exclusive one before it copies the lines
+// appended since its snapshot, from any shell, and renames the copy over
+// the journal. A shell whose descriptor still names the replaced file sees
+// that once it holds the lock, and reopens the journal by name before
+// writing. A compaction that finds it was beaten to it by another shell
+// throws its copy away.
+//
+// Where the structured store (histstore.c) can be opened it takes over: the
+// entries, with their times, exit statuses and directories, come from its
+// mapped files, the whole history is kept rather than MAX_HISTORY entries,
+// and the ring and journal are left unused. They remain for when the store
+// cannot be opened, and on Windows.
+
+#define HISTORY_COMPACT_FACTOR 8
+#define HISTORY_COMPACT_MIN_SIZE 4096   // Journals smaller than this are left alone
+
+#ifndef _WIN32
+#include <sys/file.h>
+#endif
+
+static int history_start;               // Slot of the oldest entry
+static char history_path[MAX_PATH_LENGTH];
+static long journal_size;               // Bytes in the file at our last write
+static long kept_size;                  // Bytes kept by the last load or compaction
+static int store_active;                // Entries come from the structured store
+
+#ifndef _WIN32
+static int journal_fd = -1;
+static ino_t journal_inode;             // The file journal_fd has open
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static int compacting;
+#endif
+
+// The index-th entry, oldest first
+const char *history_entry(int index) {
+    if (store_active) return history_store_command(index);
+    return command_history[(history_start + index) % MAX_HISTORY];
+}
+
+// ~/.cshell_history, or NULL without a home directory
+static const char *history_file_path(void) {
+    if (history_path[0] != '\0') return history_path;
+
+#ifdef _WIN32
+    char *home_dir = getenv("USERPROFILE");
+#else
+    char *home_dir = getenv("HOME");
+#endif
+
+    if (home_dir == NULL) {
+        if (debug_mode) printf("Error: Could not get home directory\n");
+        return NULL;
+    }
+
+    snprintf(history_path, sizeof(history_path), "%s/.cshell_history", home_dir);
+    return history_path;
+}
+
+// The journal line for an entry, with newlines and backslashes escaped.
+// Returns command itself if it has neither, otherwise a malloc'd copy.
+char *history_escape(const char *command) {
+    if (strpbrk(command, "\n\\") == NULL) return (char *)command;
+
+    char *line = malloc(strlen(command) * 2 + 1);
+    if (line == NULL) return NULL;
+
+    char *out = line;
+    for (const char *p = command; *p != '\0'; p++) {
+        if (*p == '\n' || *p == '\\') *out++ = '\\';
+        *out++ = *p == '\n' ? 'n' : *p;
+    }
+    *out = '\0';
+    return line;
+}
+
+// Undo history_escape() in place. Other backslashes, as in journals
+// written before entries were escaped, are left as they are.
+void history_unescape(char *line) {
+    char *out = line;
+    for (const char *p = line; *p != '\0'; p++) {
+        if (*p == '\\' && (p[1] == 'n' || p[1] == '\\')) {
+            *out++ = *++p == 'n' ? '\n' : '\\';
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+}
+
+// Where the newest MAX_HISTORY non-empty lines of a journal start
+static size_t newest_lines(const char *data, size_t size) {
+    size_t start = size;
+    int kept = 0;
+
+    if (size == 0) return 0;
+    size_t line_end = data[size - 1] == '\n' ? size - 1 : size;
+    for (size_t p = line_end + 1; p-- > 0 && kept < MAX_HISTORY;) {
+        if (p > 0 && data[p - 1] != '\n') continue;
+        if (p < line_end) {
+            kept++;
+            start = p;
+        }
+        if (p > 0) line_end = p - 1;
+    }
+    return start;
+}
+
+// Whether a journal this size is worth compacting
+static int journal_oversized(void) {
+    long kept = kept_size > HISTORY_COMPACT_MIN_SIZE ? kept_size : HISTORY_COMPACT_MIN_SIZE;
+    return journal_size > kept * HISTORY_COMPACT_FACTOR;
+}
+
+// Save command history to file, replacing what it held
+void save_history(void) {
+    if (store_active) return;       // Every entry is already on disk
+
+    const char *path = history_file_path();
+    if (path == NULL) return;
+
+    FILE *history_file = fopen(path, "w");
+    if (history_file == NULL) {
+        if (debug_mode) printf("Error: Could not save history to %s\n", path);
+        return;
+    }
+
+    for (int i = 0; i < history_count; i++) {
+        char *line = history_escape(history_entry(i));
+        if (line == NULL) continue;
+        fprintf(history_file, "%s\n", line);
+        if (line != history_entry(i)) free(line);
+    }
+    journal_size = kept_size = ftell(history_file);
+
+    fclose(history_file);
+}
+
+#ifndef _WIN32
+
+static int open_journal(const char *path) {
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0) journal_inode = st.st_ino;
+    return fd;
+}
+
+// Whether path names a different file than the one with this inode, as
+// after a compaction renamed a new journal over it
+static int journal_replaced(const char *path, ino_t inode) {
+    struct stat st;
+    return stat(path, &st) == 0 && st.st_ino != inode;
+}
+
+// Read a file from offset to its end; returns a malloc'd buffer or NULL
+static char *read_from(int fd, off_t offset, size_t *size) {
+    char *data = NULL;
+    size_t capacity = 0;
+
+    *size = 0;
+    for (;;) {
+        if (capacity - *size < MAX_LINE_LENGTH) {
+            capacity = capacity ? capacity * 2 : MAX_LINE_LENGTH * 4;
+            char *grown = realloc(data, capacity);
+            if (grown == NULL) break;
+            data = grown;
+        }
+        ssize_t n = pread(fd, data + *size, capacity - *size, offset + (off_t)*size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        *size += (size_t)n;
+    }
+    return data;
+}
+
+// Rewrite the journal with its newest MAX_HISTORY lines, in the background
+static void *compact_journal(void *arg) {
+    (void)arg;
+    const char *path = history_file_path();
+    char *temp_path = NULL;
+    FILE *temp = NULL;
+    char *data = NULL, *tail = NULL;
+    size_t size = 0, start = 0, tail_size = 0;
+    struct stat st;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    int failed = fd < 0 || fstat(fd, &st) != 0 || asprintf(&temp_path, "%s.XXXXXX", path) < 0;
+    if (!failed) {
+        int temp_fd = mkostemp(temp_path, O_CLOEXEC);
+        if (temp_fd >= 0 && (temp = fdopen(temp_fd, "w")) == NULL) close(temp_fd);
+        failed = temp == NULL;
+    }
+
+    // A snapshot up to its last whole line, taken while shells go on appending
+    if (!failed) {
+        data = read_from(fd, 0, &size);
+        while (size > 0 && data[size - 1] != '\n') size--;
+        start = newest_lines(data, size);
+        failed = fwrite(data + start, 1, size - start, temp) != size - start;
+    }
+
+    // Appends wait from here on. The lines added since the snapshot go in
+    // last, unless another shell has already replaced the journal.
+    if (!failed) failed = flock(fd, LOCK_EX) != 0 || journal_replaced(path, st.st_ino);
+    if (!failed) {
+        tail = read_from(fd, (off_t)size, &tail_size);
+        failed = fwrite(tail, 1, tail_size, temp) != tail_size;
+    }
+    if (temp != NULL && fclose(temp) != 0) failed = 1;
+    if (!failed) failed = rename(temp_path, path) != 0;
+    if (failed && temp_path != NULL) unlink(temp_path);
+    if (fd >= 0) close(fd);         // Which also releases the lock
+
+    pthread_mutex_lock(&journal_lock);
+    if (!failed) journal_size = kept_size = (long)(size - start + tail_size);
+    compacting = 0;
+    pthread_mutex_unlock(&journal_lock);
+
+    free(data);
+    free(tail);
+    free(temp_path);
+    return NULL;
+}
+
+// Append the newest entry to the journal
+static void journal_append(const char *command) {
+    const char *path = history_file_path();
+    if (path == NULL) return;
+
+    char *escaped = history_escape(command);
+    if (escaped == NULL) return;
+
+    pthread_mutex_lock(&journal_lock);
+
+    // Follow the journal to a new file if a compaction replaced it
+    for (;;) {
+        if (journal_fd < 0) journal_fd = open_journal(path);
+        if (journal_fd < 0) break;
+
+        flock(journal_fd, LOCK_SH);
+        if (!journal_replaced(path, journal_inode)) break;
+        close(journal_fd);
+        journal_fd = -1;
+    }
+    if (journal_fd < 0) {
+        pthread_mutex_unlock(&journal_lock);
+        if (escaped != command) free(escaped);
+        if (debug_mode) printf("Error: Could not save history to %s\n", path);
+        return;
+    }
+
+    // One write, so the line is never split by another shell's
+    struct iovec line[2] = {
+        {escaped, strlen(escaped)},
+        {"\n", 1},
+    };
+    ssize_t written;
+    do {
+        written = writev(journal_fd, line, 2);
+    } while (written < 0 && errno == EINTR);
+
+    // Appending left the offset at the end, wherever other shells put it
+    off_t end = lseek(journal_fd, 0, SEEK_CUR);
+    if (end >= 0) journal_size = (long)end;
+    flock(journal_fd, LOCK_UN);
+    if (escaped != command) free(escaped);
+
+    int compact = !compacting && journal_oversized();
+    if (compact) compacting = 1;
+
+    pthread_mutex_unlock(&journal_lock);
+
+    if (compact) {
+        pthread_t thread;
+        if (debug_mode) printf(COLOR_YELLOW "Debug: compacting history journal (%ld bytes)\n" COLOR_RESET, journal_size);
+        if (pthread_create(&thread, NULL, compact_journal, NULL) == 0) {
+            pthread_detach(thread);
+        } else {
+            pthread_mutex_lock(&journal_lock);
+            compacting = 0;
+            pthread_mutex_unlock(&journal_lock);
+        }
+    }
+}
+
+#else
+
+static void journal_append(const char *command) {
+    const char *path = history_file_path();
+    if (path == NULL) return;
+
+    // Without a background rewrite, compaction is done in place
+    if (journal_oversized()) {
+        save_history();
+        return;
+    }
+
+    FILE *history_file = fopen(path, "a");
+    if (history_file == NULL) {
+        if (debug_mode) printf("Error: Could not save history to %s\n", path);
+        return;
+    }
+    char *line = history_escape(command);
+    if (line != NULL) fprintf(history_file, "%s\n", line);
+    if (line != command) free(line);
+    journal_size = ftell(history_file);
+    fclose(history_file);
+}
+
+#endif
+
+// Add command to history
+void add_to_history(const char *command) {
+    ensure_history();
+
+    // Don't add empty commands or duplicates of the last command
+    if (command[0] == '\0' ||
+        (history_count > 0 && strcmp(command, history_entry(history_count - 1)) == 0)) {
+        return;
+    }
+
+    if (store_active) {
+        int previous = history_count;
+        if (history_store_append(command) != 0 && debug_mode) {
+            printf("Error: Could not add to history store: %s\n", strerror(errno));
+        }
+
+        // Other shells' entries may have come along with this one
+        history_count = history_store_count();
+        history_position = history_count;
+        if (history_count == previous + 1) history_search_add(command);
+        else history_search_reset();
+        return;
+    }
+
+    // When full, the new entry takes the oldest one's slot
+    if (history_count >= MAX_HISTORY) {
+        free(command_history[history_start]);
+        command_history[history_start] = strdup(command);
+        history_start = (history_start + 1) % MAX_HISTORY;
+    } else {
+        command_history[history_count] = strdup(command);
+        history_count++;
+    }
+    history_position = history_count;
+    history_search_add(command);
+
+    journal_append(command);
+}
+
+// Open the history store, or load command history from file: its newest
+// MAX_HISTORY lines
+void load_history(void) {
+    int stored = history_store_open();
+    if (stored >= 0) {
+        store_active = 1;
+        history_count = stored;
+        history_position = history_count;
+        return;
+    }
+
+    const char *path = history_file_path();
+    if (path == NULL) return;
+
+    FILE *history_file = fopen(path, "r");
+    if (history_file == NULL) {
+        // It's okay if the file doesn't exist yet
+        return;
+    }
+
+    char *data = NULL;
+    size_t size = 0, capacity = 0;
+    for (;;) {
+        if (capacity - size < MAX_LINE_LENGTH) {
+            capacity = capacity ? capacity * 2 : MAX_LINE_LENGTH * 4;
+            char *grown = realloc(data, capacity);
+            if (grown == NULL) break;
+            data = grown;
+        }
+        size_t n = fread(data + size, 1, capacity - size, history_file);
+        if (n == 0) break;
+        size += n;
+    }
+    fclose(history_file);
+
+    size_t start = newest_lines(data, size);
+    journal_size = (long)size;
+    kept_size = (long)(size - start);
+
+    for (size_t i = start; i < size;) {
+        char *end = memchr(data + i, '\n', size - i);
+        size_t length = end != NULL ? (size_t)(end - (data + i)) : size - i;
+        if (length > 0 && history_count < MAX_HISTORY) {
+            char *entry = strndup(data + i, length);
+            if (entry != NULL) {
+                history_unescape(entry);
+                command_history[history_count++] = entry;
+            }
+        }
+        i += length + 1;
+    }
+
+    history_position = history_count;
+    free(data);
+}
+
+// Time, exit status and directory of the index-th entry, or NULL without a
+// structured store
+const HistoryRecord *history_details(int index) {
+    return store_active ? history_store_get(index) : NULL;
+}
+
+// The command last added to the history has finished
+void history_finish(int exit_status, int64_t duration_us) {
+    if (store_active) history_store_finish(exit_status, duration_us);
+}
+
+// Add the lines of a plain-text history file. Returns how many were added,
+// or -1 if the file could not be read or there is no structured store.
+int history_import(const char *path) {
+    ensure_history();
+    if (!store_active) return -1;
+
+    int count = history_store_import(path);
+    history_count = history_store_count();
+    history_position = history_count;
+    history_search_reset();
+    return count;
+}
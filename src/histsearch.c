@@ -0,0 +1,235 @@
+#include "cshell.h"
+
+// Incremental history search
+//
+// Ctrl-R in the line editor looks for the newest history entry containing
+// the text typed so far, again on every keystroke. Rather than scanning the
+// entries with strstr(), a query of three or more characters is answered
+// from a trigram index: for every three-byte sequence the entries containing
+// it, as an ascending list of entry serial numbers. The entries holding all
+// of the query's trigrams are the candidates; walking the lists backwards
+// from the newest, rarest list first, with a binary search in each, finds
+// the newest candidate in time logarithmic in the history size, and only
+// candidates are compared against the query text. A one or two character
+// query is rarely absent from the last few entries, so it just scans back.
+//
+// Entries are numbered in the order they were added, so removing the oldest
+// entry changes no numbers: the lists keep the serials of removed entries
+// until there are more removed than live ones, and then the index is built
+// afresh, which keeps the cost per added entry constant. The index is built
+// on the first search and then kept up to date by add_to_history().
+
+#define TRIGRAM_TABLE_INITIAL_SIZE 4096     // A power of two
+#define POSTING_INITIAL_SIZE 4
+#define MIN_COMPACT_ENTRIES 1024            // Removed entries tolerated before a rebuild
+
+typedef struct {
+    uint32_t trigram;           // Three bytes, never 0 since entries hold no NUL
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *serials;          // Ascending
+} Posting;
+
+static Posting *trigram_table;
+static size_t trigram_table_size;
+static size_t trigram_table_used;
+static int index_built;
+static uint32_t first_indexed;  // Serial of the oldest entry when the index was built
+static uint32_t next_serial;    // Serial the next entry will get
+
+static uint32_t trigram_at(const char *text) {
+    return (uint32_t)(unsigned char)text[0] << 16 | (uint32_t)(unsigned char)text[1] << 8 | (unsigned char)text[2];
+}
+
+static size_t trigram_slot(uint32_t trigram) {
+    return (size_t)((trigram * 0x9E3779B1u) >> 7) & (trigram_table_size - 1);
+}
+
+static Posting *find_posting(uint32_t trigram) {
+    if (trigram_table == NULL) return NULL;
+
+    for (size_t i = trigram_slot(trigram);; i = (i + 1) & (trigram_table_size - 1)) {
+        if (trigram_table[i].trigram == trigram) return &trigram_table[i];
+        if (trigram_table[i].trigram == 0) return NULL;
+    }
+}
+
+static int grow_table(void) {
+    size_t size = trigram_table_size ? trigram_table_size * 2 : TRIGRAM_TABLE_INITIAL_SIZE;
+    Posting *table = calloc(size, sizeof(Posting));
+    if (table == NULL) return 0;
+
+    Posting *old = trigram_table;
+    size_t old_size = trigram_table_size;
+    trigram_table = table;
+    trigram_table_size = size;
+
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].trigram == 0) continue;
+        size_t slot = trigram_slot(old[i].trigram);
+        while (table[slot].trigram != 0) slot = (slot + 1) & (size - 1);
+        table[slot] = old[i];
+    }
+    free(old);
+    return 1;
+}
+
+static Posting *add_posting(uint32_t trigram) {
+    Posting *posting = find_posting(trigram);
+    if (posting != NULL) return posting;
+
+    // Keep the table at most half full
+    if ((trigram_table_used + 1) * 2 > trigram_table_size && !grow_table()) return NULL;
+
+    size_t slot = trigram_slot(trigram);
+    while (trigram_table[slot].trigram != 0) slot = (slot + 1) & (trigram_table_size - 1);
+    trigram_table[slot].trigram = trigram;
+    trigram_table_used++;
+    return &trigram_table[slot];
+}
+
+static void index_entry(const char *text, uint32_t serial) {
+    size_t length = strlen(text);
+
+    for (size_t i = 0; i + 3 <= length; i++) {
+        Posting *posting = add_posting(trigram_at(text + i));
+        if (posting == NULL) return;
+
+        // A trigram repeated within the entry is listed once
+        if (posting->count > 0 && posting->serials[posting->count - 1] == serial) continue;
+
+        if (posting->count == posting->capacity) {
+            uint32_t capacity = posting->capacity ? posting->capacity * 2 : POSTING_INITIAL_SIZE;
+            uint32_t *serials = realloc(posting->serials, capacity * sizeof(uint32_t));
+            if (serials == NULL) return;
+            posting->serials = serials;
+            posting->capacity = capacity;
+        }
+        posting->serials[posting->count++] = serial;
+    }
+}
+
+static void free_index(void) {
+    for (size_t i = 0; i < trigram_table_size; i++) free(trigram_table[i].serials);
+    free(trigram_table);
+    trigram_table = NULL;
+    trigram_table_size = 0;
+    trigram_table_used = 0;
+    index_built = 0;
+}
+
+// Forget the index, when entries were added other than one at a time
+void history_search_reset(void) {
+    free_index();
+}
+
+// Index the history as it is now, numbering its entries from 0
+static void build_index(void) {
+    uint64_t trace = trace_start();
+
+    free_index();
+    for (int i = 0; i < history_count; i++) index_entry(history_entry(i), (uint32_t)i);
+    first_indexed = 0;
+    next_serial = (uint32_t)history_count;
+    index_built = 1;
+
+    if (trace != 0) trace_span("history index", trace, arena_printf("%d entries, %zu trigrams", history_count, trigram_table_used));
+}
+
+// The newest entry has just been added to the history (and the oldest
+// possibly removed)
+void history_search_add(const char *command) {
+    if (!index_built) return;
+
+    // Serials below this belong to removed entries
+    uint32_t first_live = next_serial + 1 - (uint32_t)history_count;
+    uint32_t removed = first_live - first_indexed;
+    if (removed > MIN_COMPACT_ENTRIES && removed > (uint32_t)history_count) {
+        build_index();
+        return;
+    }
+
+    index_entry(command, next_serial++);
+}
+
+// Position of the last serial <= limit in a posting list, or -1
+static long last_at_most(const Posting *posting, uint32_t limit) {
+    long lo = 0, hi = (long)posting->count;
+
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        if (posting->serials[mid] <= limit) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo - 1;
+}
+
+static int by_count(const void *a, const void *b) {
+    const Posting *x = *(Posting *const *)a;
+    const Posting *y = *(Posting *const *)b;
+    return x->count < y->count ? -1 : x->count > y->count;
+}
+
+// The newest entry before index `before` that contains query, or -1. The
+// match's offset within the entry is stored in *offset.
+int history_search(const char *query, int before, size_t *offset) {
+    size_t length = strlen(query);
+    const char *found;
+
+    ensure_history();
+    if (before > history_count) before = history_count;
+    if (before <= 0) return -1;
+
+    if (length < 3) {
+        for (int i = before - 1; i >= 0; i--) {
+            const char *text = history_entry(i);
+            if ((found = strstr(text, query)) != NULL) {
+                *offset = (size_t)(found - text);
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    if (!index_built) build_index();
+
+    // The query's trigram lists, rarest first; a trigram no entry has means no match
+    size_t list_count = 0;
+    Posting **lists = arena_alloc((length - 2) * sizeof(Posting *));
+    for (size_t i = 0; i + 3 <= length; i++) {
+        Posting *posting = find_posting(trigram_at(query + i));
+        if (posting == NULL) return -1;
+        lists[list_count++] = posting;
+    }
+    qsort(lists, list_count, sizeof(Posting *), by_count);
+
+    uint32_t first_live = next_serial - (uint32_t)history_count;
+    uint32_t candidate = first_live + (uint32_t)before - 1;
+
+    for (;;) {
+        // Lower the candidate until every list has it
+        size_t agreed = 0;
+        while (agreed < list_count) {
+            long position = last_at_most(lists[agreed], candidate);
+            if (position < 0 || lists[agreed]->serials[position] < first_live) return -1;
+
+            uint32_t serial = lists[agreed]->serials[position];
+            if (serial < candidate) {
+                candidate = serial;
+                agreed = agreed == 0 ? 1 : 0;
+            } else {
+                agreed++;
+            }
+        }
+
+        // Every trigram occurs in it, but maybe not in the right order
+        int index = (int)(candidate - first_live);
+        const char *text = history_entry(index);
+        if ((found = strstr(text, query)) != NULL) {
+            *offset = (size_t)(found - text);
+            return index;
+        }
+        if (candidate == first_live) return -1;
+        candidate--;
+    }
+}
@@ -0,0 +1,447 @@
+#include "cshell.h"
+
+// Structured history store
+//
+// ~/.cshell_history.db holds one record per history entry: a HistoryRecord
+// (when it was entered, its exit status and how long it ran) followed by the
+// command and the directory it ran in, each NUL-terminated, padded to 8
+// bytes. Records are only ever appended. ~/.cshell_history.idx holds the
+// offset of every record in order, 8 bytes each, so entry i is found
+// without reading any entry before it.
+//
+// Opening maps both files and reads nothing else, so it takes as long for a
+// million entries as for ten. The kernel pages entries in when they are
+// first looked at, and history_store_command() returns commands straight
+// from the mapping. The mappings reach past the end of their files, so most
+// appends need no new mapping.
+//
+// A record is appended before its command runs, and its exit status and
+// duration are filled in through the mapping once the command finishes.
+// Each file gets one O_APPEND write per entry, the record first, so shells
+// can share the store: an interrupted append leaves at worst a record that
+// no index entry points to. An import writes its records in batches the
+// same way. A new store starts out with the entries of the
+// plain-text ~/.cshell_history; a lost index is rebuilt by walking the
+// records.
+
+#ifndef _WIN32
+
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#define STORE_MAGIC "CSHIST01"          // The first 8 bytes of both files
+#define STORE_HEADER_SIZE 8
+#define STORE_ALIGN 8
+#define STORE_MAP_SLACK (1 << 20)       // Mapped beyond the end of a file
+#define STORE_PAGE_SIZE 4096
+#define STORE_BATCH_SIZE 65536          // Bytes of records an import writes at once
+
+typedef struct {
+    int fd;
+    char *map;
+    size_t mapped;
+    size_t size;                        // As far as this shell knows
+} StoreFile;
+
+static StoreFile store_data = {-1, NULL, 0, 0};
+static StoreFile store_index = {-1, NULL, 0, 0};
+static int store_count;
+static long pending_record = -1;        // Offset of the running command's record
+
+// Map the file's contents, with room to grow
+static int map_file(StoreFile *file) {
+    size_t length = (file->size + STORE_MAP_SLACK + STORE_PAGE_SIZE - 1) & ~(size_t)(STORE_PAGE_SIZE - 1);
+    char *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+    if (map == MAP_FAILED) return -1;
+
+    if (file->map != NULL) munmap(file->map, file->mapped);
+    file->map = map;
+    file->mapped = length;
+    return 0;
+}
+
+// Catch up with the file's size, mapping more of it if needed
+static int update_size(StoreFile *file) {
+    struct stat st;
+    if (fstat(file->fd, &st) != 0) return -1;
+
+    file->size = (size_t)st.st_size;
+    return file->size > file->mapped ? map_file(file) : 0;
+}
+
+static void close_file(StoreFile *file) {
+    if (file->map != NULL) munmap(file->map, file->mapped);
+    if (file->fd >= 0) close(file->fd);
+    file->fd = -1;
+    file->map = NULL;
+    file->mapped = 0;
+    file->size = 0;
+}
+
+// Open a store file, creating it if need be; *created says whether it was
+static int open_file(StoreFile *file, const char *path, int *created) {
+    file->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+    if (file->fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(file->fd, &st) != 0) return -1;
+    *created = st.st_size == 0;
+    if (*created && write(file->fd, STORE_MAGIC, STORE_HEADER_SIZE) != STORE_HEADER_SIZE) return -1;
+
+    if (update_size(file) != 0) return -1;
+    if (file->size < STORE_HEADER_SIZE || memcmp(file->map, STORE_MAGIC, STORE_HEADER_SIZE) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+// Empty a store file down to its magic
+static int reset_file(StoreFile *file) {
+    if (ftruncate(file->fd, 0) != 0) return -1;
+    if (write(file->fd, STORE_MAGIC, STORE_HEADER_SIZE) != STORE_HEADER_SIZE) return -1;
+    return update_size(file);
+}
+
+// Size of the whole record at offset in the data file, or 0 if the file
+// ends before it does
+static size_t whole_record_size(size_t offset) {
+    if (offset + sizeof(HistoryRecord) > store_data.size) return 0;
+
+    const HistoryRecord *record = (const HistoryRecord *)(store_data.map + offset);
+    size_t size = sizeof(*record) + (size_t)record->command_length + 1 + (size_t)record->cwd_length + 1;
+    size = (size + STORE_ALIGN - 1) & ~(size_t)(STORE_ALIGN - 1);
+    if (offset + size > store_data.size) return 0;
+
+    // A torn record may have its lengths but not its strings
+    const char *command = (const char *)(record + 1);
+    if (command[record->command_length] != '\0' || command[record->command_length + 1 + record->cwd_length] != '\0') return 0;
+    return size;
+}
+
+// Index the records of the data file in order, for an index that was lost.
+// The walk stops at the first record a crash cut short, and that tail is
+// cut off so records appended after it are aligned and found next time.
+static int rebuild_index(void) {
+    uint64_t offsets[STORE_BATCH_SIZE / sizeof(uint64_t)];
+    int count = 0, total = 0, done = 0;
+    size_t offset = STORE_HEADER_SIZE;
+
+    while (!done) {
+        size_t size = whole_record_size(offset);
+        if (size == 0) {
+            done = 1;
+        } else {
+            offsets[count++] = offset;
+            offset += size;
+        }
+
+        if (count > 0 && (done || count == (int)(sizeof(offsets) / sizeof(offsets[0])))) {
+            size_t length = (size_t)count * sizeof(uint64_t);
+            if (write(store_index.fd, offsets, length) != (ssize_t)length) {
+                // Left empty, the next shell rebuilds it instead of taking it as whole
+                int emptied = ftruncate(store_index.fd, 0) == 0;
+                if (debug_mode) {
+                    printf("Error: Could not rebuild the history index%s\n", emptied ? "; the next shell will try again" : "");
+                }
+                return -1;
+            }
+            total += count;
+            count = 0;
+        }
+    }
+
+    if (offset < store_data.size && ftruncate(store_data.fd, (off_t)offset) == 0) store_data.size = offset;
+
+    if (debug_mode) printf(COLOR_YELLOW "Debug: rebuilt the history index from %d records\n" COLOR_RESET, total);
+    return update_size(&store_index);
+}
+
+static int count_entries(void) {
+    return (int)((store_index.size - STORE_HEADER_SIZE) / sizeof(uint64_t));
+}
+
+// Records to be appended together, each at an offset within the batch
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+    uint64_t *offsets;
+    int count;
+    int offsets_capacity;
+} RecordBatch;
+
+static int batch_add(RecordBatch *batch, const char *command, const char *cwd, int64_t time) {
+    size_t command_length = strlen(command);
+    size_t cwd_length = strlen(cwd);
+    size_t size = sizeof(HistoryRecord) + command_length + 1 + cwd_length + 1;
+    size = (size + STORE_ALIGN - 1) & ~(size_t)(STORE_ALIGN - 1);
+
+    if (batch->size + size > batch->capacity) {
+        size_t capacity = batch->capacity ? batch->capacity * 2 : STORE_BATCH_SIZE;
+        while (capacity < batch->size + size) capacity *= 2;
+        char *data = realloc(batch->data, capacity);
+        if (data == NULL) return -1;
+        batch->data = data;
+        batch->capacity = capacity;
+    }
+    if (batch->count == batch->offsets_capacity) {
+        int capacity = batch->offsets_capacity ? batch->offsets_capacity * 2 : 64;
+        uint64_t *offsets = realloc(batch->offsets, capacity * sizeof(uint64_t));
+        if (offsets == NULL) return -1;
+        batch->offsets = offsets;
+        batch->offsets_capacity = capacity;
+    }
+
+    // A new record has not run yet: no duration or exit status
+    HistoryRecord record = {time, -1, -1, (uint32_t)command_length, (uint32_t)cwd_length, 0};
+    char *out = batch->data + batch->size;
+    memset(out, 0, size);
+    memcpy(out, &record, sizeof(record));
+    memcpy(out + sizeof(record), command, command_length);
+    memcpy(out + sizeof(record) + command_length + 1, cwd, cwd_length);
+
+    batch->offsets[batch->count++] = batch->size;
+    batch->size += size;
+    return 0;
+}
+
+// Append the batch's records and then their index entries, one write each.
+// Returns the offset of the first record, or -1.
+static long batch_flush(RecordBatch *batch) {
+    if (batch->count == 0) return -1;
+
+    if (write(store_data.fd, batch->data, batch->size) != (ssize_t)batch->size) return -1;
+
+    // O_APPEND left the file offset just past the records, wherever records
+    // from other shells put them
+    off_t end = lseek(store_data.fd, 0, SEEK_CUR);
+    if (end < 0) return -1;
+    uint64_t first = (uint64_t)end - batch->size;
+    for (int i = 0; i < batch->count; i++) batch->offsets[i] += first;
+
+    size_t index_size = (size_t)batch->count * sizeof(uint64_t);
+    if (write(store_index.fd, batch->offsets, index_size) != (ssize_t)index_size) return -1;
+    batch->size = 0;
+    batch->count = 0;
+
+    // Entries other shells added in the meantime come along too
+    if (update_size(&store_index) != 0 || update_size(&store_data) != 0) return -1;
+    store_count = count_entries();
+    return (long)first;
+}
+
+static void batch_free(RecordBatch *batch) {
+    free(batch->data);
+    free(batch->offsets);
+}
+
+// Open the store, importing the plain-text history into a new one. Returns
+// the number of entries, or -1 if there is no usable store.
+int history_store_open(void) {
+    char path[PATH_MAX];
+    int data_created, index_created;
+
+    const char *home_dir = getenv("HOME");
+    if (home_dir == NULL) return -1;
+
+    // Shells starting together set the files up one at a time
+    snprintf(path, sizeof(path), "%s/.cshell_history.db", home_dir);
+    int lock_fd = open(path, O_RDONLY | O_CREAT | O_CLOEXEC, 0666);
+    int failed = lock_fd < 0 || flock(lock_fd, LOCK_EX) != 0;
+
+    if (!failed) failed = open_file(&store_data, path, &data_created) != 0;
+    if (!failed) {
+        snprintf(path, sizeof(path), "%s/.cshell_history.idx", home_dir);
+        failed = open_file(&store_index, path, &index_created) != 0;
+    }
+
+    // One file new and the other not, after a crash or a file being
+    // deleted. A lost index is rebuilt from the records; without the
+    // records the index's offsets mean nothing, so both start over.
+    if (!failed && index_created && !data_created) {
+        failed = rebuild_index() != 0;
+        index_created = 0;
+    } else if (!failed && data_created && !index_created) {
+        if (debug_mode) printf(COLOR_YELLOW "Debug: history store records are gone, starting over\n" COLOR_RESET);
+        failed = reset_file(&store_index) != 0;
+        index_created = 1;
+    }
+
+    if (failed) {
+        if (debug_mode) printf("Error: Could not open history store %s: %s\n", path, strerror(errno));
+        close_file(&store_data);
+        close_file(&store_index);
+        if (lock_fd >= 0) close(lock_fd);
+        return -1;
+    }
+
+    // An index entry cut short by a crash would put every later one out of step
+    size_t torn = (store_index.size - STORE_HEADER_SIZE) % sizeof(uint64_t);
+    if (torn != 0 && ftruncate(store_index.fd, (off_t)(store_index.size - torn)) == 0) {
+        store_index.size -= torn;
+    }
+
+    store_count = count_entries();
+
+    // An import that failed part way is undone: this shell goes on with
+    // the plain-text history, and the next one finds empty files and tries
+    // again rather than taking the store as imported
+    if (index_created) {
+        snprintf(path, sizeof(path), "%s/.cshell_history", home_dir);
+        if (history_store_import(path) < 0 && access(path, F_OK) == 0) {
+            int emptied = ftruncate(store_index.fd, 0) == 0 && ftruncate(store_data.fd, 0) == 0;
+            if (debug_mode) {
+                printf("Error: Could not import %s into the history store%s\n", path,
+                       emptied ? "; the next shell will try again" : "");
+            }
+            close_file(&store_data);
+            close_file(&store_index);
+            store_count = 0;
+            close(lock_fd);
+            return -1;
+        }
+    }
+
+    close(lock_fd);
+    return store_count;
+}
+
+int history_store_active(void) {
+    return store_index.map != NULL;
+}
+
+int history_store_count(void) {
+    return store_count;
+}
+
+// The index-th record, or NULL if the files do not hold it whole
+const HistoryRecord *history_store_get(int index) {
+    if (index < 0 || index >= store_count) return NULL;
+
+    uint64_t offset;
+    memcpy(&offset, store_index.map + STORE_HEADER_SIZE + (size_t)index * sizeof(offset), sizeof(offset));
+    if (offset < STORE_HEADER_SIZE || offset % STORE_ALIGN != 0 || offset + sizeof(HistoryRecord) > store_data.size) return NULL;
+
+    const HistoryRecord *record = (const HistoryRecord *)(store_data.map + offset);
+    if (offset + sizeof(*record) + record->command_length + record->cwd_length + 2 > store_data.size) return NULL;
+    return record;
+}
+
+const char *history_record_command(const HistoryRecord *record) {
+    return (const char *)(record + 1);
+}
+
+const char *history_record_cwd(const HistoryRecord *record) {
+    return history_record_command(record) + record->command_length + 1;
+}
+
+// The index-th command; valid until the next entry is added
+const char *history_store_command(int index) {
+    const HistoryRecord *record = history_store_get(index);
+    return record != NULL ? history_record_command(record) : "";
+}
+
+// Record a command about to run; history_store_finish() completes it
+int history_store_append(const char *command) {
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) cwd[0] = '\0';
+
+    RecordBatch batch = {0};
+    pending_record = batch_add(&batch, command, cwd, (int64_t)time(NULL)) == 0 ? batch_flush(&batch) : -1;
+    batch_free(&batch);
+    return pending_record >= 0 ? 0 : -1;
+}
+
+// Fill in how the last appended command went
+void history_store_finish(int exit_status, int64_t duration_us) {
+    if (pending_record < 0) return;
+
+    if ((size_t)pending_record + sizeof(HistoryRecord) <= store_data.size) {
+        HistoryRecord *record = (HistoryRecord *)(store_data.map + pending_record);
+        record->exit_status = exit_status;
+        record->duration_us = duration_us;
+    }
+    pending_record = -1;
+}
+
+// Add the lines of a plain-text history file, with no time, status or
+// directory. Lines are unescaped as history.c escapes them. Returns how many were added, or -1 if it could not be read.
+int history_store_import(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return -1;
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    RecordBatch batch = {0};
+    int count = 0, failed = 0;
+    while (!failed && (length = getline(&line, &capacity, file)) >= 0) {
+        if (length > 0 && line[length - 1] == '\n') line[--length] = '\0';
+        if (length == 0) continue;
+        history_unescape(line);
+        if (batch_add(&batch, line, "", 0) != 0) {
+            failed = 1;
+            break;
+        }
+        count++;
+        if (batch.size >= STORE_BATCH_SIZE) failed = batch_flush(&batch) < 0;
+    }
+    if (!failed && batch.count > 0) failed = batch_flush(&batch) < 0;
+    if (failed) count = -1;
+
+    batch_free(&batch);
+    free(line);
+    fclose(file);
+    if (debug_mode) printf(COLOR_YELLOW "Debug: imported %d history entries from %s\n" COLOR_RESET, count, path);
+    return count;
+}
+
+#else
+
+int history_store_open(void) {
+    return -1;
+}
+
+int history_store_active(void) {
+    return 0;
+}
+
+int history_store_count(void) {
+    return 0;
+}
+
+const HistoryRecord *history_store_get(int index) {
+    (void)index;
+    return NULL;
+}
+
+const char *history_record_command(const HistoryRecord *record) {
+    return (const char *)(record + 1);
+}
+
+const char *history_record_cwd(const HistoryRecord *record) {
+    return history_record_command(record) + record->command_length + 1;
+}
+
+const char *history_store_command(int index) {
+    (void)index;
+    return "";
+}
+
+int history_store_append(const char *command) {
+    (void)command;
+    return -1;
+}
+
+void history_store_finish(int exit_status, int64_t duration_us) {
+    (void)exit_status;
+    (void)duration_us;
+}
+
+int history_store_import(const char *path) {
+    (void)path;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,532 @@
+#include "cshell.h"
+
+// Job control
+//
+// Every external command or pipeline runs in its own process group. In an
+// interactive session the foreground group gets the terminal while it runs,
+// so Ctrl-C and Ctrl-Z reach the job and not the shell. Commands ending in
+// '&' go straight into the job table and the prompt comes back at once.
+//
+// SIGCHLD only writes a byte to a self-pipe. Before each prompt the shell
+// drains the pipe and, only if something arrived, polls the pids in the job
+// table with WNOHANG. Foreground children are always waited for by pid, so
+// background reaping never steals their status.
+
+#ifndef _WIN32
+
+#define MAX_JOBS 32
+
+#define JOB_RUNNING 1
+#define JOB_STOPPED 2
+#define JOB_DONE 3
+
+#define PROC_RUNNING 1
+#define PROC_STOPPED 2
+#define PROC_EXITED 3
+
+typedef struct {
+    int id;                     // 0 = free slot
+    pid_t pgid;
+    pid_t pids[MAX_PIPELINE_STAGES];
+    int proc_state[MAX_PIPELINE_STAGES];
+    int nprocs;
+    int state;
+    int status;                 // Exit status of the last process
+    struct rusage usage;        // Summed over processes reaped in the foreground
+    char command[MAX_COMMAND_LENGTH];
+} Job;
+
+static Job jobs[MAX_JOBS];
+static int current_job_id = 0;  // The job '+' refers to
+static int sigchld_pipe[2] = {-1, -1};
+static int job_control = 0;
+static pid_t shell_pgid = 0;
+static char command_text[MAX_COMMAND_LENGTH];
+
+static void sigchld_handler(int signo) {
+    int saved_errno = errno;
+    ssize_t ignored = write(sigchld_pipe[1], "c", 1);
+    (void)ignored;
+    (void)signo;
+    errno = saved_errno;
+}
+
+// Install the SIGCHLD self-pipe and, on a terminal, take over job control
+void init_jobs(int interactive) {
+    if (pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK) == 0) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = sigchld_handler;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGCHLD, &sa, NULL);
+    }
+
+    if (!interactive || !isatty(STDIN_FILENO)) return;
+
+    // Put the shell in its own process group and make it the foreground one
+    shell_pgid = getpid();
+    if (getpgrp() != shell_pgid && setpgid(0, shell_pgid) != 0) return;
+
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    job_control = 1;
+}
+
+int job_control_enabled(void) {
+    return job_control;
+}
+
+// Remember the command line being run, for job listings
+void jobs_set_command_text(const char *line) {
+    snprintf(command_text, sizeof(command_text), "%s", line);
+    trim_whitespace(command_text);
+}
+
+static Job *find_job(int id) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id != 0 && jobs[i].id == id) return &jobs[i];
+    }
+    return NULL;
+}
+
+static Job *add_job(pid_t pgid, const pid_t *pids, int count, int state) {
+    int next_id = 1;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id >= next_id) next_id = jobs[i].id + 1;
+    }
+
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id != 0) continue;
+
+        Job *job = &jobs[i];
+        job->id = next_id;
+        job->pgid = pgid;
+        job->nprocs = count;
+        job->state = state;
+        job->status = 0;
+        for (int p = 0; p < count; p++) {
+            job->pids[p] = pids[p];
+            job->proc_state[p] = pids[p] > 0 ? (state == JOB_STOPPED ? PROC_STOPPED : PROC_RUNNING) : PROC_EXITED;
+        }
+        snprintf(job->command, sizeof(job->command), "%s", command_text);
+        current_job_id = job->id;
+        return job;
+    }
+
+    printf("Error: Too many jobs\n");
+    return NULL;
+}
+
+static void remove_job(Job *job) {
+    if (current_job_id == job->id) {
+        current_job_id = 0;
+        for (int i = 0; i < MAX_JOBS; i++) {
+            if (jobs[i].id != 0 && &jobs[i] != job && jobs[i].id > current_job_id) {
+                current_job_id = jobs[i].id;
+            }
+        }
+    }
+    job->id = 0;
+}
+
+// Apply a waitpid() result to the job owning pid
+static void update_process(Job *job, int p, int status) {
+    if (WIFSTOPPED(status)) {
+        job->proc_state[p] = PROC_STOPPED;
+    } else if (WIFCONTINUED(status)) {
+        job->proc_state[p] = PROC_RUNNING;
+    } else {
+        job->proc_state[p] = PROC_EXITED;
+        if (p == job->nprocs - 1) job->status = exit_status_from_wait(status);
+    }
+
+    int running = 0, stopped = 0;
+    for (int i = 0; i < job->nprocs; i++) {
+        if (job->proc_state[i] == PROC_RUNNING) running++;
+        if (job->proc_state[i] == PROC_STOPPED) stopped++;
+    }
+
+    if (running == 0 && stopped == 0) {
+        job->state = JOB_DONE;
+    } else if (running == 0) {
+        job->state = JOB_STOPPED;
+    } else {
+        job->state = JOB_RUNNING;
+    }
+}
+
+static const char *job_state_name(const Job *job) {
+    if (job->state == JOB_STOPPED) return "Stopped";
+    if (job->state == JOB_DONE) return job->status == 0 ? "Done" : "Exit";
+    return "Running";
+}
+
+static void print_job(const Job *job) {
+    char marker = job->id == current_job_id ? '+' : ' ';
+    if (job->state == JOB_DONE && job->status != 0) {
+        printf("[%d]%c  %s %d\t\t%s\n", job->id, marker, job_state_name(job), job->status, job->command);
+    } else {
+        printf("[%d]%c  %-8s\t\t%s\n", job->id, marker, job_state_name(job), job->command);
+    }
+}
+
+// Poll every job process without blocking
+static void poll_jobs(void) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        Job *job = &jobs[i];
+        if (job->id == 0) continue;
+
+        for (int p = 0; p < job->nprocs; p++) {
+            if (job->proc_state[p] == PROC_EXITED) continue;
+
+            int status;
+            pid_t pid = waitpid(job->pids[p], &status, WNOHANG | WUNTRACED | WCONTINUED);
+            if (pid == job->pids[p]) {
+                update_process(job, p, status);
+            }
+        }
+    }
+}
+
+// Reap finished background jobs and report them; called before a prompt
+void jobs_notify(void) {
+    if (sigchld_pipe[0] < 0) return;
+
+    // Nothing to do unless SIGCHLD fired since the last check
+    char drain[64];
+    int signalled = 0;
+    while (read(sigchld_pipe[0], drain, sizeof(drain)) > 0) signalled = 1;
+    if (!signalled) return;
+
+    poll_jobs();
+
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id != 0 && jobs[i].state == JOB_DONE) {
+            print_job(&jobs[i]);
+            remove_job(&jobs[i]);
+        }
+    }
+}
+
+// Give the terminal to a foreground process group (no-op without job control)
+void job_take_terminal(pid_t pgid) {
+    if (job_control && pgid > 0) tcsetpgrp(STDIN_FILENO, pgid);
+}
+
+// Start a background job: report it and return immediately
+void job_background(pid_t pgid, const pid_t *pids, int count) {
+    Job *job = add_job(pgid, pids, count, JOB_RUNNING);
+    if (job != NULL) {
+        printf("[%d] %d\n", job->id, (int)pids[count - 1]);
+    }
+    last_exit_status = 0;
+}
+
+// Hand the terminal to a foreground job and wait until it exits or stops.
+// Returns the status of the last process; a stopped job moves to the table.
+static int wait_job_foreground(Job *job) {
+    if (job_control) tcsetpgrp(STDIN_FILENO, job->pgid);
+
+    while (job->state == JOB_RUNNING) {
+        for (int p = 0; p < job->nprocs; p++) {
+            if (job->proc_state[p] != PROC_RUNNING) continue;
+
+            int status;
+            struct rusage usage;
+            pid_t pid = wait4(job->pids[p], &status, WUNTRACED, &usage);
+            if (pid > 0 && !WIFSTOPPED(status)) {
+                timeradd(&job->usage.ru_utime, &usage.ru_utime, &job->usage.ru_utime);
+                timeradd(&job->usage.ru_stime, &usage.ru_stime, &job->usage.ru_stime);
+                if (usage.ru_maxrss > job->usage.ru_maxrss) job->usage.ru_maxrss = usage.ru_maxrss;
+            }
+            if (pid < 0) {
+                if (errno == EINTR) {
+                    p--;
+                    continue;
+                }
+                job->proc_state[p] = PROC_EXITED;
+                update_process(job, p, 0);
+            } else {
+                update_process(job, p, status);
+            }
+        }
+    }
+
+    if (job_control) tcsetpgrp(STDIN_FILENO, shell_pgid);
+
+    if (job->state == JOB_STOPPED) {
+        printf("\n");
+        print_job(job);
+        return 128 + SIGTSTP;
+    }
+
+    return job->status;
+}
+
+// Wait for freshly launched foreground processes. Their resource usage is
+// stored in *usage when it is not NULL.
+int job_wait_foreground(pid_t pgid, const pid_t *pids, int count, struct rusage *usage) {
+    Job temp;
+
+    memset(&temp, 0, sizeof(temp));
+    temp.pgid = pgid;
+    temp.nprocs = count;
+    temp.state = JOB_RUNNING;
+    for (int p = 0; p < count; p++) {
+        temp.pids[p] = pids[p];
+        temp.proc_state[p] = pids[p] > 0 ? PROC_RUNNING : PROC_EXITED;
+    }
+    snprintf(temp.command, sizeof(temp.command), "%s", command_text);
+
+    // Processes that failed to start count as exited with status 127
+    if (pids[count - 1] <= 0) temp.status = 127;
+    int any_running = 0;
+    for (int p = 0; p < count; p++) {
+        if (pids[p] > 0) any_running = 1;
+    }
+    if (usage != NULL) memset(usage, 0, sizeof(*usage));
+    if (!any_running) return temp.status;
+
+    uint64_t trace = trace_start();
+    int status = wait_job_foreground(&temp);
+    trace_span("wait", trace, NULL);
+    if (usage != NULL) *usage = temp.usage;
+
+    // A stopped job lives on in the table
+    if (temp.state == JOB_STOPPED) {
+        Job *stored = add_job(pgid, pids, count, JOB_STOPPED);
+        if (stored != NULL) {
+            memcpy(stored->proc_state, temp.proc_state, sizeof(temp.proc_state));
+        }
+    }
+
+    return status;
+}
+
+// Parse a job spec (%n, %+, %%, or nothing for the current job)
+static Job *parse_job_spec(const char *spec, const char *command) {
+    int id = current_job_id;
+
+    if (spec != NULL) {
+        if (spec[0] == '%') spec++;
+        if (*spec != '\0' && strcmp(spec, "+") != 0 && strcmp(spec, "%") != 0) {
+            id = atoi(spec);
+        }
+    }
+
+    Job *job = id > 0 ? find_job(id) : NULL;
+    if (job == NULL) {
+        printf("%s: %s: no such job\n", command, spec ? spec : "current");
+    }
+    return job;
+}
+
+// Jobs command - List background and stopped jobs
+int cmd_jobs(char **args) {
+    if (args[1] != NULL && strcmp(args[1], "--help") == 0) {
+        printf("Usage: jobs\n");
+        printf("List background and stopped jobs.\n");
+        return 1;
+    }
+
+    poll_jobs();
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id == 0) continue;
+        print_job(&jobs[i]);
+        if (jobs[i].state == JOB_DONE) remove_job(&jobs[i]);
+    }
+
+    return 1;
+}
+
+// Fg command - Bring a job to the foreground
+int cmd_fg(char **args) {
+    if (args[1] != NULL && strcmp(args[1], "--help") == 0) {
+        printf("Usage: fg [%%job]\n");
+        printf("Continue a job in the foreground (default: the current job).\n");
+        return 1;
+    }
+
+    Job *job = parse_job_spec(args[1], "fg");
+    if (job == NULL) {
+        last_exit_status = 1;
+        return 1;
+    }
+
+    printf("%s\n", job->command);
+    fflush(stdout);
+
+    if (job->state == JOB_STOPPED) {
+        kill(-job->pgid, SIGCONT);
+        for (int p = 0; p < job->nprocs; p++) {
+            if (job->proc_state[p] == PROC_STOPPED) job->proc_state[p] = PROC_RUNNING;
+        }
+        job->state = JOB_RUNNING;
+    }
+
+    last_exit_status = wait_job_foreground(job);
+    if (job->state == JOB_DONE) remove_job(job);
+
+    return 1;
+}
+
+// Bg command - Continue a stopped job in the background
+int cmd_bg(char **args) {
+    if (args[1] != NULL && strcmp(args[1], "--help") == 0) {
+        printf("Usage: bg [%%job]\n");
+        printf("Continue a stopped job in the background (default: the current job).\n");
+        return 1;
+    }
+
+    Job *job = parse_job_spec(args[1], "bg");
+    if (job == NULL) {
+        last_exit_status = 1;
+        return 1;
+    }
+
+    if (job->state == JOB_STOPPED) {
+        kill(-job->pgid, SIGCONT);
+        for (int p = 0; p < job->nprocs; p++) {
+            if (job->proc_state[p] == PROC_STOPPED) job->proc_state[p] = PROC_RUNNING;
+        }
+        job->state = JOB_RUNNING;
+    }
+
+    printf("[%d]+ %s &\n", job->id, job->command);
+    return 1;
+}
+
+// Wait command - Wait for background jobs to finish
+int cmd_wait(char **args) {
+    if (args[1] != NULL && strcmp(args[1], "--help") == 0) {
+        printf("Usage: wait [%%job | pid]\n");
+        printf("Wait for a job (or all background jobs) to finish.\n");
+        return 1;
+    }
+
+    for (int i = 0; i < MAX_JOBS; i++) {
+        Job *job = &jobs[i];
+        if (job->id == 0) continue;
+
+        if (args[1] != NULL) {
+            int match = 0;
+            if (args[1][0] == '%') {
+                match = job->id == atoi(args[1] + 1);
+            } else {
+                for (int p = 0; p < job->nprocs; p++) {
+                    if (job->pids[p] == (pid_t)atoi(args[1])) match = 1;
+                }
+            }
+            if (!match) continue;
+        }
+
+        // Stopped jobs would never finish; leave them alone
+        for (int p = 0; p < job->nprocs && job->state == JOB_RUNNING; p++) {
+            if (job->proc_state[p] != PROC_RUNNING) continue;
+
+            int status;
+            pid_t pid = waitpid(job->pids[p], &status, WUNTRACED);
+            if (pid < 0 && errno == EINTR) {
+                p--;
+                continue;
+            }
+            update_process(job, p, pid < 0 ? 0 : status);
+        }
+
+        last_exit_status = job->status;
+        if (job->state == JOB_DONE) remove_job(job);
+    }
+
+    return 1;
+}
+
+// Kill command - Send a signal to a job or process
+int cmd_kill(char **args) {
+    if (args[1] == NULL || strcmp(args[1], "--help") == 0) {
+        printf("Usage: kill [-signal] %%job | pid ...\n");
+        printf("Send a signal (default TERM) to jobs or processes.\n");
+        printf("Signals can be given by number or name, e.g. -9, -KILL, -STOP.\n");
+        return 1;
+    }
+
+    static const struct { const char *name; int signo; } signal_names[] = {
+        {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+        {"TERM", SIGTERM}, {"STOP", SIGSTOP}, {"CONT", SIGCONT}, {"TSTP", SIGTSTP},
+        {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {NULL, 0}
+    };
+
+    int signo = SIGTERM;
+    int first = 1;
+
+    if (args[1][0] == '-') {
+        const char *name = args[1] + 1;
+        if (strncmp(name, "SIG", 3) == 0) name += 3;
+
+        signo = isdigit((unsigned char)name[0]) ? atoi(name) : 0;
+        for (int i = 0; signo == 0 && signal_names[i].name != NULL; i++) {
+            if (strcmp(name, signal_names[i].name) == 0) signo = signal_names[i].signo;
+        }
+        if (signo <= 0) {
+            printf("kill: %s: invalid signal\n", args[1]);
+            last_exit_status = 1;
+            return 1;
+        }
+        first = 2;
+    }
+
+    for (int i = first; args[i] != NULL; i++) {
+        pid_t target;
+        Job *job = NULL;
+
+        if (args[i][0] == '%') {
+            job = parse_job_spec(args[i], "kill");
+            if (job == NULL) {
+                last_exit_status = 1;
+                continue;
+            }
+            target = -job->pgid;
+        } else {
+            target = (pid_t)atoi(args[i]);
+            if (target <= 0) {
+                printf("kill: %s: invalid process id\n", args[i]);
+                last_exit_status = 1;
+                continue;
+            }
+        }
+
+        if (kill(target, signo) != 0) {
+            perror("kill");
+            last_exit_status = 1;
+        } else if (job != NULL && job->state == JOB_STOPPED && signo != SIGSTOP &&
+                   signo != SIGTSTP && signo != SIGCONT && signo != SIGKILL) {
+            // A stopped job has to run to act on the signal
+            kill(target, SIGCONT);
+        }
+    }
+
+    return 1;
+}
+
+#else
+
+void init_jobs(int interactive) { (void)interactive; }
+int job_control_enabled(void) { return 0; }
+void jobs_set_command_text(const char *line) { (void)line; }
+void jobs_notify(void) {}
+
+static int jobs_unsupported(char **args) {
+    printf("%s: job control is not supported on Windows\n", args[0]);
+    return 1;
+}
+
+int cmd_jobs(char **args) { return jobs_unsupported(args); }
+int cmd_fg(char **args) { return jobs_unsupported(args); }
+int cmd_bg(char **args) { return jobs_unsupported(args); }
+int cmd_wait(char **args) { return jobs_unsupported(args); }
+int cmd_kill(char **args) { return jobs_unsupported(args); }
+
+#endif
@@ -0,0 +1,82 @@
+#include "cshell.h"
+
+// External process launch
+//
+// Every external command goes through spawn_command(), which uses
+// posix_spawn() instead of fork()+exec(). glibc implements posix_spawn with
+// clone(CLONE_VM|CLONE_VFORK), so the shell's page tables (notes, todo and
+// reminder arrays, history, curl state) are never copied, and launch cost
+// stays flat as the shell's RSS grows.
+
+#ifndef _WIN32
+
+#include <spawn.h>
+
+extern char **environ;
+
+// Signals whose handlers or ignored state must not leak into children
+static const int child_default_signals[] = {
+    SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE
+};
+
+// Spawn path with args, installing the descriptors in opts as the child's
+// stdin/stdout/stderr. Returns the child pid, or -1 with errno set.
+pid_t spawn_command(const char *path, char **args, const SpawnOptions *opts) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t defaults, mask;
+    pid_t pid = -1;
+    int err;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    // Redirections: dup2 clears FD_CLOEXEC on the target, so the source
+    // descriptors can (and should) be opened close-on-exec by the caller
+    if (opts != NULL) {
+        int sources[3] = {opts->fd_in, opts->fd_out, opts->fd_err};
+        for (int target = 0; target < 3; target++) {
+            if (sources[target] >= 0 && sources[target] != target) {
+                posix_spawn_file_actions_adddup2(&actions, sources[target], target);
+            }
+        }
+    }
+
+    // Signal dispositions: restore defaults and start with nothing blocked
+    sigemptyset(&defaults);
+    for (size_t i = 0; i < sizeof(child_default_signals) / sizeof(child_default_signals[0]); i++) {
+        sigaddset(&defaults, child_default_signals[i]);
+    }
+    sigemptyset(&mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+
+    // Job control: a new process group, or the group of an earlier stage
+    if (opts != NULL && opts->pgid >= 0) {
+        posix_spawnattr_setpgroup(&attr, opts->pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+
+    posix_spawnattr_setflags(&attr, flags);
+
+    // Pending stdio output must reach the terminal before the child's
+    fflush(stdout);
+    fflush(stderr);
+
+    uint64_t trace = trace_start();
+    err = posix_spawn(&pid, path, &actions, &attr, args, environ);
+    trace_span("spawn", trace, args[0]);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    return pid;
+}
+
+#endif
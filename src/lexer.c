@@ -0,0 +1,561 @@
+#include "cshell.h"
+
+// Command line lexer
+//
+// lex_command() splits a line into Tokens in one pass. Each token is a
+// (pointer, length) span of the line itself plus a kind: a word, one of
+// the operators | & < > >> 2> 2>> 2>&1, or a separator (';' or a newline)
+// between commands. A '#' at the start of a word comments out the rest of
+// the line, and a backslash-newline joins two lines. Words may contain
+// 'single quotes', "double quotes", backslash escapes, $ expansions and
+// glob patterns; quoted operator characters are part of the word, and so
+// is everything in $(...). Nothing is copied, and there is no limit on the
+// number of tokens: the token array lives in the per-command arena.
+//
+// Turning tokens into the argv the rest of the shell uses takes two steps.
+// prepare_tokens() does everything that gives the same result every time:
+// plain words are terminated in place, and quoted words are unquoted in
+// place, which never makes them longer. expand_tokens() then builds an argv;
+// only words with $ or a pattern still need work there, through
+// expand_word() (expand.c) and glob_expand() (glob.c), which may turn them
+// into several arguments. The script compiler (vm.c) prepares a command once
+// and expands it every time it runs; tokenize_command() does both at once.
+// Operators become shared static strings, so token_operator() can tell a
+// real `|` from a quoted "|" by pointer.
+//
+// Most of the time goes into scanning words and quoted strings for the next
+// character that ends them. On x86 that scan compares 16 (SSE2) or 32 (AVX2)
+// bytes at a time, chosen once by CPU feature; elsewhere it uses a byte
+// class table.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LEXER_X86 1
+#include <immintrin.h>
+#endif
+
+// Byte classes for the scalar scan
+#define CLASS_WORD_END 1        // Ends or interrupts an unquoted word
+#define CLASS_DQUOTE_END 2      // Ends or interrupts a double-quoted string
+
+static const unsigned char char_class[256] = {
+    [' '] = CLASS_WORD_END,
+    ['\t'] = CLASS_WORD_END,
+    ['\n'] = CLASS_WORD_END,
+    ['|'] = CLASS_WORD_END,
+    ['&'] = CLASS_WORD_END,
+    ['<'] = CLASS_WORD_END,
+    ['>'] = CLASS_WORD_END,
+    [';'] = CLASS_WORD_END,
+    ['\''] = CLASS_WORD_END,
+    ['"'] = CLASS_WORD_END | CLASS_DQUOTE_END,
+    ['\\'] = CLASS_WORD_END | CLASS_DQUOTE_END,
+    ['$'] = CLASS_WORD_END | CLASS_DQUOTE_END,
+    ['*'] = CLASS_WORD_END,
+    ['?'] = CLASS_WORD_END,
+    ['['] = CLASS_WORD_END,
+};
+
+// Shared operator strings, indexed by TokenKind
+static char *operator_text[] = {
+    [TOKEN_PIPE] = "|",
+    [TOKEN_BACKGROUND] = "&",
+    [TOKEN_REDIRECT_IN] = "<",
+    [TOKEN_REDIRECT_OUT] = ">",
+    [TOKEN_REDIRECT_APPEND] = ">>",
+    [TOKEN_REDIRECT_ERR] = "2>",
+    [TOKEN_REDIRECT_ERR_APPEND] = "2>>",
+    [TOKEN_REDIRECT_ERR_OUT] = "2>&1",
+    [TOKEN_SEPARATOR] = ";",
+};
+
+#define TOKEN_KIND_COUNT ((int)(sizeof(operator_text) / sizeof(operator_text[0])))
+
+typedef size_t (*ScanFunc)(const char *p, size_t n);
+
+// Length of the run before the first byte of the given class
+static size_t scan_class_scalar(const char *p, size_t n, unsigned char class) {
+    size_t i = 0;
+    while (i < n && !(char_class[(unsigned char)p[i]] & class)) i++;
+    return i;
+}
+
+static size_t scan_word_scalar(const char *p, size_t n) {
+    return scan_class_scalar(p, n, CLASS_WORD_END);
+}
+
+static size_t scan_dquote_scalar(const char *p, size_t n) {
+    return scan_class_scalar(p, n, CLASS_DQUOTE_END);
+}
+
+#ifdef LEXER_X86
+
+__attribute__((target("sse2")))
+static inline __m128i word_end_mask_sse2(__m128i v) {
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('$')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('*')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('?')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('[')));
+    return _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+}
+
+__attribute__((target("sse2")))
+static size_t scan_word_sse2(const char *p, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        int mask = _mm_movemask_epi8(word_end_mask_sse2(_mm_loadu_si128((const __m128i *)(p + i))));
+        if (mask != 0) return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+    return i + scan_word_scalar(p + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static size_t scan_dquote_sse2(const char *p, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('$')));
+        int mask = _mm_movemask_epi8(m);
+        if (mask != 0) return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+    return i + scan_dquote_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i word_end_mask_avx2(__m256i v) {
+    __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('$')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('?')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')));
+    return _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+}
+
+__attribute__((target("avx2")))
+static size_t scan_word_avx2(const char *p, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        unsigned mask = (unsigned)_mm256_movemask_epi8(word_end_mask_avx2(_mm256_loadu_si256((const __m256i *)(p + i))));
+        if (mask != 0) return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + scan_word_sse2(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_dquote_avx2(const char *p, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('$')));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if (mask != 0) return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + scan_dquote_sse2(p + i, n - i);
+}
+
+#endif
+
+static ScanFunc scan_word = scan_word_scalar;
+static ScanFunc scan_dquote = scan_dquote_scalar;
+static const char *scan_impl = "scalar";
+static pthread_once_t scan_once = PTHREAD_ONCE_INIT;
+
+static int use_scan(const char *name) {
+    if (strcmp(name, "scalar") == 0) {
+        scan_word = scan_word_scalar;
+        scan_dquote = scan_dquote_scalar;
+        scan_impl = "scalar";
+        return 0;
+    }
+#ifdef LEXER_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        scan_word = scan_word_sse2;
+        scan_dquote = scan_dquote_sse2;
+        scan_impl = "sse2";
+        return 0;
+    }
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        scan_word = scan_word_avx2;
+        scan_dquote = scan_dquote_avx2;
+        scan_impl = "avx2";
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+static void select_best_scan(void) {
+    if (use_scan("avx2") != 0 && use_scan("sse2") != 0) use_scan("scalar");
+}
+
+// Pick the scan implementation ("scalar", "sse2", "avx2" or "auto").
+// Returns the name of the one in use, or NULL if the CPU lacks it.
+const char *lexer_select(const char *name) {
+    pthread_once(&scan_once, select_best_scan);
+
+    if (strcmp(name, "auto") == 0) select_best_scan();
+    else if (use_scan(name) != 0) return NULL;
+    return scan_impl;
+}
+
+// Match an unquoted operator at p; returns its length or 0
+static size_t match_operator(const char *p, const char *end, TokenKind *kind) {
+    size_t left = (size_t)(end - p);
+
+    switch (*p) {
+    case '|':
+        *kind = TOKEN_PIPE;
+        return 1;
+    case '&':
+        *kind = TOKEN_BACKGROUND;
+        return 1;
+    case '<':
+        *kind = TOKEN_REDIRECT_IN;
+        return 1;
+    case ';':
+    case '\n':
+        *kind = TOKEN_SEPARATOR;
+        return 1;
+    case '>':
+        if (left >= 2 && p[1] == '>') {
+            *kind = TOKEN_REDIRECT_APPEND;
+            return 2;
+        }
+        *kind = TOKEN_REDIRECT_OUT;
+        return 1;
+    case '2':
+        // Only at the start of a word: "a2>b" is the word a2 and >
+        if (left < 2 || p[1] != '>') return 0;
+        if (left >= 3 && p[2] == '>') {
+            *kind = TOKEN_REDIRECT_ERR_APPEND;
+            return 3;
+        }
+        if (left >= 4 && p[2] == '&' && p[3] == '1') {
+            *kind = TOKEN_REDIRECT_ERR_OUT;
+            return 4;
+        }
+        *kind = TOKEN_REDIRECT_ERR;
+        return 2;
+    }
+    return 0;
+}
+
+// Blanks between tokens; a newline there is a separator instead
+static const char *skip_blanks(const char *p, const char *end) {
+    for (;;) {
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (p + 1 < end && p[0] == '\\' && p[1] == '\n') {
+            p += 2;
+        } else if (p < end && *p == '#') {
+            while (p < end && *p != '\n') p++;
+        } else {
+            return p;
+        }
+    }
+}
+
+// End of the $(...) starting at p (which points at '$'), or NULL if it is
+// not closed. Quotes and nested substitutions inside are skipped whole.
+const char *skip_substitution(const char *p, const char *end) {
+    int depth = 1;
+
+    for (p += 2; p < end; p++) {
+        if (*p == '\\') {
+            p++;
+        } else if (*p == '\'') {
+            p = memchr(p + 1, '\'', (size_t)(end - p - 1));
+            if (p == NULL) return NULL;
+        } else if (*p == '"') {
+            for (p++; p < end && *p != '"'; p++) {
+                if (*p == '\\') {
+                    p++;
+                } else if (*p == '$' && p + 1 < end && p[1] == '(') {
+                    p = skip_substitution(p, end);
+                    if (p == NULL) return NULL;
+                    p--;
+                }
+            }
+            if (p >= end) return NULL;
+        } else if (*p == '$' && p + 1 < end && p[1] == '(') {
+            p = skip_substitution(p, end);
+            if (p == NULL) return NULL;
+            p--;
+        } else if (*p == '(') {
+            depth++;
+        } else if (*p == ')' && --depth == 0) {
+            return p + 1;
+        }
+    }
+
+    return NULL;
+}
+
+// Step over a $ in a word: a whole $(...), or just the '$' (a variable name
+// after it needs no special treatment). NULL if a $( is not closed.
+static const char *skip_dollar(const char *p, const char *end) {
+    if (p + 1 < end && p[1] == '(') return skip_substitution(p, end);
+    return p + 1;
+}
+
+// Split line into tokens, stored in the per-command arena. Returns the
+// token count, or -1 with *error set for an unterminated quote or $(.
+// That is left to the caller to report: for a script still being read, the
+// rest of the quote may be on the next line.
+int lex_command(const char *line, size_t length, Token **tokens_out, const char **error) {
+    pthread_once(&scan_once, select_best_scan);
+
+    const char *p = line;
+    const char *end = line + length;
+    size_t capacity = 16;
+    Token *tokens = arena_alloc(capacity * sizeof(Token));
+    int count = 0;
+
+    for (;;) {
+        p = skip_blanks(p, end);
+        if (p == end) break;
+
+        if ((size_t)count == capacity) {
+            tokens = arena_grow(tokens, capacity * sizeof(Token), capacity * 2 * sizeof(Token));
+            capacity *= 2;
+        }
+        Token *token = &tokens[count++];
+
+        size_t op_len = match_operator(p, end, &token->kind);
+        if (op_len > 0) {
+            token->start = p;
+            token->length = op_len;
+            token->flags = 0;
+            p += op_len;
+            continue;
+        }
+
+        // A word runs until an unquoted blank or operator character
+        token->start = p;
+        token->kind = TOKEN_WORD;
+        token->flags = 0;
+
+        for (;;) {
+            p += scan_word(p, (size_t)(end - p));
+            if (p == end) break;
+
+            if (*p == '\'') {
+                const char *close = memchr(p + 1, '\'', (size_t)(end - p - 1));
+                if (close == NULL) {
+                    *error = "unterminated quote";
+                    return -1;
+                }
+                token->flags |= TOKEN_QUOTED;
+                p = close + 1;
+            } else if (*p == '"') {
+                token->flags |= TOKEN_QUOTED;
+                p++;
+                for (;;) {
+                    p += scan_dquote(p, (size_t)(end - p));
+                    if (p == end) {
+                        *error = "unterminated quote";
+                        return -1;
+                    }
+                    if (*p == '"') break;
+                    if (*p == '$') {
+                        token->flags |= TOKEN_EXPAND;
+                        if ((p = skip_dollar(p, end)) == NULL) {
+                            *error = "unterminated $(";
+                            return -1;
+                        }
+                        continue;
+                    }
+                    token->flags |= TOKEN_ESCAPED;
+                    p += p + 1 < end ? 2 : 1;
+                }
+                p++;
+            } else if (*p == '\\') {
+                token->flags |= TOKEN_ESCAPED;
+                p += p + 1 < end ? 2 : 1;
+            } else if (*p == '$') {
+                token->flags |= TOKEN_EXPAND;
+                if ((p = skip_dollar(p, end)) == NULL) {
+                    *error = "unterminated $(";
+                    return -1;
+                }
+            } else if (*p == '*' || *p == '?' || *p == '[') {
+                token->flags |= TOKEN_GLOB;
+                p++;
+            } else {
+                break;
+            }
+        }
+
+        token->length = (size_t)(p - token->start);
+    }
+
+    *tokens_out = tokens;
+    return count;
+}
+
+// Remove quotes and escapes from a word in place and terminate it
+static void unquote_word(char *word, size_t length) {
+    const char *src = word;
+    const char *end = word + length;
+    char *dst = word;
+
+    while (src < end) {
+        if (*src == '\'') {
+            for (src++; *src != '\''; src++) *dst++ = *src;
+            src++;
+        } else if (*src == '"') {
+            for (src++; *src != '"'; src++) {
+                // Inside double quotes only \" \\ \$ \` and \newline escape
+                if (*src == '\\' && strchr("\"\\$`\n", src[1]) != NULL) {
+                    src++;
+                    if (*src == '\n') continue;
+                }
+                *dst++ = *src;
+            }
+            src++;
+        } else if (*src == '\\' && src + 1 < end) {
+            src++;
+            if (*src != '\n') *dst++ = *src;
+            src++;
+        } else {
+            *dst++ = *src++;
+        }
+    }
+
+    *dst = '\0';
+}
+
+// Which operator an argument is, or TOKEN_WORD for an ordinary word
+TokenKind token_operator(const char *arg) {
+    for (int kind = TOKEN_WORD + 1; kind < TOKEN_KIND_COUNT; kind++) {
+        if (arg == operator_text[kind]) return (TokenKind)kind;
+    }
+    return TOKEN_WORD;
+}
+
+void arg_list_push(ArgList *list, char *arg) {
+    if (list->count + 1 >= list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 16;
+        list->args = arena_grow(list->args, (size_t)list->capacity * sizeof(char *), (size_t)capacity * sizeof(char *));
+        list->capacity = capacity;
+    }
+    list->args[list->count++] = arg;
+    list->args[list->count] = NULL;
+}
+
+// Whether an unquoted word really is a pattern: a '[' without a ']' after
+// it matches only itself, which makes the `[` command a plain word
+static int has_pattern(const char *word, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (word[i] == '*' || word[i] == '?') return 1;
+        if (word[i] == '[' && memchr(word + i + 1, ']', length - i - 1) != NULL) return 1;
+    }
+    return 0;
+}
+
+// Do the part of turning tokens into arguments that never changes: words
+// without $ or a pattern get their final text, in place. Leading NAME=value
+// words (when assignments is set) are marked TOKEN_ASSIGN. Afterwards a
+// word's flags are 0 for final text, TOKEN_GLOB for a terminated pattern,
+// or anything else for raw text that expand_tokens() expands each time.
+void prepare_tokens(Token *tokens, int count, int assignments) {
+    int leading = assignments;
+
+    for (int i = 0; i < count; i++) {
+        Token *token = &tokens[i];
+        char *word = (char *)token->start;
+
+        if (token->kind != TOKEN_WORD) {
+            leading = 0;
+            continue;
+        }
+        leading = leading && assignment_name_length(word, token->length) > 0;
+
+        // Assignments are neither split nor globbed
+        int flags = token->flags;
+        if (flags == TOKEN_GLOB && !has_pattern(word, token->length)) flags = 0;
+        if ((flags & TOKEN_EXPAND) || ((flags & TOKEN_GLOB) && !leading && flags != TOKEN_GLOB)) {
+            if (leading) token->flags |= TOKEN_ASSIGN;
+            continue;
+        }
+
+        if (flags & (TOKEN_QUOTED | TOKEN_ESCAPED)) {
+            unquote_word(word, token->length);
+        } else {
+            // The byte after a word is a blank, an operator already recorded,
+            // or the end of the line
+            word[token->length] = '\0';
+        }
+        token->flags = flags == TOKEN_GLOB && !leading ? TOKEN_GLOB : 0;
+        if (leading) token->flags |= TOKEN_ASSIGN;
+    }
+}
+
+// Append the arguments of prepared tokens to out
+void expand_tokens(const Token *tokens, int count, ArgList *out) {
+    for (int i = 0; i < count; i++) {
+        const Token *token = &tokens[i];
+        char *word = (char *)token->start;
+        int flags = token->flags & ~TOKEN_ASSIGN;
+
+        if (token->kind != TOKEN_WORD) {
+            arg_list_push(out, operator_text[token->kind]);
+        } else if (flags == 0) {
+            arg_list_push(out, word);
+        } else if (flags == TOKEN_GLOB) {
+            if (glob_expand(word, out) == 0) arg_list_push(out, word);
+        } else {
+            int assign = (token->flags & TOKEN_ASSIGN) != 0;
+            expand_word(word, token->length, !assign, (flags & TOKEN_GLOB) && !assign, out);
+        }
+    }
+}
+
+// An empty argv that arg_list_push() can extend
+void arg_list_init(ArgList *list) {
+    list->args = NULL;
+    list->count = 0;
+    list->capacity = 0;
+    arg_list_push(list, NULL);
+    list->count = 0;
+}
+
+// Split a command line in place into a NULL-terminated argv, allocated from
+// the per-command arena. Returns the argument count, or -1 on a syntax error.
+int tokenize_command(char *line, char ***args_out) {
+    Token *tokens;
+    const char *error;
+    int count = lex_command(line, strlen(line), &tokens, &error);
+    if (count < 0) {
+        printf("Error: %s\n", error);
+        return -1;
+    }
+
+    prepare_tokens(tokens, count, 1);
+
+    // Even an empty line gets a NULL-terminated argv
+    ArgList list;
+    arg_list_init(&list);
+    expand_tokens(tokens, count, &list);
+
+    *args_out = list.args;
+    return list.count;
+}
@@ -0,0 +1,237 @@
+#include "cshell.h"
+
+// Compiled line cache
+//
+// Interactive sessions and piped scripts repeat the same few lines, and a
+// loop body's $(...) is the same text every time round. The programs
+// compile_program() builds for them are kept in a small LRU cache keyed by
+// a wyhash of the raw text, so a repeated line skips lexing, parsing and
+// word preparation and goes straight to the VM. Programs never change once
+// compiled, so a cached one can run any number of times - even while it is
+// already running, since every user holds its own reference.
+//
+// A program's bindings depend on which functions existed when it was
+// compiled (a function shadows a builtin of the same name), so an entry
+// compiled before the last function definition is compiled afresh.
+// Debug mode reports hits and misses.
+
+#define LINE_CACHE_SIZE 64
+#define LINE_CACHE_BUCKETS 128          // A power of two
+#define LINE_CACHE_MAX_LENGTH 4096      // Longer text (a whole script) is not kept
+
+typedef struct LineEntry {
+    uint64_t hash;
+    char *line;
+    size_t length;
+    unsigned generation;                // function_generation() when compiled
+    Program *program;
+    struct LineEntry *next;             // In its bucket
+    struct LineEntry *newer;
+    struct LineEntry *older;
+} LineEntry;
+
+static LineEntry line_entries[LINE_CACHE_SIZE];
+static LineEntry *free_entries;
+static int line_cache_ready;
+static LineEntry *line_buckets[LINE_CACHE_BUCKETS];
+static LineEntry *newest;
+static LineEntry *oldest;
+static unsigned long line_cache_hits;
+static unsigned long line_cache_misses;
+
+// wyhash (final version 4), by Wang Yi, released into the public domain
+
+static const uint64_t wyhash_secret[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
+};
+
+static void wymum(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static uint64_t wymix(uint64_t a, uint64_t b) {
+    wymum(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t wyr8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static uint64_t wyr4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t wyr3(const uint8_t *p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+static uint64_t wyhash(const void *key, size_t len, uint64_t seed) {
+    const uint64_t *secret = wyhash_secret;
+    const uint8_t *p = key;
+    uint64_t a, b;
+
+    seed ^= wymix(seed ^ secret[0], secret[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wyr3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i >= 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ secret[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ secret[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    wymum(&a, &b);
+    return wymix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+static void init_line_cache(void) {
+    for (int i = LINE_CACHE_SIZE - 1; i >= 0; i--) {
+        line_entries[i].next = free_entries;
+        free_entries = &line_entries[i];
+    }
+    line_cache_ready = 1;
+}
+
+static void unlink_lru(LineEntry *entry) {
+    if (entry->newer != NULL) entry->newer->older = entry->older;
+    else newest = entry->older;
+    if (entry->older != NULL) entry->older->newer = entry->newer;
+    else oldest = entry->newer;
+}
+
+static void link_newest(LineEntry *entry) {
+    entry->newer = NULL;
+    entry->older = newest;
+    if (newest != NULL) newest->newer = entry;
+    newest = entry;
+    if (oldest == NULL) oldest = entry;
+}
+
+static void remove_entry(LineEntry *entry) {
+    LineEntry **link = &line_buckets[entry->hash & (LINE_CACHE_BUCKETS - 1)];
+    while (*link != entry) link = &(*link)->next;
+    *link = entry->next;
+
+    unlink_lru(entry);
+    free_program(entry->program);
+    free(entry->line);
+
+    entry->next = free_entries;
+    free_entries = entry;
+}
+
+static void report(const char *result) {
+    if (debug_mode) {
+        printf(COLOR_YELLOW "Debug: line cache %s (%lu hits, %lu misses)\n" COLOR_RESET,
+               result, line_cache_hits, line_cache_misses);
+    }
+}
+
+// The cached program for this text, with a reference for the caller, or
+// NULL (text too long to cache is not counted as a miss)
+Program *line_cache_lookup(const char *line, size_t length) {
+    if (length > LINE_CACHE_MAX_LENGTH) return NULL;
+
+    uint64_t hash = wyhash(line, length, 0);
+    LineEntry *entry = line_buckets[hash & (LINE_CACHE_BUCKETS - 1)];
+    while (entry != NULL && !(entry->hash == hash && entry->length == length && memcmp(entry->line, line, length) == 0)) {
+        entry = entry->next;
+    }
+
+    if (entry != NULL && entry->generation != function_generation()) {
+        remove_entry(entry);
+        entry = NULL;
+    }
+
+    if (entry == NULL) {
+        line_cache_misses++;
+        report("miss");
+        return NULL;
+    }
+
+    line_cache_hits++;
+    unlink_lru(entry);
+    link_newest(entry);
+    report("hit");
+    return retain_program(entry->program);
+}
+
+// Keep a compiled program for its text; the cache takes its own reference
+void line_cache_insert(const char *line, size_t length, Program *program) {
+    if (length > LINE_CACHE_MAX_LENGTH) return;
+    if (!line_cache_ready) init_line_cache();
+
+    char *copy = malloc(length + 1);
+    if (copy == NULL) return;
+    memcpy(copy, line, length);
+    copy[length] = '\0';
+
+    if (free_entries == NULL) remove_entry(oldest);
+    LineEntry *entry = free_entries;
+    free_entries = entry->next;
+
+    entry->hash = wyhash(line, length, 0);
+    entry->line = copy;
+    entry->length = length;
+    entry->generation = function_generation();
+    entry->program = retain_program(program);
+
+    LineEntry **bucket = &line_buckets[entry->hash & (LINE_CACHE_BUCKETS - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    link_newest(entry);
+}
+
+// Compile a line, or reuse its cached program. Returns NULL after
+// reporting an error; otherwise the caller frees the program after running it.
+Program *compile_line(const char *line, size_t length) {
+    Program *program = line_cache_lookup(line, length);
+    if (program != NULL) return program;
+
+    program = compile_program(line, length, NULL);
+    if (program != NULL) line_cache_insert(line, length, program);
+    return program;
+}
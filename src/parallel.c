@@ -0,0 +1,550 @@
+#include "cshell.h"
+
+// Parallel command execution
+//
+// parallel runs one command per input argument on a fixed pool of worker
+// threads. Tasks are dealt round-robin onto per-worker deques; a worker pops
+// from the back of its own deque and, once that is empty, steals from the
+// front of another worker's, so a few slow tasks never leave the rest of the
+// pool idle. No tasks are added after the start, so a worker that finds
+// every deque empty is done.
+//
+// Builtins marked BUILTIN_THREADS run directly on the worker thread, with
+// their output and error messages going to the task's buffer and their exit
+// status in the thread's own last_exit_status. Everything else runs as a
+// child process whose stdout and stderr are captured through a pipe. Workers
+// never fork: external commands are started with posix_spawn(), and other
+// builtins in a new shell (cshell -c) started the same way. Each task's
+// output is printed in one piece, so output from different tasks never
+// interleaves.
+
+#ifndef _WIN32
+
+#define MAX_PARALLEL_WORKERS 64
+
+typedef struct {
+    char **argv;
+    char *arg;
+    ShellStream output;
+    int status;
+    double elapsed_ms;
+    int state;              // 0 = pending, 1 = finished, 2 = printed
+} ParallelTask;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int *items;
+    int head;               // items[head..tail) are still pending
+    int tail;
+} TaskDeque;
+
+typedef struct {
+    ParallelTask *tasks;
+    int task_count;
+    TaskDeque *deques;
+    int worker_count;
+    int null_fd;
+    char shell_path[PATH_MAX];  // This shell's executable, for builtins
+    int *finished;          // Task indices in completion order
+    int finished_count;
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_cond;
+} ParallelRun;
+
+typedef struct {
+    ParallelRun *run;
+    int id;
+    pthread_t thread;
+    int started;
+} ParallelWorker;
+
+static double elapsed_ms_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Owner end: newest task first
+static int deque_pop(TaskDeque *deque) {
+    int task = -1;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail > deque->head) task = deque->items[--deque->tail];
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+// Thief end: oldest task first
+static int deque_steal(TaskDeque *deque) {
+    int task = -1;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail > deque->head) task = deque->items[deque->head++];
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+// The arguments as one command line for cshell -c, each single-quoted
+static char *quote_command(char **argv) {
+    size_t length = 1;
+    for (int i = 0; argv[i] != NULL; i++) length += strlen(argv[i]) * 4 + 3;
+
+    char *line = malloc(length);
+    if (line == NULL) return NULL;
+
+    char *out = line;
+    for (int i = 0; argv[i] != NULL; i++) {
+        if (i > 0) *out++ = ' ';
+        *out++ = '\'';
+        for (const char *p = argv[i]; *p != '\0'; p++) {
+            // A quote ends the quoted part, is escaped, and starts a new one
+            if (*p == '\'') {
+                memcpy(out, "'\\''", 4);
+                out += 4;
+            } else {
+                *out++ = *p;
+            }
+        }
+        *out++ = '\'';
+    }
+    *out = '\0';
+    return line;
+}
+
+// Run a task as a child process with its stdout and stderr captured in its
+// output; returns its exit status
+static int spawn_task(ParallelRun *run, ParallelTask *task, int builtin) {
+    char path[PATH_MAX];
+    char *shell_argv[4] = {"cshell", "-c", NULL, NULL};
+    char **argv = task->argv;
+
+    if (builtin) {
+        shell_argv[2] = quote_command(task->argv);
+        if (run->shell_path[0] == '\0' || shell_argv[2] == NULL) {
+            stream_printf(&task->output, "%s: cannot start a shell to run it\n", task->argv[0]);
+            free(shell_argv[2]);
+            return 127;
+        }
+        snprintf(path, sizeof(path), "%s", run->shell_path);
+        argv = shell_argv;
+    } else if (!path_cache_lookup(task->argv[0], path, sizeof(path))) {
+        stream_printf(&task->output, "%s: command not found\n", task->argv[0]);
+        return 127;
+    }
+
+    int fds[2];
+    pid_t pid = -1;
+
+    if (pipe2(fds, O_CLOEXEC) == 0) {
+        SpawnOptions io = {run->null_fd, fds[1], fds[1], -1};
+        pid = spawn_command(path, argv, &io);
+        if (pid < 0) {
+            stream_printf(&task->output, "%s: %s\n", task->argv[0], strerror(errno));
+            if (!builtin) path_cache_forget(task->argv[0]);
+        }
+        close(fds[1]);
+
+        ShellStream pipe_in;
+        stream_init_fd(&pipe_in, fds[0]);
+        if (pid > 0) stream_forward(&pipe_in, &task->output);
+        stream_free(&pipe_in);
+        close(fds[0]);
+    } else {
+        stream_printf(&task->output, "pipe: %s\n", strerror(errno));
+    }
+    free(shell_argv[2]);
+
+    int status = 0;
+    if (pid <= 0) return 127;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return 127;
+    }
+    return exit_status_from_wait(status);
+}
+
+static void run_task(ParallelRun *run, ParallelTask *task) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    stream_init_buffer(&task->output);
+
+    BuiltinCommand *builtin = task->argv != NULL ? find_builtin(task->argv[0]) : NULL;
+    if (task->argv == NULL) {
+        task->status = 1;
+    } else if (builtin != NULL && (builtin->flags & BUILTIN_THREADS)) {
+        // In-process: empty input, output and errors straight into the
+        // task's buffer
+        ShellStream input;
+        stream_init_buffer(&input);
+        shell_in = &input;
+        shell_out = &task->output;
+        shell_err = &task->output;
+        last_exit_status = 0;
+        builtin->func(task->argv);
+        task->status = last_exit_status;
+        shell_in = NULL;
+        shell_out = NULL;
+        shell_err = NULL;
+    } else {
+        task->status = spawn_task(run, task, builtin != NULL);
+    }
+
+    task->elapsed_ms = elapsed_ms_since(&start);
+
+    pthread_mutex_lock(&run->done_lock);
+    task->state = 1;
+    run->finished[run->finished_count++] = (int)(task - run->tasks);
+    pthread_cond_broadcast(&run->done_cond);
+    pthread_mutex_unlock(&run->done_lock);
+}
+
+static void *parallel_worker(void *arg) {
+    ParallelWorker *worker = arg;
+    ParallelRun *run = worker->run;
+
+    for (;;) {
+        int task = deque_pop(&run->deques[worker->id]);
+
+        for (int k = 1; task < 0 && k < run->worker_count; k++) {
+            task = deque_steal(&run->deques[(worker->id + k) % run->worker_count]);
+        }
+        if (task < 0) break;
+
+        run_task(run, &run->tasks[task]);
+
+        // Builtins that ran here allocated from this thread's arena. The
+        // fallback on the shell's own thread must keep the command line.
+        if (worker->started) arena_reset();
+    }
+
+    if (worker->started) arena_release();
+    return NULL;
+}
+
+// Build a task's argv: "{}" in the template is replaced by the argument,
+// and without any "{}" the argument is appended
+static char **build_task_argv(char **command, int command_len, char *arg) {
+    char **argv = malloc((command_len + 2) * sizeof(char *));
+    if (argv == NULL) return NULL;
+
+    int substituted = 0;
+    for (int i = 0; i < command_len; i++) {
+        char *marker = strstr(command[i], "{}");
+        if (marker == NULL) {
+            argv[i] = command[i];
+            continue;
+        }
+
+        substituted = 1;
+        if (strcmp(command[i], "{}") == 0) {
+            argv[i] = arg;
+            continue;
+        }
+
+        size_t prefix = (size_t)(marker - command[i]);
+        size_t len = strlen(command[i]) - 2 + strlen(arg);
+        argv[i] = malloc(len + 1);
+        if (argv[i] != NULL) {
+            snprintf(argv[i], len + 1, "%.*s%s%s", (int)prefix, command[i], arg, marker + 2);
+        } else {
+            argv[i] = command[i];
+        }
+    }
+
+    int argc = command_len;
+    if (!substituted) argv[argc++] = arg;
+    argv[argc] = NULL;
+
+    return argv;
+}
+
+static void free_task_argv(char **argv, char **command, int command_len, char *arg) {
+    if (argv == NULL) return;
+    for (int i = 0; i < command_len; i++) {
+        if (argv[i] != command[i] && argv[i] != arg) free(argv[i]);
+    }
+    free(argv);
+}
+
+// Append the lines of a file (or "-" for input) to the argument buffer
+static int read_argument_file(const char *name, ShellStream *lines) {
+    if (strcmp(name, "-") == 0) {
+        size_t len;
+        const char *data = stream_read_all(shell_in, &len);
+        stream_write(lines, data, len);
+    } else {
+        FILE *file = fopen(name, "r");
+        if (file == NULL) {
+            perror(name);
+            return -1;
+        }
+        stream_write_file(lines, file);
+        fclose(file);
+    }
+
+    // Keep the last line separate from the next file's first
+    if (lines->size > 0 && lines->data[lines->size - 1] != '\n') {
+        stream_write(lines, "\n", 1);
+    }
+    return 0;
+}
+
+// Split the buffered lines in place and append them to the argument list
+static char **collect_line_arguments(ShellStream *lines, char **list, int *count) {
+    if (lines->size == 0) return list;
+    stream_write(lines, "", 1);
+
+    char *line = lines->data;
+    while (*line != '\0') {
+        char *end = strchr(line, '\n');
+        if (end != NULL) *end = '\0';
+        if (end != NULL && end > line && end[-1] == '\r') end[-1] = '\0';
+
+        if (*line != '\0') {
+            char **grown = realloc(list, (*count + 1) * sizeof(char *));
+            if (grown == NULL) break;
+            list = grown;
+            list[(*count)++] = line;
+        }
+
+        if (end == NULL) break;
+        line = end + 1;
+    }
+
+    return list;
+}
+
+static void print_parallel_usage(void) {
+    printf("Usage: parallel [-j N] [-k] command [args...] ::: arg...\n");
+    printf("       parallel [-j N] [-k] command [args...] :::: file...\n");
+    printf("       ... | parallel [-j N] [-k] command [args...]\n");
+    printf("Run command once per argument, N at a time (default: one per CPU).\n\n");
+    printf("  {}        Replaced by the argument (otherwise it is appended)\n");
+    printf("  ::: args  Take arguments from the command line\n");
+    printf("  :::: f    Take arguments from lines of files ('-' for input)\n");
+    printf("  -k        Print output in argument order, not completion order\n\n");
+    printf("Each job's output is printed in one piece; a summary with the exit\n");
+    printf("status and run time of every job goes to stderr.\n");
+}
+
+#endif
+
+// Parallel command - Run a command for many arguments concurrently
+int cmd_parallel(char **args) {
+    if (args[1] == NULL || strcmp(args[1], "--help") == 0) {
+#ifdef _WIN32
+        printf("Usage: parallel [-j N] command ::: arg...\n");
+#else
+        print_parallel_usage();
+#endif
+        return 1;
+    }
+
+#ifdef _WIN32
+    printf("parallel: not supported on Windows\n");
+    return 1;
+#else
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > 0 ? (int)cpus : 1;
+    int keep_order = 0;
+    int i = 1;
+
+    // Options
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+        if (strcmp(args[i], "-k") == 0) {
+            keep_order = 1;
+        } else if (strncmp(args[i], "-j", 2) == 0) {
+            const char *value = args[i][2] != '\0' ? args[i] + 2 : args[++i];
+            if (value == NULL || atoi(value) <= 0) {
+                printf("parallel: -j needs a positive number\n");
+                last_exit_status = 2;
+                return 1;
+            }
+            workers = atoi(value);
+        } else {
+            printf("parallel: unknown option '%s'\n", args[i]);
+            last_exit_status = 2;
+            return 1;
+        }
+    }
+
+    // Command template up to the first ::: or ::::
+    char **command = &args[i];
+    int command_len = 0;
+    while (command[command_len] != NULL && strcmp(command[command_len], ":::") != 0 &&
+           strcmp(command[command_len], "::::") != 0) {
+        command_len++;
+    }
+    if (command_len == 0) {
+        printf("parallel: missing command\n");
+        last_exit_status = 2;
+        return 1;
+    }
+
+    // Arguments: after :::, from the files after ::::, or from input lines
+    char **arguments = NULL;
+    int argument_count = 0;
+    ShellStream lines;
+    stream_init_buffer(&lines);
+
+    char **source = &command[command_len];
+    if (*source == NULL) {
+        if (!stream_input_is_piped()) {
+            printf("parallel: no arguments (use ::: or pipe them in)\n");
+            last_exit_status = 2;
+            return 1;
+        }
+        read_argument_file("-", &lines);
+        arguments = collect_line_arguments(&lines, arguments, &argument_count);
+    } else if (strcmp(*source, ":::") == 0) {
+        for (source++; *source != NULL; source++) {
+            char **grown = realloc(arguments, (argument_count + 1) * sizeof(char *));
+            if (grown == NULL) break;
+            arguments = grown;
+            arguments[argument_count++] = *source;
+        }
+    } else {
+        for (source++; *source != NULL; source++) {
+            if (read_argument_file(*source, &lines) != 0) {
+                stream_free(&lines);
+                free(arguments);
+                last_exit_status = 1;
+                return 1;
+            }
+        }
+        arguments = collect_line_arguments(&lines, arguments, &argument_count);
+    }
+
+    if (argument_count == 0) {
+        stream_free(&lines);
+        free(arguments);
+        return 1;
+    }
+
+    if (workers > argument_count) workers = argument_count;
+    if (workers > MAX_PARALLEL_WORKERS) workers = MAX_PARALLEL_WORKERS;
+
+    // Set up the tasks and deal them onto the worker deques
+    ParallelRun run;
+    memset(&run, 0, sizeof(run));
+    run.task_count = argument_count;
+    run.worker_count = workers;
+    run.tasks = calloc(argument_count, sizeof(ParallelTask));
+    run.deques = calloc(workers, sizeof(TaskDeque));
+    run.finished = malloc(argument_count * sizeof(int));
+    int *slots = malloc(argument_count * sizeof(int));
+    ParallelWorker *pool = calloc(workers, sizeof(ParallelWorker));
+
+    if (run.tasks == NULL || run.deques == NULL || run.finished == NULL || slots == NULL || pool == NULL) {
+        printf("Error: Memory allocation failed\n");
+        free(run.tasks);
+        free(run.deques);
+        free(run.finished);
+        free(slots);
+        free(pool);
+        stream_free(&lines);
+        free(arguments);
+        last_exit_status = 1;
+        return 1;
+    }
+
+    for (int t = 0; t < argument_count; t++) {
+        run.tasks[t].arg = arguments[t];
+        run.tasks[t].argv = build_task_argv(command, command_len, arguments[t]);
+    }
+
+    // Deque w holds tasks w, w + N, w + 2N, ... stored highest first, so
+    // the owner runs its tasks in argument order and thieves take the last
+    int offset = 0;
+    for (int w = 0; w < workers; w++) {
+        TaskDeque *deque = &run.deques[w];
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->items = &slots[offset];
+
+        int count = (argument_count - w + workers - 1) / workers;
+        for (int j = 0; j < count; j++) {
+            deque->items[count - 1 - j] = w + j * workers;
+        }
+        deque->tail = count;
+        offset += count;
+
+        pool[w].run = &run;
+        pool[w].id = w;
+    }
+
+    run.null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    ssize_t path_length = readlink("/proc/self/exe", run.shell_path, sizeof(run.shell_path) - 1);
+    run.shell_path[path_length > 0 ? path_length : 0] = '\0';
+
+    // Children are started from the workers, so the terminal goes back to
+    // normal here, once
+    terminal_restore();
+    pthread_mutex_init(&run.done_lock, NULL);
+    pthread_cond_init(&run.done_cond, NULL);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int started = 0;
+    for (int w = 0; w < workers; w++) {
+        pool[w].started = 1;
+        if (pthread_create(&pool[w].thread, NULL, parallel_worker, &pool[w]) != 0) pool[w].started = 0;
+        started += pool[w].started;
+    }
+    if (started == 0) {
+        // No threads available: the deques still drain, just one at a time
+        parallel_worker(&pool[0]);
+    }
+
+    // Print each task's output as a whole, as soon as it may be printed
+    for (int printed = 0; printed < argument_count; printed++) {
+        ParallelTask *task;
+
+        pthread_mutex_lock(&run.done_lock);
+        if (keep_order) {
+            while (run.tasks[printed].state != 1) pthread_cond_wait(&run.done_cond, &run.done_lock);
+            task = &run.tasks[printed];
+        } else {
+            while (run.finished_count <= printed) pthread_cond_wait(&run.done_cond, &run.done_lock);
+            task = &run.tasks[run.finished[printed]];
+        }
+        task->state = 2;
+        pthread_mutex_unlock(&run.done_lock);
+
+        sh_write(task->output.data, task->output.size);
+        stream_flush(shell_out);
+        stream_free(&task->output);
+    }
+
+    for (int w = 0; w < workers; w++) {
+        if (pool[w].started) pthread_join(pool[w].thread, NULL);
+    }
+    double total_ms = elapsed_ms_since(&start);
+
+    // Per-job summary, in argument order
+    int failed = 0;
+    for (int t = 0; t < argument_count; t++) {
+        ParallelTask *task = &run.tasks[t];
+        if (task->status != 0) failed++;
+        fprintf(stderr, "parallel: [%d] exit %-3d %8.1f ms  %s\n", t + 1, task->status,
+                task->elapsed_ms, task->arg);
+        free_task_argv(task->argv, command, command_len, task->arg);
+    }
+    fprintf(stderr, "parallel: %d jobs, %d failed, %d workers, %.1f ms\n",
+            argument_count, failed, workers, total_ms);
+
+    // Like GNU parallel, the exit status is the number of failed jobs
+    last_exit_status = failed > 101 ? 101 : failed;
+
+    if (run.null_fd >= 0) close(run.null_fd);
+    for (int w = 0; w < workers; w++) pthread_mutex_destroy(&run.deques[w].lock);
+    pthread_mutex_destroy(&run.done_lock);
+    pthread_cond_destroy(&run.done_cond);
+    free(run.tasks);
+    free(run.deques);
+    free(run.finished);
+    free(slots);
+    free(pool);
+    stream_free(&lines);
+    free(arguments);
+
+    return 1;
+#endif
+}
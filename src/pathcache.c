@@ -0,0 +1,294 @@
+#include "cshell.h"
+
+// PATH lookup cache
+//
+// Maps command names to the absolute path they resolved to, so external
+// commands can be launched with execv() instead of letting execvp() probe
+// every PATH directory on each invocation. The cache is dropped when the PATH
+// string changes. Directory mtimes are re-checked at most once per
+// PATH_CACHE_RECHECK_MS: a change in directory i invalidates every entry
+// resolved from directory i or later, since a new file there may now shadow
+// them.
+
+#ifndef _WIN32
+
+#define PATH_CACHE_BUCKETS 256
+#define PATH_CACHE_RECHECK_MS 1000
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+typedef struct PathEntry {
+    char *name;
+    char *path;
+    int dir_index;
+    int hits;
+    struct PathEntry *next;
+} PathEntry;
+
+typedef struct {
+    char *dir;
+    struct timespec mtime;
+} PathDir;
+
+static PathEntry *path_buckets[PATH_CACHE_BUCKETS];
+static PathDir *path_dirs = NULL;
+static int path_dir_count = 0;
+static char *cached_path_env = NULL;
+static struct timespec last_recheck = {0, 0};
+static pthread_mutex_t path_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int hash_command_name(const char *name) {
+    unsigned int h = 2166136261u;
+    while (*name != '\0') {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h % PATH_CACHE_BUCKETS;
+}
+
+static void free_entry(PathEntry *entry) {
+    free(entry->name);
+    free(entry->path);
+    free(entry);
+}
+
+// Drop entries resolved from PATH directory first_dir or later
+static void drop_entries_from(int first_dir) {
+    for (int b = 0; b < PATH_CACHE_BUCKETS; b++) {
+        PathEntry **link = &path_buckets[b];
+        while (*link != NULL) {
+            PathEntry *entry = *link;
+            if (entry->dir_index >= first_dir) {
+                *link = entry->next;
+                free_entry(entry);
+            } else {
+                link = &entry->next;
+            }
+        }
+    }
+}
+
+static void free_path_dirs(void) {
+    for (int i = 0; i < path_dir_count; i++) {
+        free(path_dirs[i].dir);
+    }
+    free(path_dirs);
+    path_dirs = NULL;
+    path_dir_count = 0;
+}
+
+static void stat_mtime(const char *dir, struct timespec *mtime) {
+    struct stat st;
+    if (stat(dir, &st) == 0) {
+        *mtime = st.st_mtim;
+    } else {
+        mtime->tv_sec = 0;
+        mtime->tv_nsec = 0;
+    }
+}
+
+// Split PATH into directories and record their current mtimes
+static void load_path_dirs(const char *path_env) {
+    free_path_dirs();
+    free(cached_path_env);
+    cached_path_env = strdup(path_env);
+
+    int capacity = 1;
+    for (const char *p = path_env; *p != '\0'; p++) {
+        if (*p == ':') capacity++;
+    }
+
+    path_dirs = calloc(capacity, sizeof(PathDir));
+    if (path_dirs == NULL) return;
+
+    const char *start = path_env;
+    for (;;) {
+        const char *end = strchr(start, ':');
+        size_t len = end ? (size_t)(end - start) : strlen(start);
+
+        // An empty PATH element means the current directory
+        char *dir = len == 0 ? strdup(".") : strndup(start, len);
+        if (dir != NULL) {
+            path_dirs[path_dir_count].dir = dir;
+            stat_mtime(dir, &path_dirs[path_dir_count].mtime);
+            path_dir_count++;
+        }
+
+        if (end == NULL) break;
+        start = end + 1;
+    }
+}
+
+static long elapsed_ms(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000 + (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+// Bring the cache in line with the current PATH and directory mtimes
+static void validate_path_cache(void) {
+    const char *path_env = getenv("PATH");
+    if (path_env == NULL) path_env = DEFAULT_PATH;
+
+    if (cached_path_env == NULL || strcmp(cached_path_env, path_env) != 0) {
+        drop_entries_from(0);
+        load_path_dirs(path_env);
+        clock_gettime(CLOCK_MONOTONIC, &last_recheck);
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (elapsed_ms(&last_recheck, &now) < PATH_CACHE_RECHECK_MS) return;
+    last_recheck = now;
+
+    for (int i = 0; i < path_dir_count; i++) {
+        struct timespec mtime;
+        stat_mtime(path_dirs[i].dir, &mtime);
+
+        if (mtime.tv_sec != path_dirs[i].mtime.tv_sec ||
+            mtime.tv_nsec != path_dirs[i].mtime.tv_nsec) {
+            if (debug_mode) printf(COLOR_YELLOW "Debug: PATH directory changed: %s\n" COLOR_RESET, path_dirs[i].dir);
+            drop_entries_from(i);
+            for (int j = i; j < path_dir_count; j++) {
+                stat_mtime(path_dirs[j].dir, &path_dirs[j].mtime);
+            }
+            break;
+        }
+    }
+}
+
+// Search PATH for an executable; returns the directory index or -1
+static int search_path(const char *name, char *out, size_t out_size) {
+    for (int i = 0; i < path_dir_count; i++) {
+        char candidate[PATH_MAX];
+        snprintf(candidate, sizeof(candidate), "%s/%s", path_dirs[i].dir, name);
+
+        struct stat st;
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+            snprintf(out, out_size, "%s", candidate);
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Resolve a command name to an executable path.
+// Returns 1 and fills out on success, 0 if the command was not found.
+int path_cache_lookup(const char *name, char *out, size_t out_size) {
+    // Names with a slash are paths already and bypass PATH entirely
+    if (strchr(name, '/') != NULL) {
+        snprintf(out, out_size, "%s", name);
+        return 1;
+    }
+
+    pthread_mutex_lock(&path_cache_lock);
+    validate_path_cache();
+
+    unsigned int bucket = hash_command_name(name);
+    for (PathEntry *entry = path_buckets[bucket]; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            entry->hits++;
+            snprintf(out, out_size, "%s", entry->path);
+            pthread_mutex_unlock(&path_cache_lock);
+            return 1;
+        }
+    }
+
+    int dir_index = search_path(name, out, out_size);
+    if (dir_index >= 0) {
+        PathEntry *entry = malloc(sizeof(PathEntry));
+        if (entry != NULL) {
+            entry->name = strdup(name);
+            entry->path = strdup(out);
+            entry->dir_index = dir_index;
+            entry->hits = 1;
+            entry->next = path_buckets[bucket];
+            path_buckets[bucket] = entry;
+        }
+    }
+
+    pthread_mutex_unlock(&path_cache_lock);
+    return dir_index >= 0;
+}
+
+// Forget a single command, e.g. after its cached path failed to execute
+void path_cache_forget(const char *name) {
+    pthread_mutex_lock(&path_cache_lock);
+
+    PathEntry **link = &path_buckets[hash_command_name(name)];
+    while (*link != NULL) {
+        PathEntry *entry = *link;
+        if (strcmp(entry->name, name) == 0) {
+            *link = entry->next;
+            free_entry(entry);
+            break;
+        }
+        link = &entry->next;
+    }
+
+    pthread_mutex_unlock(&path_cache_lock);
+}
+
+// Forget every remembered location
+void path_cache_clear(void) {
+    pthread_mutex_lock(&path_cache_lock);
+    drop_entries_from(0);
+    free_path_dirs();
+    free(cached_path_env);
+    cached_path_env = NULL;
+    pthread_mutex_unlock(&path_cache_lock);
+}
+
+// Print the cache in the same layout as bash's `hash`
+static void path_cache_print(void) {
+    pthread_mutex_lock(&path_cache_lock);
+
+    int count = 0;
+    for (int b = 0; b < PATH_CACHE_BUCKETS; b++) {
+        for (PathEntry *entry = path_buckets[b]; entry != NULL; entry = entry->next) {
+            if (count == 0) printf("hits\tcommand\n");
+            printf("%4d\t%s\n", entry->hits, entry->path);
+            count++;
+        }
+    }
+
+    if (count == 0) {
+        printf("hash: hash table empty\n");
+    }
+
+    pthread_mutex_unlock(&path_cache_lock);
+}
+
+#endif
+
+// Hash command - Inspect and reset the PATH lookup cache
+int cmd_hash(char **args) {
+    if (args[1] != NULL && strcmp(args[1], "--help") == 0) {
+        printf("Usage: hash [-r] [command...]\n");
+        printf("Show or manage the remembered locations of external commands.\n\n");
+        printf("  hash              List remembered commands and their hit counts\n");
+        printf("  hash -r           Forget all remembered locations\n");
+        printf("  hash [command]    Look up and remember the given commands\n");
+        return 1;
+    }
+
+#ifdef _WIN32
+    printf("hash: not supported on Windows\n");
+#else
+    if (args[1] == NULL) {
+        path_cache_print();
+    } else if (strcmp(args[1], "-r") == 0) {
+        path_cache_clear();
+    } else {
+        char path[PATH_MAX];
+        for (int i = 1; args[i] != NULL; i++) {
+            if (find_builtin(args[i]) != NULL) {
+                continue;
+            }
+            if (!path_cache_lookup(args[i], path, sizeof(path))) {
+                printf("hash: %s: not found\n", args[i]);
+            }
+        }
+    }
+#endif
+
+    return 1;
+}
@@ -0,0 +1,528 @@
+#include "cshell.h"
+
+// Redirections and pipelines
+//
+// The lexer (lexer.c) splits a command line into words and the operators
+// '|', '&', <, >, >>, 2>, 2>> and 2>&1. execute_pipeline() then splits the
+// arguments into stages at each '|', opens each stage's redirections and
+// runs every stage concurrently. The exit status of
+// a pipeline is the exit status of its last stage. A trailing '&' runs the
+// whole line as a background job (see jobs.c).
+//
+// Runs of adjacent stream builtins (BUILTIN_STREAMS) form an in-process
+// group: they execute inside the shell and hand memory buffers to each other.
+// Real pipes only exist where a group meets an external command or a builtin
+// without stream support, which still runs in a forked child. A builtin run
+// on its own is never forked, even when its output is redirected.
+
+// Convert a wait status to a shell exit status
+int exit_status_from_wait(int status) {
+#ifdef _WIN32
+    return status;
+#else
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 1;
+#endif
+}
+
+#ifndef _WIN32
+
+// Redirections opened for one stage (-1 = none)
+typedef struct {
+    int fd_in;
+    int fd_out;
+    int fd_err;
+    int err_to_out;
+} StageRedirects;
+
+static void close_redirects(StageRedirects *r) {
+    if (r->fd_in >= 0) close(r->fd_in);
+    if (r->fd_out >= 0) close(r->fd_out);
+    if (r->fd_err >= 0) close(r->fd_err);
+    r->fd_in = r->fd_out = r->fd_err = -1;
+}
+
+static int is_operator(const char *arg) {
+    return token_operator(arg) != TOKEN_WORD;
+}
+
+// Remove redirection operators from a stage's arguments and open their
+// files close-on-exec. Returns 0 on success, -1 after reporting an error.
+static int open_redirects(char **args, StageRedirects *r) {
+    r->fd_in = r->fd_out = r->fd_err = -1;
+    r->err_to_out = 0;
+
+    int kept = 0;
+    for (int i = 0; args[i] != NULL; i++) {
+        char *op = args[i];
+        TokenKind kind = token_operator(op);
+        if (kind == TOKEN_WORD) {
+            args[kept++] = op;
+            continue;
+        }
+
+        if (kind == TOKEN_REDIRECT_ERR_OUT) {
+            r->err_to_out = 1;
+            continue;
+        }
+
+        char *file = args[i + 1];
+        if (file == NULL || is_operator(file)) {
+            printf("Error: syntax error near '%s'\n", op);
+            close_redirects(r);
+            return -1;
+        }
+        i++;
+
+        int flags = O_CLOEXEC;
+        int *target;
+        if (kind == TOKEN_REDIRECT_IN) {
+            flags |= O_RDONLY;
+            target = &r->fd_in;
+        } else if (kind == TOKEN_REDIRECT_OUT || kind == TOKEN_REDIRECT_APPEND) {
+            flags |= O_WRONLY | O_CREAT | (kind == TOKEN_REDIRECT_APPEND ? O_APPEND : O_TRUNC);
+            target = &r->fd_out;
+        } else {
+            flags |= O_WRONLY | O_CREAT | (kind == TOKEN_REDIRECT_ERR_APPEND ? O_APPEND : O_TRUNC);
+            target = &r->fd_err;
+        }
+
+        int fd = open(file, flags, 0644);
+        if (fd < 0) {
+            perror(file);
+            close_redirects(r);
+            return -1;
+        }
+
+        // The last redirection of a kind wins, as in sh
+        if (*target >= 0) close(*target);
+        *target = fd;
+    }
+    args[kept] = NULL;
+
+    if (kept == 0) {
+        printf("Error: missing command\n");
+        close_redirects(r);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Combine a stage's pipe ends with its redirections; redirections win
+static SpawnOptions stage_io(const StageRedirects *r, int pipe_in, int pipe_out) {
+    SpawnOptions io;
+    io.pgid = -1;
+    io.fd_in = r->fd_in >= 0 ? r->fd_in : pipe_in;
+    io.fd_out = r->fd_out >= 0 ? r->fd_out : pipe_out;
+    io.fd_err = r->fd_err;
+    if (r->err_to_out) {
+        io.fd_err = io.fd_out >= 0 ? io.fd_out : STDOUT_FILENO;
+    }
+    return io;
+}
+
+// Run a builtin in the shell process with its stdio temporarily swapped
+// for the given descriptors. Stream builtins read redirected input through
+// shell_in, so stdin is only swapped for builtins that read stdio directly.
+void run_builtin_with_io(BuiltinCommand *builtin, char **args, const SpawnOptions *io) {
+    int sources[3] = {io->fd_in, io->fd_out, io->fd_err};
+    int saved[3] = {-1, -1, -1};
+    ShellStream input;
+    int use_stream_input = (builtin->flags & BUILTIN_STREAMS) && io->fd_in >= 0;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int target = 0; target < 3; target++) {
+        if (sources[target] < 0 || sources[target] == target) continue;
+        if (target == STDIN_FILENO && use_stream_input) continue;
+
+        saved[target] = fcntl(target, F_DUPFD_CLOEXEC, 10);
+        dup2(sources[target], target);
+    }
+
+    if (use_stream_input) {
+        stream_init_fd(&input, io->fd_in);
+        shell_in = &input;
+    }
+
+    builtin->func(args);
+
+    if (use_stream_input) {
+        shell_in = NULL;
+        stream_free(&input);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int target = 0; target < 3; target++) {
+        if (saved[target] < 0) continue;
+        dup2(saved[target], target);
+        close(saved[target]);
+    }
+    if (saved[STDIN_FILENO] >= 0) clearerr(stdin);
+}
+
+// Run a builtin as a pipeline stage in a child process
+static pid_t fork_builtin(BuiltinCommand *builtin, char **args, const SpawnOptions *io) {
+    fflush(stdout);
+    fflush(stderr);
+
+    uint64_t trace = trace_start();
+    pid_t pid = fork();
+    if (pid != 0) {
+        trace_span("fork", trace, args[0]);
+        return pid;
+    }
+
+    if (io->pgid >= 0) setpgid(0, io->pgid);
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+
+    if (io->fd_in >= 0) dup2(io->fd_in, STDIN_FILENO);
+    if (io->fd_out >= 0) dup2(io->fd_out, STDOUT_FILENO);
+    if (io->fd_err >= 0) dup2(io->fd_err, STDERR_FILENO);
+
+    last_exit_status = 0;
+    builtin->func(args);
+    fflush(stdout);
+    _exit(last_exit_status);
+}
+
+// Start a builtin (forked) or external command as a child process with
+// the given stdio; returns its pid or -1 after reporting the error
+pid_t start_process(char **args, const SpawnOptions *io) {
+    terminal_restore();
+
+    BuiltinCommand *builtin = find_builtin(args[0]);
+    if (builtin != NULL) {
+        pid_t pid = fork_builtin(builtin, args, io);
+        if (pid < 0) {
+            perror("fork");
+        } else if (io->pgid >= 0) {
+            // Also set the group here, so it exists before the parent uses it
+            setpgid(pid, io->pgid == 0 ? pid : io->pgid);
+        }
+        return pid;
+    }
+
+    char path[PATH_MAX];
+    if (!path_cache_lookup(args[0], path, sizeof(path))) {
+        fprintf(stderr, "%s: command not found\n", args[0]);
+        return -1;
+    }
+
+    pid_t pid = spawn_command(path, args, io);
+    if (pid < 0) {
+        perror(args[0]);
+        path_cache_forget(args[0]);
+    }
+    return pid;
+}
+
+// A run of adjacent stream builtins executed inside the shell
+typedef struct {
+    char ***stages;
+    StageRedirects *redirects;
+    int count;
+    int fd_in;          // Pipe from the previous child stage, or -1 for stdin
+    int fd_out;         // Pipe to the next child stage, or -1 for stdout
+    int threaded;
+    int status;         // Exit status of the group's last stage
+} StreamGroup;
+
+static void *run_stream_group(void *arg) {
+    StreamGroup *group = arg;
+    ShellStream pipe_in, pipe_out, buffers[2], file_in, file_out;
+    ShellStream *in = NULL;
+
+    if (group->fd_in >= 0) {
+        stream_init_fd(&pipe_in, group->fd_in);
+        in = &pipe_in;
+    }
+    if (group->fd_out >= 0) {
+        stream_init_fd(&pipe_out, group->fd_out);
+    }
+
+    // Each stage writes a buffer that the next stage reads in place
+    for (int i = 0; i < group->count; i++) {
+        StageRedirects *r = &group->redirects[i];
+        ShellStream *out;
+
+        if (r->fd_out >= 0) {
+            stream_init_fd(&file_out, r->fd_out);
+            out = &file_out;
+        } else if (i == group->count - 1) {
+            out = group->fd_out >= 0 ? &pipe_out : NULL;
+        } else {
+            out = &buffers[i % 2];
+            stream_init_buffer(out);
+        }
+
+        ShellStream *stage_in = in;
+        if (r->fd_in >= 0) {
+            stream_init_fd(&file_in, r->fd_in);
+            stage_in = &file_in;
+        }
+
+        char **args = group->stages[i];
+        shell_in = stage_in;
+        shell_out = out;
+
+        // Builtins report failure by setting last_exit_status, which is this
+        // thread's own
+        last_exit_status = 0;
+        find_builtin(args[0])->func(args);
+        group->status = last_exit_status;
+
+        if (stage_in == &file_in) stream_free(&file_in);
+        if (in != NULL && in != &pipe_in) stream_free(in);
+
+        // A stage redirected to a file passes nothing down the pipeline
+        if (out == &file_out) {
+            stream_flush(&file_out);
+            stream_free(&file_out);
+            if (i < group->count - 1) {
+                out = &buffers[i % 2];
+                stream_init_buffer(out);
+            } else {
+                out = NULL;
+            }
+        }
+        in = out;
+    }
+
+    shell_in = NULL;
+    shell_out = NULL;
+
+    if (group->fd_out >= 0) {
+        stream_flush(&pipe_out);
+        stream_free(&pipe_out);
+        close(group->fd_out);
+    } else {
+        fflush(stdout);
+    }
+    if (group->fd_in >= 0) {
+        stream_free(&pipe_in);
+        close(group->fd_in);
+    }
+    if (group->threaded) arena_release();
+
+    return NULL;
+}
+
+#endif
+
+// Execute a tokenized command line, which may be a pipeline
+void execute_pipeline(char **args) {
+    char **stages[MAX_PIPELINE_STAGES];
+    int stage_count = 0;
+    int background = 0;
+
+    // A trailing '&' runs the whole line as a background job
+    int count = 0;
+    while (args[count] != NULL) count++;
+    if (count > 0 && token_operator(args[count - 1]) == TOKEN_BACKGROUND) {
+        background = 1;
+        args[--count] = NULL;
+    }
+    int misplaced = count == 0;
+    for (int i = 0; i < count; i++) {
+        if (token_operator(args[i]) == TOKEN_BACKGROUND) misplaced = 1;
+    }
+    if (misplaced) {
+        printf("Error: syntax error near '&'\n");
+        last_exit_status = 2;
+        return;
+    }
+
+    // Split the token list into stages at each '|'
+    stages[stage_count++] = args;
+    for (int i = 0; args[i] != NULL; i++) {
+        if (token_operator(args[i]) == TOKEN_PIPE) {
+            if (stage_count == MAX_PIPELINE_STAGES) {
+                printf("Error: too many pipeline stages (at most %d)\n", MAX_PIPELINE_STAGES);
+                last_exit_status = 2;
+                return;
+            }
+            args[i] = NULL;
+            stages[stage_count++] = &args[i + 1];
+        }
+    }
+
+    for (int s = 0; s < stage_count; s++) {
+        if (stages[s][0] == NULL) {
+            printf("Error: syntax error near '|'\n");
+            last_exit_status = 2;
+            return;
+        }
+    }
+
+#ifdef _WIN32
+    // Windows implementation: let cmd.exe handle pipes and redirections
+    if (stage_count == 1) {
+        execute_command(args, NULL);
+        return;
+    }
+
+    char command[MAX_COMMAND_LENGTH] = "";
+    for (int s = 0; s < stage_count; s++) {
+        for (int i = 0; stages[s][i] != NULL; i++) {
+            strcat(command, stages[s][i]);
+            strcat(command, " ");
+        }
+        if (s < stage_count - 1) strcat(command, "| ");
+    }
+    last_exit_status = system(command);
+#else
+    // Unix implementation: open every stage's redirections first
+    StageRedirects redirects[MAX_PIPELINE_STAGES];
+    for (int s = 0; s < stage_count; s++) {
+        if (open_redirects(stages[s], &redirects[s]) != 0) {
+            for (int j = 0; j < s; j++) close_redirects(&redirects[j]);
+            last_exit_status = 1;
+            return;
+        }
+    }
+
+    if (stage_count == 1 && !background) {
+        SpawnOptions io = stage_io(&redirects[0], -1, -1);
+        execute_command(stages[0], &io);
+        close_redirects(&redirects[0]);
+        return;
+    }
+
+    if (debug_mode) printf(COLOR_YELLOW "Debug: Pipeline with %d stages\n" COLOR_RESET, stage_count);
+
+    // Accounted as one command, named after its stages ("seq|sort")
+    char stats_name[MAX_COMMAND_LENGTH] = "";
+    for (int s = 0; s < stage_count; s++) {
+        if (s > 0) strncat(stats_name, "|", sizeof(stats_name) - strlen(stats_name) - 1);
+        strncat(stats_name, stages[s][0], sizeof(stats_name) - strlen(stats_name) - 1);
+    }
+    StatsMark mark;
+    stats_begin(&mark, RUSAGE_SELF);
+
+    // Decide which stages run in-process. A stderr redirection would have
+    // to swap the shell's own stderr, so such stages run in a child instead,
+    // and so does everything in a background job.
+    int in_process[MAX_PIPELINE_STAGES];
+    for (int s = 0; s < stage_count; s++) {
+        BuiltinCommand *builtin = find_builtin(stages[s][0]);
+        in_process[s] = !background && builtin != NULL && (builtin->flags & BUILTIN_STREAMS) &&
+                        redirects[s].fd_err < 0 && !redirects[s].err_to_out;
+    }
+
+    // Create every pipe up front; two in-process neighbours need none
+    int pipes[MAX_PIPELINE_STAGES][2];
+    pid_t pids[MAX_PIPELINE_STAGES];
+
+    for (int s = 0; s < stage_count - 1; s++) {
+        pipes[s][0] = pipes[s][1] = -1;
+        if (in_process[s] && in_process[s + 1]) continue;
+
+        if (pipe2(pipes[s], O_CLOEXEC) != 0) {
+            perror("pipe");
+            for (int j = 0; j < s; j++) {
+                if (pipes[j][0] >= 0) close(pipes[j][0]);
+                if (pipes[j][1] >= 0) close(pipes[j][1]);
+            }
+            for (int j = 0; j < stage_count; j++) close_redirects(&redirects[j]);
+            last_exit_status = 1;
+            return;
+        }
+    }
+
+    // Start all child stages before any in-process work. They share one
+    // process group, led by the first child, when job control applies.
+    int own_group = background || job_control_enabled();
+    pid_t pgid = 0;
+
+    for (int s = 0; s < stage_count; s++) {
+        pids[s] = 0;
+        if (in_process[s]) continue;
+
+        int fd_in = s > 0 ? pipes[s - 1][0] : -1;
+        int fd_out = s < stage_count - 1 ? pipes[s][1] : -1;
+        SpawnOptions io = stage_io(&redirects[s], fd_in, fd_out);
+        if (own_group) io.pgid = pgid;
+
+        pids[s] = start_process(stages[s], &io);
+        if (own_group && pgid == 0 && pids[s] > 0) pgid = pids[s];
+        close_redirects(&redirects[s]);
+    }
+
+    // Keep only the pipe ends the in-process groups use, so every child
+    // sees EOF (or EPIPE) as soon as its real peer is done
+    for (int s = 0; s < stage_count - 1; s++) {
+        if (pipes[s][0] < 0) continue;
+        if (!in_process[s]) {
+            close(pipes[s][1]);
+            pipes[s][1] = -1;
+        }
+        if (!in_process[s + 1]) {
+            close(pipes[s][0]);
+            pipes[s][0] = -1;
+        }
+    }
+
+    if (background) {
+        job_background(pgid, pids, stage_count);
+        return;
+    }
+
+    // The children own the terminal while the pipeline runs
+    if (own_group) job_take_terminal(pgid);
+
+    // Run the in-process groups. Every group but a trailing one gets its own
+    // thread, so a group feeding a child never waits on one reading from it.
+    StreamGroup groups[MAX_PIPELINE_STAGES];
+    pthread_t threads[MAX_PIPELINE_STAGES];
+    int group_count = 0;
+
+    for (int s = 0; s < stage_count; s++) {
+        if (!in_process[s]) continue;
+
+        StreamGroup *group = &groups[group_count];
+        int first = s;
+        while (s + 1 < stage_count && in_process[s + 1]) s++;
+
+        group->stages = &stages[first];
+        group->redirects = &redirects[first];
+        group->count = s - first + 1;
+        group->fd_in = first > 0 ? pipes[first - 1][0] : -1;
+        group->fd_out = s < stage_count - 1 ? pipes[s][1] : -1;
+        group->threaded = s < stage_count - 1;
+
+        if (group->threaded && pthread_create(&threads[group_count], NULL, run_stream_group, group) != 0) {
+            group->threaded = 0;
+        }
+        if (!group->threaded) {
+            run_stream_group(group);
+        }
+        group_count++;
+    }
+
+    for (int g = 0; g < group_count; g++) {
+        if (groups[g].threaded) pthread_join(threads[g], NULL);
+    }
+    for (int s = 0; s < stage_count; s++) {
+        if (in_process[s]) close_redirects(&redirects[s]);
+    }
+
+    // Reap every child stage; the pipeline's status is the last stage's
+    struct rusage usage;
+    last_exit_status = job_wait_foreground(own_group ? pgid : -1, pids, stage_count, &usage);
+    if (in_process[stage_count - 1]) last_exit_status = groups[group_count - 1].status;
+    stats_end(&mark, stats_name, &usage);
+#endif
+}
@@ -0,0 +1,157 @@
+#include "cshell.h"
+
+// Script and batch mode
+//
+// `cshell -c "cmd"`, `cshell script.csh` and a cshell whose stdin is not a
+// terminal run commands without the interactive front end: no banner,
+// no prompt, no raw terminal mode and no history. Input is read in large
+// blocks, and the shell exits with the status of the last command. A '#'
+// starts a comment (including a "#!" first line).
+//
+// Scripts are compiled (vm.c) rather than run line by line. A script file
+// is read whole and compiled once. Other input is compiled as it arrives:
+// complete statements run as soon as their line is in, while an if, loop
+// or function definition waits until its last line has been read.
+
+#define SCRIPT_CHUNK 65536
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+// CRLF line ends become LF, so a script written on Windows runs too
+static size_t strip_carriage_returns(char *text, size_t len) {
+    size_t out = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == '\r' && i + 1 < len && text[i + 1] == '\n') continue;
+        text[out++] = text[i];
+    }
+    return out;
+}
+
+// Compile and run text[0..len); returns the bytes used. With more input to
+// come, a statement still open at the end is left for later.
+static size_t run_text(const char *text, size_t len, int more) {
+    size_t used = 0;
+
+    while (shell_running && used < len) {
+        size_t size = len - used;
+        size_t complete = size;
+        Program *program = line_cache_lookup(text + used, size);
+        if (program == NULL) {
+            program = compile_program(text + used, size, more ? &complete : NULL);
+            if (program != NULL) line_cache_insert(text + used, size, program);
+        }
+
+        if (program == NULL && more) {
+            if (complete == 0) break;
+
+            // Run the statements before the open one, or report the error
+            if (complete != COMPILE_FAILED) size = complete;
+            program = compile_program(text + used, size, NULL);
+        }
+
+        if (program != NULL) {
+            run_program(program);
+            free_program(program);
+        } else {
+            last_exit_status = 2;
+        }
+        arena_reset();
+        jobs_notify();
+        used += size;
+    }
+
+    return used;
+}
+
+// Run commands read from fd until end of input or `exit`
+int run_script_fd(int fd) {
+    size_t capacity = SCRIPT_CHUNK;
+    size_t len = 0;
+    char *buffer = malloc(capacity + 1);
+    if (buffer == NULL) {
+        printf("Error: Memory allocation failed\n");
+        return 1;
+    }
+
+#ifndef _WIN32
+    struct stat st;
+    int whole_file = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+#else
+    int whole_file = 0;
+#endif
+
+    while (shell_running) {
+        // Keep room for a full read; a line longer than the buffer grows it
+        if (capacity - len < SCRIPT_CHUNK / 2) {
+            char *grown = realloc(buffer, capacity * 2 + 1);
+            if (grown == NULL) {
+                printf("Error: Memory allocation failed\n");
+                break;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+
+        ssize_t n = read(fd, buffer + len, capacity - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("read");
+            last_exit_status = 1;
+            break;
+        }
+
+        if (n == 0) {
+            // Whatever is left runs, or reports what it lacks
+            len = strip_carriage_returns(buffer, len);
+            if (len > 0) run_text(buffer, len, 0);
+            break;
+        }
+
+        // Only whole lines are compiled; a regular file is read to its end first
+        size_t start = len;
+        len += (size_t)n;
+        if (whole_file) continue;
+
+        char *newline = NULL;
+        for (size_t i = len; i > start; i--) {
+            if (buffer[i - 1] == '\n') {
+                newline = buffer + i - 1;
+                break;
+            }
+        }
+        if (newline == NULL) continue;
+
+        size_t lines = strip_carriage_returns(buffer, (size_t)(newline - buffer) + 1);
+        size_t rest = len - (size_t)(newline + 1 - buffer);
+        memmove(buffer + lines, newline + 1, rest);
+        len = lines + rest;
+
+        size_t used = run_text(buffer, lines, 1);
+        memmove(buffer, buffer + used, len - used);
+        len -= used;
+    }
+
+    free(buffer);
+    return last_exit_status;
+}
+
+// Run a script file
+int run_script_file(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "cshell: %s: %s\n", path, strerror(errno));
+        return 127;
+    }
+
+    int status = run_script_fd(fd);
+    close(fd);
+    return status;
+}
+
+// Run the commands of a -c argument
+int run_command_string(const char *commands) {
+    run_text(commands, strlen(commands), 0);
+    return last_exit_status;
+}
@@ -0,0 +1,510 @@
+#include "cshell.h"
+
+// Command server
+//
+// `cshell --serve SOCK` starts once - history, todo list, notes, PATH cache
+// and the curl share handle are loaded a single time - and then accepts
+// clients on a Unix domain socket. Each client connection is served by a
+// forked copy of the warm server, so sessions run concurrently and one
+// session's cd or debug setting never leaks into another.
+//
+// `cshell --connect SOCK -c CMD` is the matching client. It never calls
+// init_shell(); it only sends the command and copies the reply to its own
+// stdout/stderr, exiting with the command's status. Without -c it reads its
+// stdin and sends each complete statement as one command over the same
+// connection; an if, loop or function definition waits for its last line,
+// the way a script does.
+//
+// Both directions use frames of a type byte, a 32-bit big-endian length and
+// the payload:
+//   'C'  client -> server  one command: a line or a whole statement
+//   'O'  server -> client  a chunk of stdout
+//   'E'  server -> client  a chunk of stderr
+//   'X'  server -> client  4-byte exit status; the command is finished
+
+#ifndef _WIN32
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <arpa/inet.h>
+
+#define SERVER_BACKLOG 64
+#define FRAME_CHUNK 65536
+
+static volatile sig_atomic_t server_stop = 0;
+
+// Relay of one command's output pipes to the client
+typedef struct {
+    int conn;
+    int out_fd;
+    int err_fd;
+    int wake_fd;        // Readable once the command has returned
+    int broken;         // The client went away; output is discarded
+} OutputRelay;
+
+static int write_all_fd(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_all_fd(int fd, void *data, size_t len) {
+    char *p = data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int write_frame(int fd, char type, const void *data, uint32_t len) {
+    unsigned char header[5];
+    uint32_t be_len = htonl(len);
+
+    header[0] = (unsigned char)type;
+    memcpy(header + 1, &be_len, 4);
+    if (write_all_fd(fd, header, sizeof(header)) != 0) return -1;
+    return len > 0 ? write_all_fd(fd, data, len) : 0;
+}
+
+static int read_frame_header(int fd, char *type, uint32_t *len) {
+    unsigned char header[5];
+    uint32_t be_len;
+
+    if (read_all_fd(fd, header, sizeof(header)) != 0) return -1;
+    memcpy(&be_len, header + 1, 4);
+    *type = (char)header[0];
+    *len = ntohl(be_len);
+    return 0;
+}
+
+// Read one frame into buf; payloads larger than size are rejected
+static int read_frame(int fd, char *type, char *buf, uint32_t size, uint32_t *len) {
+    if (read_frame_header(fd, type, len) != 0 || *len > size) return -1;
+    return *len > 0 ? read_all_fd(fd, buf, *len) : 0;
+}
+
+// Forward whatever is readable on fd; returns 0 once it reaches EOF
+static int relay_pipe(OutputRelay *relay, int fd, char type) {
+    char buffer[FRAME_CHUNK];
+
+    for (;;) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return 1;        // EAGAIN: drained for now
+        if (n == 0) return 0;
+
+        if (!relay->broken && write_frame(relay->conn, type, buffer, (uint32_t)n) != 0) {
+            relay->broken = 1;
+        }
+    }
+}
+
+static void *relay_output(void *arg) {
+    OutputRelay *relay = arg;
+    int out_open = 1, err_open = 1;
+
+    while (out_open || err_open) {
+        struct pollfd fds[3] = {
+            {out_open ? relay->out_fd : -1, POLLIN, 0},
+            {err_open ? relay->err_fd : -1, POLLIN, 0},
+            {relay->wake_fd, POLLIN, 0},
+        };
+
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (fds[0].revents) out_open = relay_pipe(relay, relay->out_fd, 'O');
+        if (fds[1].revents) err_open = relay_pipe(relay, relay->err_fd, 'E');
+
+        // The command is done. Background jobs may still hold the pipes
+        // open, so take what is buffered now and stop.
+        if (fds[2].revents) {
+            if (out_open) relay_pipe(relay, relay->out_fd, 'O');
+            if (err_open) relay_pipe(relay, relay->err_fd, 'E');
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+// Run one command with stdout/stderr streamed to the client
+static int serve_command(int conn, char *line, int null_fd) {
+    int out[2], err[2], wake[2];
+
+    if (pipe2(out, O_CLOEXEC) != 0) return -1;
+    if (pipe2(err, O_CLOEXEC) != 0) {
+        close(out[0]);
+        close(out[1]);
+        return -1;
+    }
+    if (pipe2(wake, O_CLOEXEC) != 0) {
+        close(out[0]);
+        close(out[1]);
+        close(err[0]);
+        close(err[1]);
+        return -1;
+    }
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+    fcntl(err[0], F_SETFL, O_NONBLOCK);
+
+    OutputRelay relay = {conn, out[0], err[0], wake[0], 0};
+    pthread_t thread;
+    int threaded = pthread_create(&thread, NULL, relay_output, &relay) == 0;
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(out[1], STDOUT_FILENO);
+    dup2(err[1], STDERR_FILENO);
+    close(out[1]);
+    close(err[1]);
+
+    last_exit_status = 0;
+    process_command(line);
+
+    // Point stdio back at /dev/null, which closes our ends of the pipes
+    fflush(stdout);
+    fflush(stderr);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+
+    if (threaded) {
+        write_all_fd(wake[1], "x", 1);
+        pthread_join(thread, NULL);
+    }
+    close(wake[0]);
+    close(wake[1]);
+    close(out[0]);
+    close(err[0]);
+
+    if (relay.broken) return -1;
+
+    uint32_t status = htonl((uint32_t)last_exit_status);
+    return write_frame(conn, 'X', &status, sizeof(status));
+}
+
+// Serve one client until it disconnects or runs `exit`
+static void serve_session(int conn) {
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (null_fd < 0) return;
+
+    // Commands never read the server's stdin
+    dup2(null_fd, STDIN_FILENO);
+
+    for (;;) {
+        char type;
+        uint32_t len;
+
+        // A command is as long as its frame says: a whole statement can
+        // run to many lines
+        if (read_frame_header(conn, &type, &len) != 0 || type != 'C') break;
+        char *line = malloc((size_t)len + 1);
+        if (line == NULL) {
+            printf("Error: Memory allocation failed\n");
+            break;
+        }
+        if (len > 0 && read_all_fd(conn, line, len) != 0) {
+            free(line);
+            break;
+        }
+        line[len] = '\0';
+
+        int result = serve_command(conn, line, null_fd);
+        free(line);
+        if (result != 0 || !shell_running) break;
+    }
+
+    close(null_fd);
+}
+
+static void server_signal_handler(int signo) {
+    (void)signo;
+    server_stop = 1;
+}
+
+// Make way for the listening socket at addr. Only a socket nobody listens
+// on - left behind by a server that died - is removed; a live server's
+// socket or any other file is refused.
+static int claim_socket_path(const struct sockaddr_un *addr) {
+    const char *path = addr->sun_path;
+    struct stat st;
+
+    if (lstat(path, &st) != 0) {
+        if (errno == ENOENT) return 0;
+        perror(path);
+        return -1;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "cshell: %s exists and is not a socket\n", path);
+        return -1;
+    }
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0) {
+        perror("socket");
+        return -1;
+    }
+    int connected = connect(probe, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+    int saved_errno = errno;
+    close(probe);
+
+    if (connected) {
+        fprintf(stderr, "cshell: a server is already listening on %s\n", path);
+        return -1;
+    }
+    if (saved_errno != ECONNREFUSED) {
+        errno = saved_errno;
+        perror(path);
+        return -1;
+    }
+    if (unlink(path) != 0 && errno != ENOENT) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+// Listen on socket_path and serve clients until SIGINT or SIGTERM
+int run_server(const char *socket_path) {
+    struct sockaddr_un addr;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "cshell: socket path too long: %s\n", socket_path);
+        return 2;
+    }
+
+    // Everything a command might need is loaded once, before any fork
+    ensure_history();
+    ensure_todo_list();
+    ensure_notes();
+    init_builtin_table();
+    init_curl_share();
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    if (claim_socket_path(&addr) != 0) {
+        close(listen_fd);
+        return 1;
+    }
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, SERVER_BACKLOG) != 0) {
+        perror(socket_path);
+        close(listen_fd);
+        return 1;
+    }
+    chmod(socket_path, 0600);
+
+    // Remembered so that on exit only our own socket is removed
+    struct stat bound;
+    int have_bound = lstat(socket_path, &bound) == 0;
+
+    // No SA_RESTART, so accept() returns when asked to stop
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = server_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    fprintf(stderr, "cshell: serving on %s\n", socket_path);
+
+    while (!server_stop) {
+        int conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        int accept_errno = errno;
+
+        // Reap finished sessions (waitpid's ECHILD must not hide accept's error)
+        while (waitpid(-1, NULL, WNOHANG) > 0);
+
+        if (conn < 0) {
+            if (accept_errno == EINTR || accept_errno == ECONNABORTED) continue;
+            errno = accept_errno;
+            perror("accept");
+            break;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listen_fd);
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            serve_session(conn);
+            close(conn);
+            fflush(NULL);
+            _exit(0);
+        }
+        if (pid < 0) perror("fork");
+        close(conn);
+    }
+
+    close(listen_fd);
+
+    struct stat st;
+    if (have_bound && lstat(socket_path, &st) == 0 && st.st_dev == bound.st_dev && st.st_ino == bound.st_ino) {
+        unlink(socket_path);
+    }
+    return 0;
+}
+
+// Send one command and copy its output; returns its exit status, -1 if
+// the connection broke, or -2 if the session had already ended (`exit`)
+static int client_command(int conn, const char *command, size_t length) {
+    if (length > UINT32_MAX || write_frame(conn, 'C', command, (uint32_t)length) != 0) return -2;
+
+    static char buffer[FRAME_CHUNK];
+    for (int frames = 0;; frames++) {
+        char type;
+        uint32_t len;
+
+        if (read_frame(conn, &type, buffer, sizeof(buffer), &len) != 0) return frames == 0 ? -2 : -1;
+
+        if (type == 'O') {
+            write_all_fd(STDOUT_FILENO, buffer, len);
+        } else if (type == 'E') {
+            write_all_fd(STDERR_FILENO, buffer, len);
+        } else if (type == 'X' && len == 4) {
+            uint32_t status;
+            memcpy(&status, buffer, 4);
+            return (int)ntohl(status);
+        }
+    }
+}
+
+// Send stdin a complete statement at a time, as run_text() in script.c
+// splits it; returns the last status or client_command()'s error
+static int client_statements(int conn) {
+    char *line = NULL;
+    size_t line_capacity = 0;
+    char *text = NULL;
+    size_t len = 0, capacity = 0;
+    int status = 0;
+    int ended = 0;              // By `exit`, or by a failure here
+    ssize_t n;
+
+    while (status >= 0 && (n = getline(&line, &line_capacity, stdin)) > 0) {
+        if (len + (size_t)n + 1 > capacity) {
+            capacity = (len + (size_t)n + 1) * 2;
+            char *grown = realloc(text, capacity);
+            if (grown == NULL) {
+                printf("Error: Memory allocation failed\n");
+                status = 1;
+                ended = 1;
+                break;
+            }
+            text = grown;
+        }
+        memcpy(text + len, line, (size_t)n);
+        len += (size_t)n;
+
+        // Only the statement boundaries matter here; the server compiles
+        // the text again and reports any error itself
+        size_t complete = len;
+        Program *program = compile_program(text, len, &complete);
+        arena_reset();
+        if (program != NULL) free_program(program);
+        if (complete == 0) continue;
+        if (complete == COMPILE_FAILED) complete = len;
+
+        int result = client_command(conn, text, complete);
+        if (result == -2) {
+            ended = 1;
+            break;
+        }
+        status = result;
+        memmove(text, text + complete, len - complete);
+        len -= complete;
+    }
+
+    // Whatever is left runs, or reports what it lacks
+    if (!ended && status >= 0 && len > 0) {
+        int result = client_command(conn, text, len);
+        if (result != -2) status = result;
+    }
+
+    free(line);
+    free(text);
+    return status;
+}
+
+// Run command (or the statements on stdin) on the server at socket_path
+int run_client(const char *socket_path, const char *command) {
+    struct sockaddr_un addr;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "cshell: socket path too long: %s\n", socket_path);
+        return 2;
+    }
+
+    int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    if (connect(conn, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror(socket_path);
+        close(conn);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int status = 0;
+    if (command != NULL) {
+        status = client_command(conn, command, strlen(command));
+    } else {
+        status = client_statements(conn);
+    }
+
+    if (status == -2 && command != NULL) status = -1;
+    if (status < 0) {
+        fprintf(stderr, "cshell: connection to %s lost\n", socket_path);
+        status = 1;
+    }
+
+    close(conn);
+    return status;
+}
+
+#else
+
+int run_server(const char *socket_path) {
+    (void)socket_path;
+    fprintf(stderr, "cshell: --serve is not supported on Windows\n");
+    return 2;
+}
+
+int run_client(const char *socket_path, const char *command) {
+    (void)socket_path;
+    (void)command;
+    fprintf(stderr, "cshell: --connect is not supported on Windows\n");
+    return 2;
+}
+
+#endif
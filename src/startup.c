@@ -0,0 +1,194 @@
+#include "cshell.h"
+
+// Startup profiling and lazy initialization
+//
+// Nothing that touches the disk or the network runs before the first
+// prompt. Each subsystem has an ensure_*() function that initializes it
+// exactly once (pthread_once), called by the code that first needs it:
+//
+//   history     loaded on a background thread started by init_shell(); the
+//               line editor and history commands wait for it if needed
+//   todo/notes  loaded by the todo and note commands
+//   network     curl_global_init() on the first curl handle
+//   dispatch    the builtin hash table, built on the background thread (or
+//               by the first find_builtin(), whichever comes first)
+//   completion  the sorted builtin name index, built on the first Tab
+//
+// `cshell --startup-profile` prints how long each init phase took, up to
+// the first prompt, and then the cost of each lazy step as it happens.
+
+int startup_profile = 0;
+
+#define MAX_PROFILE_PHASES 16
+
+typedef struct {
+    const char *name;
+    double ms;
+} ProfilePhase;
+
+static ProfilePhase profile_phases[MAX_PROFILE_PHASES];
+static int profile_phase_count = 0;
+static struct timespec profile_start;
+static struct timespec profile_last;
+
+static pthread_once_t history_once = PTHREAD_ONCE_INIT;
+static pthread_once_t todo_once = PTHREAD_ONCE_INIT;
+static pthread_once_t notes_once = PTHREAD_ONCE_INIT;
+static pthread_once_t network_once = PTHREAD_ONCE_INIT;
+static pthread_once_t completion_once = PTHREAD_ONCE_INIT;
+
+static const char **completion_names = NULL;
+static int completion_name_count = 0;
+
+static double ms_between(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000.0 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+void startup_profile_begin(void) {
+    clock_gettime(CLOCK_MONOTONIC, &profile_start);
+    profile_last = profile_start;
+}
+
+// Close the current phase, charging the time since the previous mark to it
+void startup_profile_mark(const char *phase) {
+    if (!startup_profile) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (profile_phase_count < MAX_PROFILE_PHASES) {
+        profile_phases[profile_phase_count].name = phase;
+        profile_phases[profile_phase_count].ms = ms_between(&profile_last, &now);
+        profile_phase_count++;
+    }
+    profile_last = now;
+}
+
+// Print the phases recorded so far and the time to the first prompt
+void startup_profile_report(void) {
+    if (!startup_profile) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    fprintf(stderr, "Startup profile:\n");
+    for (int i = 0; i < profile_phase_count; i++) {
+        fprintf(stderr, "  %-20s %9.3f ms\n", profile_phases[i].name, profile_phases[i].ms);
+    }
+    fprintf(stderr, "  %-20s %9.3f ms\n", "first prompt", ms_between(&profile_start, &now));
+}
+
+// Time a lazy initialization step and report it when profiling
+static void run_profiled(const char *name, void (*init)(void)) {
+    struct timespec start, end;
+
+    if (!startup_profile) {
+        init();
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    init();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    fprintf(stderr, "[startup] %s: %.3f ms (at +%.3f ms)\n", name,
+            ms_between(&start, &end), ms_between(&profile_start, &start));
+}
+
+static void init_history(void) {
+    run_profiled("history", load_history);
+}
+
+static void init_todo(void) {
+    run_profiled("todo list", load_todo_list);
+}
+
+static void init_notes(void) {
+    run_profiled("notes", load_notes);
+}
+
+static void load_network(void) {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+}
+
+static void init_network(void) {
+    run_profiled("network", load_network);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static void build_completion_index(void) {
+    int count = 0;
+    while (builtin_commands[count].name != NULL) count++;
+
+    completion_names = malloc(count * sizeof(char *));
+    if (completion_names == NULL) return;
+
+    for (int i = 0; i < count; i++) {
+        completion_names[i] = builtin_commands[i].name;
+    }
+    qsort(completion_names, count, sizeof(char *), compare_names);
+    completion_name_count = count;
+}
+
+static void init_completion(void) {
+    run_profiled("completion index", build_completion_index);
+}
+
+void ensure_history(void) {
+    pthread_once(&history_once, init_history);
+}
+
+void ensure_todo_list(void) {
+    pthread_once(&todo_once, init_todo);
+}
+
+void ensure_notes(void) {
+    pthread_once(&notes_once, init_notes);
+}
+
+void ensure_network(void) {
+    pthread_once(&network_once, init_network);
+}
+
+// Builtin names starting with prefix, in sorted order; returns the count
+// and stores the index of the first match
+int completion_range(const char *prefix, const char ***names, int *first) {
+    pthread_once(&completion_once, init_completion);
+
+    size_t len = strlen(prefix);
+    int lo = 0, hi = completion_name_count;
+
+    // Lower bound of prefix; every match follows it contiguously
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcmp(completion_names[mid], prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    int end = lo;
+    while (end < completion_name_count && strncmp(completion_names[end], prefix, len) == 0) end++;
+
+    *names = completion_names;
+    *first = lo;
+    return end - lo;
+}
+
+static void *background_init(void *arg) {
+    (void)arg;
+    ensure_history();
+    init_builtin_table();
+    return NULL;
+}
+
+// Start loading what the first interactive commands are likely to need
+void start_background_init(void) {
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, background_init, NULL) == 0) {
+        pthread_detach(thread);
+    } else {
+        background_init(NULL);
+    }
+}
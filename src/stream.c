@@ -0,0 +1,287 @@
+#include "cshell.h"
+#include <stdarg.h>
+
+// Builtin stream I/O
+//
+// Builtins that support streams write through sh_printf()/sh_write() and
+// read through shell_in instead of using stdout/stdin directly. Outside a
+// pipeline both are NULL and map onto stdio, so output ordering with plain
+// printf() is unchanged. Inside a pipeline, adjacent stream builtins run in
+// the shell process: each stage writes into a memory buffer that the next
+// stage reads in place, and only the stages next to an external command
+// get a real pipe (an STREAM_FD stream with its own write buffer).
+// Error messages go through sh_perror() to shell_err, which parallel points
+// at a job's own output.
+
+#define STREAM_CHUNK 65536
+
+__thread ShellStream *shell_in = NULL;
+__thread ShellStream *shell_out = NULL;
+__thread ShellStream *shell_err = NULL;
+
+// Read-all buffer for builtins reading the shell's own stdin
+static __thread ShellStream stdin_slurp;
+
+void stream_init_fd(ShellStream *s, int fd) {
+    memset(s, 0, sizeof(*s));
+    s->kind = STREAM_FD;
+    s->fd = fd;
+}
+
+void stream_init_buffer(ShellStream *s) {
+    memset(s, 0, sizeof(*s));
+    s->kind = STREAM_BUFFER;
+    s->fd = -1;
+}
+
+void stream_free(ShellStream *s) {
+    free(s->data);
+    s->data = NULL;
+    s->size = 0;
+    s->capacity = 0;
+    s->read_pos = 0;
+}
+
+// Make room for extra more bytes after the current contents
+static int stream_reserve(ShellStream *s, size_t extra) {
+    if (s->size + extra <= s->capacity) return 1;
+
+    size_t capacity = s->capacity ? s->capacity : STREAM_CHUNK;
+    while (capacity < s->size + extra) capacity *= 2;
+
+    char *data = realloc(s->data, capacity);
+    if (data == NULL) {
+        s->error = 1;
+        return 0;
+    }
+
+    s->data = data;
+    s->capacity = capacity;
+    return 1;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Push buffered output of an fd stream to its descriptor
+int stream_flush(ShellStream *s) {
+    if (s == NULL) {
+        fflush(stdout);
+        return 0;
+    }
+    if (s->kind != STREAM_FD || s->size == 0) return s->error ? -1 : 0;
+
+    // A reader that went away (EPIPE) just makes the rest of the output vanish
+    if (!s->error && write_all(s->fd, s->data, s->size) != 0) {
+        s->error = 1;
+    }
+    s->size = 0;
+
+    return s->error ? -1 : 0;
+}
+
+int stream_write(ShellStream *s, const void *data, size_t len) {
+    if (s == NULL) {
+        return fwrite(data, 1, len, stdout) == len ? 0 : -1;
+    }
+    if (s->error) return -1;
+
+    if (s->kind == STREAM_FD && s->size + len > STREAM_CHUNK) {
+        stream_flush(s);
+        if (len >= STREAM_CHUNK) {
+            if (write_all(s->fd, data, len) != 0) s->error = 1;
+            return s->error ? -1 : 0;
+        }
+    }
+
+    if (!stream_reserve(s, len)) return -1;
+    memcpy(s->data + s->size, data, len);
+    s->size += len;
+
+    return 0;
+}
+
+int stream_vprintf(ShellStream *s, const char *format, va_list ap) {
+    if (s == NULL) {
+        return vprintf(format, ap);
+    }
+    if (s->error) return -1;
+    if (s->kind == STREAM_FD && s->size + 1024 > STREAM_CHUNK) stream_flush(s);
+
+    // Format straight into the stream's buffer, growing it once if needed
+    if (!stream_reserve(s, 256)) return -1;
+
+    va_list retry;
+    va_copy(retry, ap);
+    int n = vsnprintf(s->data + s->size, s->capacity - s->size, format, ap);
+
+    if (n >= 0 && (size_t)n >= s->capacity - s->size) {
+        if (!stream_reserve(s, (size_t)n + 1)) {
+            va_end(retry);
+            return -1;
+        }
+        n = vsnprintf(s->data + s->size, s->capacity - s->size, format, retry);
+    }
+    va_end(retry);
+
+    if (n > 0) s->size += (size_t)n;
+    return n;
+}
+
+int stream_printf(ShellStream *s, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int n = stream_vprintf(s, format, ap);
+    va_end(ap);
+    return n;
+}
+
+// Printf/write to the current builtin output stream
+int sh_printf(const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int n = stream_vprintf(shell_out, format, ap);
+    va_end(ap);
+    return n;
+}
+
+int sh_write(const void *data, size_t len) {
+    return stream_write(shell_out, data, len);
+}
+
+// perror() for stream builtins
+void sh_perror(const char *prefix) {
+    const char *message = strerror(errno);
+    if (shell_err == NULL) {
+        fprintf(stderr, "%s: %s\n", prefix, message);
+    } else {
+        stream_printf(shell_err, "%s: %s\n", prefix, message);
+    }
+}
+
+// Read up to len bytes; returns 0 at end of input
+ssize_t stream_read(ShellStream *s, char *buf, size_t len) {
+    if (s == NULL) {
+        terminal_restore();
+        size_t n = fread(buf, 1, len, stdin);
+        return n > 0 ? (ssize_t)n : (ferror(stdin) ? -1 : 0);
+    }
+
+    // Data already buffered (a builtin's output, or read-ahead from an fd)
+    if (s->read_pos < s->size) {
+        size_t n = s->size - s->read_pos;
+        if (n > len) n = len;
+        memcpy(buf, s->data + s->read_pos, n);
+        s->read_pos += n;
+        return (ssize_t)n;
+    }
+
+    if (s->kind != STREAM_FD) return 0;
+
+    ssize_t n;
+    do {
+        n = read(s->fd, buf, len);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+// Return all remaining input as one contiguous block. For buffer streams
+// this is the previous stage's output in place; nothing is copied.
+const char *stream_read_all(ShellStream *s, size_t *len) {
+    if (s == NULL) {
+        terminal_restore();
+        s = &stdin_slurp;
+        stream_free(s);
+        stream_init_buffer(s);
+
+        // Go through stdio so input it has already buffered is not lost
+        size_t n;
+        while (stream_reserve(s, STREAM_CHUNK) &&
+               (n = fread(s->data + s->size, 1, s->capacity - s->size, stdin)) > 0) {
+            s->size += n;
+        }
+    } else if (s->kind == STREAM_FD) {
+        for (;;) {
+            if (!stream_reserve(s, STREAM_CHUNK)) break;
+
+            ssize_t n = read(s->fd, s->data + s->size, s->capacity - s->size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            s->size += (size_t)n;
+        }
+    }
+
+    *len = s->size - s->read_pos;
+    const char *data = s->data ? s->data + s->read_pos : "";
+    s->read_pos = s->size;
+
+    return data;
+}
+
+// Copy everything left in `in` to `out`. When one in-process stage feeds
+// another, the buffer itself changes hands instead of being copied.
+int stream_forward(ShellStream *in, ShellStream *out) {
+    if (in != NULL && out != NULL && in->kind == STREAM_BUFFER &&
+        out->kind == STREAM_BUFFER && out->size == 0) {
+        free(out->data);
+        out->data = in->data;
+        out->size = in->size;
+        out->capacity = in->capacity;
+        out->read_pos = in->read_pos;
+
+        in->data = NULL;
+        in->size = in->capacity = in->read_pos = 0;
+        return 0;
+    }
+
+    char buffer[STREAM_CHUNK];
+    ssize_t n;
+    while ((n = stream_read(in, buffer, sizeof(buffer))) > 0) {
+        if (stream_write(out, buffer, (size_t)n) != 0) return -1;
+    }
+
+    return n < 0 ? -1 : 0;
+}
+
+// Copy an open file to `out`, reading straight into the output buffer
+int stream_write_file(ShellStream *out, FILE *file) {
+    if (out == NULL) {
+        char buffer[STREAM_CHUNK];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            fwrite(buffer, 1, n, stdout);
+        }
+        return ferror(file) ? -1 : 0;
+    }
+
+    for (;;) {
+        if (out->kind == STREAM_FD && out->size >= STREAM_CHUNK / 2) stream_flush(out);
+        if (!stream_reserve(out, STREAM_CHUNK / 2)) return -1;
+
+        size_t n = fread(out->data + out->size, 1, out->capacity - out->size, file);
+        if (n == 0) break;
+        out->size += n;
+    }
+
+    return ferror(file) ? -1 : 0;
+}
+
+// True when the current builtin's input comes from a pipe or redirection
+int stream_input_is_piped(void) {
+    return shell_in != NULL || !isatty(STDIN_FILENO);
+}
+
+// True when the current builtin's output goes straight to a terminal
+int stream_output_is_terminal(void) {
+    return shell_out == NULL && isatty(STDOUT_FILENO);
+}
@@ -0,0 +1,259 @@
+#include "cshell.h"
+#include <stdatomic.h>
+#include <sys/syscall.h>
+
+// Trace-event export
+//
+// `debug trace out.json` records a span for every phase of each command
+// (input, history save, tokenize, builtin lookup, spawn, wait, network
+// transfers) and writes them as Chrome trace-event JSON, which chrome://tracing
+// and Perfetto load directly.
+//
+// Recording must not slow the shell down, so each thread appends to its own
+// single-producer/single-consumer ring with one release store and no lock.
+// A flusher thread drains all rings every TRACE_FLUSH_MS into the file. When
+// a ring is full, events are dropped and counted rather than blocking. Rings
+// of threads that exit are freed by the flusher once drained.
+
+#ifndef _WIN32
+
+#define TRACE_RING_SIZE 4096        // Events per thread; a power of two
+#define MAX_TRACE_THREADS 64
+#define TRACE_FLUSH_MS 100
+#define TRACE_DETAIL_LENGTH 48
+
+typedef struct {
+    const char *name;               // Static strings only
+    uint64_t ts;
+    uint64_t dur;
+    char detail[TRACE_DETAIL_LENGTH];
+} TraceEvent;
+
+typedef struct {
+    TraceEvent events[TRACE_RING_SIZE];
+    _Atomic unsigned long head;     // Written by the owning thread
+    _Atomic unsigned long tail;     // Written by the flusher
+    _Atomic int orphaned;           // The owning thread has exited
+    pid_t tid;
+} TraceRing;
+
+atomic_int trace_enabled = 0;
+
+static _Atomic(TraceRing *) trace_rings[MAX_TRACE_THREADS];
+static __thread TraceRing *thread_ring = NULL;
+static pthread_key_t trace_ring_key;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static atomic_ulong trace_dropped = 0;
+
+static FILE *trace_file = NULL;
+static int trace_first_event = 1;
+static pthread_t trace_flusher;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;    // Guards trace_file
+static atomic_int trace_stopping = 0;
+
+static uint64_t trace_clock_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static void release_ring(void *ring) {
+    atomic_store_explicit(&((TraceRing *)ring)->orphaned, 1, memory_order_release);
+}
+
+static void create_ring_key(void) {
+    pthread_key_create(&trace_ring_key, release_ring);
+}
+
+// Give the calling thread a ring; NULL if every slot is taken
+static TraceRing *register_ring(void) {
+    pthread_once(&trace_key_once, create_ring_key);
+
+    TraceRing *ring = calloc(1, sizeof(TraceRing));
+    if (ring == NULL) return NULL;
+    ring->tid = (pid_t)syscall(SYS_gettid);
+
+    for (int i = 0; i < MAX_TRACE_THREADS; i++) {
+        TraceRing *expected = NULL;
+        if (atomic_compare_exchange_strong(&trace_rings[i], &expected, ring)) {
+            pthread_setspecific(trace_ring_key, ring);
+            thread_ring = ring;
+            return ring;
+        }
+    }
+
+    free(ring);
+    return NULL;
+}
+
+// Start time for a span, or 0 when tracing is off
+uint64_t trace_start(void) {
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) return 0;
+    return trace_clock_us();
+}
+
+// Record a complete span from start until now
+void trace_span(const char *name, uint64_t start, const char *detail) {
+    if (start == 0) return;
+
+    uint64_t end = trace_clock_us();
+    TraceRing *ring = thread_ring != NULL ? thread_ring : register_ring();
+    if (ring == NULL) {
+        atomic_fetch_add(&trace_dropped, 1);
+        return;
+    }
+
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= TRACE_RING_SIZE) {
+        atomic_fetch_add(&trace_dropped, 1);
+        return;
+    }
+
+    TraceEvent *event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+    event->name = name;
+    event->ts = start;
+    event->dur = end - start;
+    if (detail != NULL) snprintf(event->detail, sizeof(event->detail), "%s", detail);
+    else event->detail[0] = '\0';
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Write a string as a JSON string literal
+static void write_json_string(FILE *file, const char *s) {
+    fputc('"', file);
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(file, "\\%c", c);
+        else if (c < 0x20) fprintf(file, "\\u%04x", c);
+        else fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+// Move every recorded event into the file; called with trace_lock held
+static void drain_rings(void) {
+    pid_t pid = getpid();
+
+    for (int i = 0; i < MAX_TRACE_THREADS; i++) {
+        TraceRing *ring = atomic_load(&trace_rings[i]);
+        if (ring == NULL) continue;
+
+        // Read orphaned first: once set, no more events can arrive
+        int orphaned = atomic_load_explicit(&ring->orphaned, memory_order_acquire);
+        unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        for (; tail != head; tail++) {
+            TraceEvent *event = &ring->events[tail & (TRACE_RING_SIZE - 1)];
+
+            if (trace_file != NULL) {
+                fprintf(trace_file, "%s\n{\"name\":", trace_first_event ? "" : ",");
+                write_json_string(trace_file, event->name);
+                fprintf(trace_file, ",\"cat\":\"cshell\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d",
+                        (unsigned long long)event->ts, (unsigned long long)event->dur, (int)pid, (int)ring->tid);
+                if (event->detail[0] != '\0') {
+                    fprintf(trace_file, ",\"args\":{\"detail\":");
+                    write_json_string(trace_file, event->detail);
+                    fputc('}', trace_file);
+                }
+                fputc('}', trace_file);
+                trace_first_event = 0;
+            }
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        if (orphaned) {
+            atomic_store(&trace_rings[i], NULL);
+            free(ring);
+        }
+    }
+
+    if (trace_file != NULL) fflush(trace_file);
+}
+
+static void *trace_flush_loop(void *arg) {
+    (void)arg;
+    struct timespec interval = {0, TRACE_FLUSH_MS * 1000000L};
+
+    while (!atomic_load(&trace_stopping)) {
+        nanosleep(&interval, NULL);
+        pthread_mutex_lock(&trace_lock);
+        drain_rings();
+        pthread_mutex_unlock(&trace_lock);
+    }
+
+    return NULL;
+}
+
+// Start writing trace events to path; returns 0 on success
+int trace_open(const char *path) {
+    if (trace_file != NULL) trace_close();
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    // Events left over from an earlier trace are discarded
+    trace_file = NULL;
+    drain_rings();
+    trace_file = file;
+    trace_first_event = 1;
+    fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    pthread_mutex_unlock(&trace_lock);
+
+    atomic_store(&trace_stopping, 0);
+    atomic_store(&trace_dropped, 0);
+    if (pthread_create(&trace_flusher, NULL, trace_flush_loop, NULL) != 0) {
+        perror("pthread_create");
+        fclose(file);
+        trace_file = NULL;
+        return -1;
+    }
+
+    atomic_store(&trace_enabled, 1);
+    return 0;
+}
+
+// Stop tracing, flush what is left and finish the JSON document
+void trace_close(void) {
+    if (trace_file == NULL) return;
+
+    atomic_store(&trace_enabled, 0);
+    atomic_store(&trace_stopping, 1);
+    pthread_join(trace_flusher, NULL);
+
+    pthread_mutex_lock(&trace_lock);
+    drain_rings();
+    fprintf(trace_file, "\n]}\n");
+    fclose(trace_file);
+    trace_file = NULL;
+    pthread_mutex_unlock(&trace_lock);
+
+    unsigned long dropped = atomic_load(&trace_dropped);
+    if (dropped > 0) {
+        printf("Trace: %lu events dropped (ring full)\n", dropped);
+    }
+}
+
+int trace_active(void) {
+    return trace_file != NULL;
+}
+
+#else
+
+uint64_t trace_start(void) { return 0; }
+void trace_span(const char *name, uint64_t start, const char *detail) { (void)name; (void)start; (void)detail; }
+int trace_open(const char *path) {
+    (void)path;
+    printf("Tracing is not supported on Windows\n");
+    return -1;
+}
+void trace_close(void) {}
+int trace_active(void) { return 0; }
+
+#endif
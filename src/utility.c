@@ -5,19 +5,31 @@
 #include <shellapi.h>
 #endif
 
+#define RESPONSE_INITIAL_SIZE 4096
+
+// Start an empty response buffer in the per-command arena
+void response_init(ResponseData *response) {
+    response->data = arena_alloc(RESPONSE_INITIAL_SIZE);
+    response->data[0] = '\0';
+    response->size = 0;
+    response->capacity = RESPONSE_INITIAL_SIZE;
+}
+
 // Curl callback function to handle response data
 size_t curl_callback(void *contents, size_t size, size_t nmemb, void *userp) {
     size_t realsize = size * nmemb;
     ResponseData *response = (ResponseData *)userp;
 
-    // Allocate or resize the memory for the response data
-    char *ptr = realloc(response->data, response->size + realsize + 1);
-    if (ptr == NULL) {
-        fprintf(stderr, "Error: Not enough memory to store response\n");
-        return 0;
+    // Grow geometrically; the buffer is usually the arena's newest
+    // allocation, so this extends it in place without copying
+    if (response->size + realsize + 1 > response->capacity) {
+        size_t capacity = response->capacity ? response->capacity : RESPONSE_INITIAL_SIZE;
+        while (capacity < response->size + realsize + 1) capacity *= 2;
+
+        response->data = arena_grow(response->data, response->size + 1, capacity);
+        response->capacity = capacity;
     }
 
-    response->data = ptr;
     memcpy(&(response->data[response->size]), contents, realsize);
     response->size += realsize;
     response->data[response->size] = 0;
@@ -25,6 +37,41 @@ size_t curl_callback(void *contents, size_t size, size_t nmemb, void *userp) {
     return realsize;
 }
 
+// Shared curl state (DNS cache, TLS sessions, connections); NULL until a
+// long-running shell sets it up with init_curl_share()
+static CURLSH *curl_share = NULL;
+
+void init_curl_share(void) {
+    if (curl_share != NULL) return;
+
+    ensure_network();
+    curl_share = curl_share_init();
+    if (curl_share != NULL) {
+        curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+}
+
+// curl_easy_init() attached to the shared state, if there is any
+CURL *shell_curl_init(void) {
+    ensure_network();
+
+    CURL *curl = curl_easy_init();
+    if (curl != NULL && curl_share != NULL) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, curl_share);
+    }
+    return curl;
+}
+
+// curl_easy_perform() as a "network" trace span
+CURLcode shell_curl_perform(CURL *curl, const char *url) {
+    uint64_t start = trace_start();
+    CURLcode res = curl_easy_perform(curl);
+    trace_span("network", start, url);
+    return res;
+}
+
 // Open a URL in the default browser
 int open_url_in_browser(const char *url) {
 #ifdef _WIN32
@@ -0,0 +1,1002 @@
+#include "cshell.h"
+
+// Script compiler and VM
+//
+// Every command line and script is compiled into a small program before it
+// runs. compile_program() lexes the whole text once, parses its statements
+//
+//   if LIST; then LIST; [elif LIST; then LIST;]... [else LIST;] fi
+//   while LIST; do LIST; done        until LIST; do LIST; done
+//   for NAME [in WORDS...]; do LIST; done
+//   NAME() { LIST; }                 function NAME { LIST; }
+//   { LIST; }   ! STATEMENT   break   continue   return [STATUS]
+//
+// (statements end at ';', '&' or a newline; a condition holds when its last
+// command exits 0) and emits a flat array of instructions that
+// run_program() executes in one loop. Functions get their arguments as $1,
+// $2, ..., $# and $@; variables are shared with the rest of the shell.
+//
+// The words of each simple command are lexed and prepared once, at compile
+// time (prepare_tokens()): words without $ or a pattern already have their
+// final text, so running the command again only expands what can change.
+// A literal builtin name is bound to its builtin_commands[] entry then; with
+// only literal words the command is a BUILTIN instruction that calls it
+// with a ready-made argv. A call to a function defined earlier in the same
+// program is bound to its entry point. Everything else goes through
+// execute_pipeline(), which also means functions cannot be piped or
+// redirected. A loop body is therefore lexed once, however often it runs.
+//
+// Programs live in malloc'd memory with their own copy of the source,
+// because the per-command arena is reset after every top-level command the
+// VM runs (a long loop would grow it without bound otherwise). Loop word
+// lists and function arguments, which outlive a command, are malloc'd too.
+// A program run from $(...) is nested inside a command and leaves the arena
+// alone.
+
+#define VM_MAX_CALL_DEPTH 1000
+
+// Results of compile_list() besides a terminator index
+#define LIST_END (-1)           // End of input outside any compound statement
+#define LIST_ERROR (-2)
+
+typedef enum {
+    OP_RUN,             // Expand and run command a
+    OP_BUILTIN,         // Call the bound builtin of command a with its ready-made argv
+    OP_CALL,            // Call function a of this program with the words of command b
+    OP_DEFINE,          // Make function a of this program callable by name
+    OP_RETURN,          // Return from a function, with the status in command a (-1: keep)
+    OP_JUMP,            // Continue at a
+    OP_JUMP_FALSE,      // Continue at a if the last command failed
+    OP_NOT,             // Invert the exit status
+    OP_STATUS,          // Set the exit status to a
+    OP_FOR_BEGIN,       // Start a loop over the words of command a (-1: the arguments)
+    OP_FOR_NEXT,        // Set variable command b to the next word, or continue at a
+    OP_WHILE_BEGIN,     // Start a while or until loop whose condition is at a
+    OP_WHILE_NEXT,      // Keep the status of the body that just ran
+    OP_WHILE_TEST,      // Leave the loop for a unless the status is 0 (b: until, nonzero)
+    OP_LOOP_END,        // Drop the innermost loop
+    OP_END
+} OpCode;
+
+typedef struct {
+    int op;
+    int a;
+    int b;
+} Instruction;
+
+// A simple command: a run of tokens up to a separator
+typedef struct {
+    int first;                  // Index of its first token
+    int count;
+    int assignments;            // Leading NAME=value words assign
+    int has_operators;          // Pipes, redirections or &
+    int bindable;               // Its name is not a function when compiled
+    size_t text_offset;         // Into the source as written
+    size_t text_length;
+    BuiltinCommand *builtin;    // A literal builtin name
+    char **argv;                // Ready-made when no word needs expanding
+} Command;
+
+typedef struct {
+    char *name;
+    int entry;
+} FunctionDef;
+
+struct Program {
+    char *text;                 // The source as written
+    char *source;               // A copy the tokens point into, prepared in place
+    int multiline;
+    Token *tokens;
+    int token_count;
+    Instruction *code;
+    int code_count;
+    int code_capacity;
+    Command *commands;
+    int command_count;
+    int command_capacity;
+    FunctionDef *functions;
+    int function_count;
+    int function_capacity;
+    int refs;                   // The owner, defined functions and running calls
+};
+
+typedef struct {
+    Program *program;
+    const Token *tokens;
+    int count;
+    int pos;
+    int *breaks;                // Jumps to patch to the end of the current loop
+    int break_count;
+    int break_capacity;
+    int *ends;                  // Jumps to patch to the end of the current if
+    int end_count;
+    int end_capacity;
+    int loop_depth;
+    int function_depth;
+    int continue_target;
+    int quiet;                  // The caller reports problems itself
+    int failed;                 // An error, not just input that stops early
+    size_t complete;            // Length of the complete top-level statements
+} Compiler;
+
+// Functions by name, across programs
+typedef struct {
+    const char *name;           // Owned by program
+    Program *program;
+    int entry;
+} ShellFunction;
+
+static ShellFunction *shell_functions;
+static int shell_function_count;
+static int shell_function_capacity;
+static unsigned shell_function_generation;   // Definitions so far
+
+// Nested run_program() calls: 1 is a top-level command line or script
+static int vm_depth;
+
+static void *grow_array(void *array, int *capacity, int count, size_t size) {
+    if (count < *capacity) return array;
+
+    int grown = *capacity ? *capacity * 2 : 16;
+    void *bigger = realloc(array, (size_t)grown * size);
+    if (bigger == NULL) {
+        printf("Error: Memory allocation failed\n");
+        exit(1);
+    }
+    *capacity = grown;
+    return bigger;
+}
+
+static ShellFunction *find_function(const char *name) {
+    for (int i = 0; i < shell_function_count; i++) {
+        if (strcmp(shell_functions[i].name, name) == 0) return &shell_functions[i];
+    }
+    return NULL;
+}
+
+// --- Compiler ---
+
+static const Token *peek(Compiler *c) {
+    return c->pos < c->count ? &c->tokens[c->pos] : NULL;
+}
+
+static int at_statement_end(Compiler *c) {
+    const Token *t = peek(c);
+    return t == NULL || t->kind == TOKEN_SEPARATOR;
+}
+
+// A plain, unquoted word with exactly this text
+static int is_word(const Token *t, const char *word) {
+    size_t length = strlen(word);
+    return t != NULL && t->kind == TOKEN_WORD && t->flags == 0 && t->length == length &&
+           memcmp(t->start, word, length) == 0;
+}
+
+static int is_name(const char *word, size_t length) {
+    if (length == 0 || !(isalpha((unsigned char)word[0]) || word[0] == '_')) return 0;
+    for (size_t i = 1; i < length; i++) {
+        if (!(isalnum((unsigned char)word[i]) || word[i] == '_')) return 0;
+    }
+    return 1;
+}
+
+static void skip_separators(Compiler *c) {
+    while (c->pos < c->count && c->tokens[c->pos].kind == TOKEN_SEPARATOR) c->pos++;
+}
+
+static int line_of(Compiler *c, const Token *t) {
+    int line = 1;
+    for (const char *p = c->program->source; p < t->start; p++) {
+        if (*p == '\n') line++;
+    }
+    return line;
+}
+
+// Report an error at the current token; returns LIST_ERROR
+static int compile_error(Compiler *c, const char *message) {
+    const Token *t = peek(c);
+
+    c->failed = 1;
+    if (c->quiet) return LIST_ERROR;
+
+    printf("Error: ");
+    if (t != NULL && c->program->multiline) printf("line %d: ", line_of(c, t));
+    if (t == NULL) {
+        printf("%s at end of input\n", message);
+    } else if (t->kind == TOKEN_SEPARATOR) {
+        printf("%s near '%s'\n", message, *t->start == ';' ? ";" : "newline");
+    } else {
+        printf("%s near '%.*s'\n", message, (int)t->length, t->start);
+    }
+    return LIST_ERROR;
+}
+
+// Input ended inside a compound statement
+static int unexpected_end(Compiler *c, const char *expected) {
+    if (!c->quiet) printf("Error: unexpected end of input, expected '%s'\n", expected);
+    return LIST_ERROR;
+}
+
+static int emit(Compiler *c, int op, int a, int b) {
+    Program *p = c->program;
+    p->code = grow_array(p->code, &p->code_capacity, p->code_count, sizeof(Instruction));
+    p->code[p->code_count] = (Instruction){op, a, b};
+    return p->code_count++;
+}
+
+static void patch(Compiler *c, int at, int target) {
+    c->program->code[at].a = target;
+}
+
+static int here(Compiler *c) {
+    return c->program->code_count;
+}
+
+static int add_command(Compiler *c, int first, int count, int assignments) {
+    Program *p = c->program;
+    p->commands = grow_array(p->commands, &p->command_capacity, p->command_count, sizeof(Command));
+
+    Command *cmd = &p->commands[p->command_count];
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->first = first;
+    cmd->count = count;
+    cmd->assignments = assignments;
+    for (int i = first; i < first + count; i++) {
+        if (c->tokens[i].kind != TOKEN_WORD) cmd->has_operators = 1;
+    }
+    if (count > 0) {
+        const Token *last = &c->tokens[first + count - 1];
+        cmd->text_offset = (size_t)(c->tokens[first].start - p->source);
+        cmd->text_length = (size_t)(last->start + last->length - c->tokens[first].start);
+    }
+    return p->command_count++;
+}
+
+// A function of this program whose definition has been compiled already
+static int local_function(Compiler *c, const Token *t) {
+    Program *p = c->program;
+    for (int i = p->function_count - 1; i >= 0; i--) {
+        if (strlen(p->functions[i].name) == t->length && memcmp(p->functions[i].name, t->start, t->length) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int compile_list(Compiler *c, const char *const *terminators);
+
+static int compile_simple_command(Compiler *c) {
+    int first = c->pos;
+
+    // A & ends the command as well, so `a & b` starts b right away
+    while (!at_statement_end(c)) {
+        if (c->tokens[c->pos++].kind == TOKEN_BACKGROUND) break;
+    }
+
+    int index = add_command(c, first, c->pos - first, 1);
+    Command *cmd = &c->program->commands[index];
+    const Token *name = &c->tokens[first];
+
+    if (name->kind == TOKEN_WORD && name->flags == 0 && !cmd->has_operators) {
+        int function = local_function(c, name);
+        if (function >= 0) {
+            emit(c, OP_CALL, function, index);
+            return 0;
+        }
+
+        char *text = arena_printf("%.*s", (int)name->length, name->start);
+        cmd->bindable = find_function(text) == NULL;
+    }
+
+    emit(c, OP_RUN, index, 0);
+    return 0;
+}
+
+// After a compound statement only a separator may follow
+static int end_statement(Compiler *c) {
+    return at_statement_end(c) ? 0 : compile_error(c, "syntax error");
+}
+
+static int compile_if(Compiler *c) {
+    static const char *const then_word[] = {"then", NULL};
+    static const char *const branch_end[] = {"elif", "else", "fi", NULL};
+    static const char *const fi_word[] = {"fi", NULL};
+    int first_end = c->end_count;
+
+    c->pos++;
+    for (;;) {
+        if (compile_list(c, then_word) < 0) return LIST_ERROR;
+        int skip = emit(c, OP_JUMP_FALSE, 0, 0);
+
+        int found = compile_list(c, branch_end);
+        if (found < 0) return LIST_ERROR;
+
+        c->ends = grow_array(c->ends, &c->end_capacity, c->end_count, sizeof(int));
+        c->ends[c->end_count++] = emit(c, OP_JUMP, 0, 0);
+        patch(c, skip, here(c));
+
+        if (found == 1) {
+            if (compile_list(c, fi_word) < 0) return LIST_ERROR;
+            break;
+        }
+        if (found == 2) {
+            // No branch taken
+            emit(c, OP_STATUS, 0, 0);
+            break;
+        }
+    }
+
+    for (int i = first_end; i < c->end_count; i++) patch(c, c->ends[i], here(c));
+    c->end_count = first_end;
+    return end_statement(c);
+}
+
+// Compile a loop body up to done; breaks go to the code emitted by the caller
+// right after it returns
+static int compile_loop_body(Compiler *c, int continue_target, int *first_break) {
+    static const char *const done_word[] = {"done", NULL};
+
+    int saved_continue = c->continue_target;
+    *first_break = c->break_count;
+    c->continue_target = continue_target;
+    c->loop_depth++;
+
+    int found = compile_list(c, done_word);
+
+    c->loop_depth--;
+    c->continue_target = saved_continue;
+    return found < 0 ? LIST_ERROR : 0;
+}
+
+static void patch_breaks(Compiler *c, int first_break) {
+    for (int i = first_break; i < c->break_count; i++) patch(c, c->breaks[i], here(c));
+    c->break_count = first_break;
+}
+
+static int compile_while(Compiler *c, int until) {
+    static const char *const do_word[] = {"do", NULL};
+    int first_break;
+
+    c->pos++;
+    int begin = emit(c, OP_WHILE_BEGIN, 0, 0);
+    int top = emit(c, OP_WHILE_NEXT, 0, 0);
+    patch(c, begin, here(c));
+    if (compile_list(c, do_word) < 0) return LIST_ERROR;
+    int exit_test = emit(c, OP_WHILE_TEST, 0, until);
+
+    if (compile_loop_body(c, top, &first_break) < 0) return LIST_ERROR;
+    emit(c, OP_JUMP, top, 0);
+
+    patch(c, exit_test, here(c));
+    patch_breaks(c, first_break);
+    emit(c, OP_LOOP_END, 0, 0);
+    return end_statement(c);
+}
+
+static int compile_for(Compiler *c) {
+    int first_break;
+
+    c->pos++;
+    const Token *name = peek(c);
+    if (name == NULL) return unexpected_end(c, "do");
+    if (name->kind != TOKEN_WORD || name->flags != 0 || !is_name(name->start, name->length)) {
+        return compile_error(c, "bad for loop variable");
+    }
+    int variable = add_command(c, c->pos++, 1, 0);
+
+    // Without "in WORDS" the loop goes over the arguments
+    int words = -1;
+    if (is_word(peek(c), "in")) {
+        int first = ++c->pos;
+        while (!at_statement_end(c)) c->pos++;
+        words = add_command(c, first, c->pos - first, 0);
+    }
+
+    skip_separators(c);
+    if (peek(c) == NULL) return unexpected_end(c, "do");
+    if (!is_word(peek(c), "do")) return compile_error(c, "syntax error");
+    c->pos++;
+
+    emit(c, OP_FOR_BEGIN, words, 0);
+    int next = emit(c, OP_FOR_NEXT, 0, variable);
+    if (compile_loop_body(c, next, &first_break) < 0) return LIST_ERROR;
+    emit(c, OP_JUMP, next, 0);
+
+    patch(c, next, here(c));
+    patch_breaks(c, first_break);
+    emit(c, OP_LOOP_END, 0, 0);
+    return end_statement(c);
+}
+
+// The body of NAME() { ... }, from the '{' on
+static int compile_function(Compiler *c, const char *name, size_t length) {
+    static const char *const close_brace[] = {"}", NULL};
+    Program *p = c->program;
+
+    skip_separators(c);
+    if (peek(c) == NULL) return unexpected_end(c, "{");
+    if (!is_word(peek(c), "{")) return compile_error(c, "syntax error");
+    c->pos++;
+
+    // Registered before its body is compiled, so it can call itself
+    p->functions = grow_array(p->functions, &p->function_capacity, p->function_count, sizeof(FunctionDef));
+    int index = p->function_count++;
+    p->functions[index].name = strndup(name, length);
+    if (p->functions[index].name == NULL) {
+        printf("Error: Memory allocation failed\n");
+        exit(1);
+    }
+
+    emit(c, OP_DEFINE, index, 0);
+    int skip = emit(c, OP_JUMP, 0, 0);
+    p->functions[index].entry = here(c);
+
+    // Loops around the definition are not loops of the body
+    int saved_loops = c->loop_depth;
+    c->loop_depth = 0;
+    c->function_depth++;
+    int found = compile_list(c, close_brace);
+    c->function_depth--;
+    c->loop_depth = saved_loops;
+    if (found < 0) return LIST_ERROR;
+
+    emit(c, OP_RETURN, -1, 0);
+    patch(c, skip, here(c));
+    return end_statement(c);
+}
+
+static int compile_statement(Compiler *c) {
+    static const char *const reserved[] = {"then", "elif", "else", "fi", "do", "done", "}", NULL};
+    static const char *const close_brace[] = {"}", NULL};
+    const Token *t = peek(c);
+
+    for (int i = 0; reserved[i] != NULL; i++) {
+        if (is_word(t, reserved[i])) return compile_error(c, "syntax error");
+    }
+
+    if (is_word(t, "!")) {
+        c->pos++;
+        if (at_statement_end(c)) return compile_error(c, "syntax error");
+        if (compile_statement(c) < 0) return LIST_ERROR;
+        emit(c, OP_NOT, 0, 0);
+        return 0;
+    }
+    if (is_word(t, "if")) return compile_if(c);
+    if (is_word(t, "while")) return compile_while(c, 0);
+    if (is_word(t, "until")) return compile_while(c, 1);
+    if (is_word(t, "for")) return compile_for(c);
+
+    if (is_word(t, "{")) {
+        c->pos++;
+        if (compile_list(c, close_brace) < 0) return LIST_ERROR;
+        return end_statement(c);
+    }
+
+    if (is_word(t, "break") || is_word(t, "continue")) {
+        if (c->loop_depth == 0) return compile_error(c, "not in a loop");
+        c->pos++;
+        if (!at_statement_end(c)) return compile_error(c, "syntax error");
+
+        if (t->length == 5) {
+            c->breaks = grow_array(c->breaks, &c->break_capacity, c->break_count, sizeof(int));
+            c->breaks[c->break_count++] = emit(c, OP_JUMP, 0, 0);
+        } else {
+            emit(c, OP_JUMP, c->continue_target, 0);
+        }
+        return 0;
+    }
+
+    if (is_word(t, "return")) {
+        if (c->function_depth == 0) return compile_error(c, "not in a function");
+        int first = ++c->pos;
+        while (!at_statement_end(c)) c->pos++;
+        emit(c, OP_RETURN, c->pos > first ? add_command(c, first, c->pos - first, 0) : -1, 0);
+        return 0;
+    }
+
+    if (is_word(t, "function")) {
+        c->pos++;
+        const Token *name = peek(c);
+        if (name == NULL) return unexpected_end(c, "{");
+        size_t length = name->length;
+        if (name->kind == TOKEN_WORD && name->flags == 0 && length > 2 && memcmp(name->start + length - 2, "()", 2) == 0) {
+            length -= 2;
+        }
+        if (name->kind != TOKEN_WORD || name->flags != 0 || !is_name(name->start, length)) {
+            return compile_error(c, "bad function name");
+        }
+        c->pos++;
+        if (is_word(peek(c), "()")) c->pos++;
+        return compile_function(c, name->start, length);
+    }
+
+    // NAME() { ... } or NAME () { ... }
+    if (t->kind == TOKEN_WORD && t->flags == 0) {
+        if (t->length > 2 && memcmp(t->start + t->length - 2, "()", 2) == 0 && is_name(t->start, t->length - 2)) {
+            c->pos++;
+            return compile_function(c, t->start, t->length - 2);
+        }
+        if (is_name(t->start, t->length) && is_word(c->pos + 1 < c->count ? t + 1 : NULL, "()")) {
+            c->pos += 2;
+            return compile_function(c, t->start, t->length);
+        }
+    }
+
+    return compile_simple_command(c);
+}
+
+// Compile statements until one starts with a word of terminators (a
+// NULL-terminated list, or NULL at the top level). Returns the index of
+// that word, which is consumed, LIST_END at the end of the top level, or
+// LIST_ERROR.
+static int compile_list(Compiler *c, const char *const *terminators) {
+    for (;;) {
+        skip_separators(c);
+        const Token *t = peek(c);
+
+        if (t == NULL) {
+            if (terminators != NULL) {
+                int last = 0;
+                while (terminators[last + 1] != NULL) last++;
+                return unexpected_end(c, terminators[last]);
+            }
+            c->complete = strlen(c->program->text);
+            return LIST_END;
+        }
+
+        for (int i = 0; terminators != NULL && terminators[i] != NULL; i++) {
+            if (is_word(t, terminators[i])) {
+                c->pos++;
+                return i;
+            }
+        }
+
+        if (compile_statement(c) < 0) return LIST_ERROR;
+
+        // Everything up to here can run while the rest is still being read
+        if (terminators == NULL) {
+            const Token *end = peek(c);
+            c->complete = end == NULL ? strlen(c->program->text) : (size_t)(end->start + end->length - c->program->source);
+        }
+    }
+}
+
+// Prepare every command's words and bind what can be bound
+static void link_program(Program *p) {
+    for (int i = 0; i < p->command_count; i++) {
+        Command *cmd = &p->commands[i];
+        prepare_tokens(&p->tokens[cmd->first], cmd->count, cmd->assignments);
+    }
+
+    for (int i = 0; i < p->code_count; i++) {
+        if (p->code[i].op != OP_RUN) continue;
+
+        Command *cmd = &p->commands[p->code[i].a];
+        if (!cmd->bindable) continue;
+
+        const Token *tokens = &p->tokens[cmd->first];
+        if (tokens[0].flags != 0) continue;
+        cmd->builtin = find_builtin(tokens[0].start);
+        if (cmd->builtin == NULL) continue;
+
+        int literal = 1;
+        for (int t = 1; t < cmd->count; t++) {
+            if (tokens[t].flags != 0) literal = 0;
+        }
+        if (!literal) continue;
+
+        cmd->argv = malloc((size_t)(cmd->count + 1) * sizeof(char *));
+        if (cmd->argv == NULL) continue;
+        for (int t = 0; t < cmd->count; t++) cmd->argv[t] = (char *)tokens[t].start;
+        cmd->argv[cmd->count] = NULL;
+        p->code[i].op = OP_BUILTIN;
+    }
+}
+
+// Changes whenever a function is defined, which can change how a
+// command name compiles
+unsigned function_generation(void) {
+    return shell_function_generation;
+}
+
+Program *retain_program(Program *p) {
+    p->refs++;
+    return p;
+}
+
+void free_program(Program *p) {
+    if (p == NULL || --p->refs > 0) return;
+
+    for (int i = 0; i < p->command_count; i++) free(p->commands[i].argv);
+    for (int i = 0; i < p->function_count; i++) free(p->functions[i].name);
+    free(p->commands);
+    free(p->functions);
+    free(p->code);
+    free(p->tokens);
+    free(p->source);
+    free(p->text);
+    free(p);
+}
+
+static void *vm_alloc(size_t size) {
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == NULL) {
+        printf("Error: Memory allocation failed\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static Program *new_program(const char *source, size_t length) {
+    Program *p = vm_alloc(sizeof(Program));
+    memset(p, 0, sizeof(*p));
+
+    p->text = vm_alloc(length + 1);
+    memcpy(p->text, source, length);
+    p->text[length] = '\0';
+    p->source = vm_alloc(length + 1);
+    memcpy(p->source, source, length);
+    p->source[length] = '\0';
+
+    // A final newline alone does not make line numbers worth reporting
+    const char *newline = memchr(source, '\n', length);
+    p->multiline = newline != NULL && newline < source + length - 1;
+    p->refs = 1;
+    return p;
+}
+
+// Compile a command line or script. Returns NULL after reporting an error.
+//
+// A caller still reading its input passes complete, and nothing is
+// reported: the text may just stop in the middle of a statement or quote.
+// NULL then comes with *complete set to the length of the whole statements
+// before the problem, which can run while more is read - 0 if there are
+// none - or COMPILE_FAILED for an error in the first statement. Compiling
+// that text again without complete reports the error.
+Program *compile_program(const char *source, size_t length, size_t *complete) {
+    Program *p = new_program(source, length);
+
+    Token *tokens;
+    const char *error;
+    int count = lex_command(p->source, length, &tokens, &error);
+    if (count < 0) {
+        if (complete != NULL) *complete = 0;
+        else printf("Error: %s\n", error);
+        free_program(p);
+        return NULL;
+    }
+
+    // The arena token array would not survive the next command
+    p->tokens = vm_alloc((size_t)count * sizeof(Token));
+    memcpy(p->tokens, tokens, (size_t)count * sizeof(Token));
+    p->token_count = count;
+
+    Compiler c;
+    memset(&c, 0, sizeof(c));
+    c.program = p;
+    c.tokens = p->tokens;
+    c.count = count;
+    c.quiet = complete != NULL;
+
+    int result = compile_list(&c, NULL);
+    free(c.breaks);
+    free(c.ends);
+
+    if (result == LIST_ERROR) {
+        if (complete != NULL) *complete = c.failed && c.complete == 0 ? COMPILE_FAILED : c.complete;
+        free_program(p);
+        return NULL;
+    }
+
+    emit(&c, OP_END, 0, 0);
+    link_program(p);
+    if (complete != NULL) *complete = length;
+
+    if (debug_mode) {
+        printf(COLOR_YELLOW "Debug: compiled %d instructions, %d commands, %d tokens\n" COLOR_RESET,
+               p->code_count, p->command_count, p->token_count);
+    }
+    return p;
+}
+
+// --- VM ---
+
+typedef struct {
+    char **words;               // One malloc'd block, strings included
+    int count;
+    int next;
+    int status;                 // Of a while loop's last body, 0 before it runs
+} LoopWords;
+
+typedef struct {
+    Program *program;           // The caller's
+    int return_pc;
+    int loop_depth;             // Loops the caller had running
+    char **args;                // This call's arguments, one malloc'd block
+    char **saved_args;          // The caller's
+} Frame;
+
+typedef struct {
+    LoopWords *loops;
+    int loop_count;
+    int loop_capacity;
+    Frame *frames;
+    int frame_count;
+    int frame_capacity;
+} VM;
+
+// Copy words that must outlive the arena into one block
+static char **copy_words(char **words, int count) {
+    size_t size = (size_t)(count + 1) * sizeof(char *);
+    for (int i = 0; i < count; i++) size += strlen(words[i]) + 1;
+
+    char **copy = malloc(size);
+    if (copy == NULL) {
+        printf("Error: Memory allocation failed\n");
+        exit(1);
+    }
+
+    char *p = (char *)(copy + count + 1);
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(words[i]) + 1;
+        memcpy(p, words[i], len);
+        copy[i] = p;
+        p += len;
+    }
+    copy[count] = NULL;
+    return copy;
+}
+
+static int count_words(char **words) {
+    int count = 0;
+    while (words != NULL && words[count] != NULL) count++;
+    return count;
+}
+
+// Ctrl-C stops a running program in an interactive shell, whether it
+// reached the shell or a foreground command that it killed
+static int interrupted(void) {
+    return shell_interrupted || (interactive && last_exit_status == 128 + SIGINT);
+}
+
+// Top-level commands free their arena memory, as a line of its own would
+static void command_done(void) {
+    if (vm_depth == 1) finish_command();
+}
+
+static void define_function(Program *program, int index) {
+    FunctionDef *def = &program->functions[index];
+    ShellFunction *function = find_function(def->name);
+
+    if (function == NULL) {
+        shell_functions = grow_array(shell_functions, &shell_function_capacity, shell_function_count, sizeof(ShellFunction));
+        function = &shell_functions[shell_function_count++];
+    } else {
+        free_program(function->program);
+    }
+
+    function->name = def->name;
+    function->program = program;
+    function->entry = def->entry;
+    program->refs++;
+    shell_function_generation++;
+    last_exit_status = 0;
+}
+
+static void call_function(VM *vm, Program **program, int *pc, Program *target, int entry, char **args) {
+    if (vm->frame_count == VM_MAX_CALL_DEPTH) {
+        printf("Error: %s: function calls nested too deeply\n", args[0]);
+        last_exit_status = 1;
+        return;
+    }
+
+    vm->frames = grow_array(vm->frames, &vm->frame_capacity, vm->frame_count, sizeof(Frame));
+    Frame *frame = &vm->frames[vm->frame_count++];
+    frame->program = *program;
+    frame->return_pc = *pc;
+    frame->loop_depth = vm->loop_count;
+    frame->args = copy_words(args, count_words(args));
+    frame->saved_args = set_positional_args(frame->args);
+
+    // A running function stays alive even if it is redefined meanwhile
+    target->refs++;
+    *program = target;
+    *pc = entry;
+    last_exit_status = 0;
+}
+
+static void end_loop(VM *vm) {
+    LoopWords *loop = &vm->loops[--vm->loop_count];
+    free(loop->words);
+}
+
+static void return_from_function(VM *vm, Program **program, int *pc) {
+    Frame *frame = &vm->frames[--vm->frame_count];
+
+    while (vm->loop_count > frame->loop_depth) end_loop(vm);
+    set_positional_args(frame->saved_args);
+    free(frame->args);
+    free_program(*program);
+
+    *program = frame->program;
+    *pc = frame->return_pc;
+}
+
+// Expand a command's words into an arena argv; returns the count
+static int expand_command(Program *program, const Command *cmd, char ***args) {
+    ArgList list;
+    arg_list_init(&list);
+    expand_tokens(&program->tokens[cmd->first], cmd->count, &list);
+    *args = list.args;
+    return list.count;
+}
+
+static void run_command(VM *vm, Program **program, int *pc, const Command *cmd) {
+    char **args;
+    if (expand_command(*program, cmd, &args) == 0 || assign_variables(args)) return;
+
+    if (!cmd->has_operators) {
+        ShellFunction *function = find_function(args[0]);
+        if (function != NULL) {
+            call_function(vm, program, pc, function->program, function->entry, args);
+            return;
+        }
+        if (cmd->builtin != NULL) {
+            run_builtin(cmd->builtin, args, NULL);
+            return;
+        }
+    }
+
+    // The job table shows just this command, not the whole line or script
+    jobs_set_command_text(arena_printf("%.*s", (int)cmd->text_length, (*program)->text + cmd->text_offset));
+    execute_pipeline(args);
+}
+
+// Run a compiled program to its end, an `exit` or an interrupt. Returns
+// the exit status. The caller keeps its reference to the program.
+int run_program(Program *program) {
+    VM vm;
+    memset(&vm, 0, sizeof(vm));
+    Program *current = program;
+    int pc = 0;
+
+    if (vm_depth++ == 0) shell_interrupted = 0;
+
+    while (shell_running) {
+        const Instruction *in = &current->code[pc++];
+        const Program *caller;
+        const Command *cmd;
+        uint64_t trace;
+        char **args;
+
+        switch (in->op) {
+        case OP_RUN:
+        case OP_BUILTIN:
+            // A call switches current, the trace still names the caller's command
+            caller = current;
+            cmd = &current->commands[in->a];
+            trace = trace_start();
+            if (in->op == OP_BUILTIN) {
+                if (debug_mode) printf(COLOR_YELLOW "Debug: Executing bound builtin: %s\n" COLOR_RESET, cmd->argv[0]);
+                run_builtin(cmd->builtin, cmd->argv, NULL);
+            } else {
+                run_command(&vm, &current, &pc, cmd);
+            }
+            if (trace != 0) trace_span("run", trace, arena_printf("%.*s", (int)cmd->text_length, caller->text + cmd->text_offset));
+            command_done();
+            break;
+
+        case OP_CALL:
+            expand_command(current, &current->commands[in->b], &args);
+            call_function(&vm, &current, &pc, current, current->functions[in->a].entry, args);
+            command_done();
+            break;
+
+        case OP_DEFINE:
+            define_function(current, in->a);
+            break;
+
+        case OP_RETURN:
+            if (vm.frame_count == 0) goto done;
+            if (in->a >= 0 && expand_command(current, &current->commands[in->a], &args) > 0) {
+                last_exit_status = atoi(args[0]) & 0xff;
+            }
+            return_from_function(&vm, &current, &pc);
+            command_done();
+            break;
+
+        case OP_JUMP:
+            // Every loop jumps back, so this is where an interrupt ends it
+            if (in->a < pc && interrupted()) goto done;
+            pc = in->a;
+            break;
+
+        case OP_JUMP_FALSE:
+            if (last_exit_status != 0) pc = in->a;
+            break;
+
+        case OP_NOT:
+            last_exit_status = last_exit_status == 0;
+            break;
+
+        case OP_STATUS:
+            last_exit_status = in->a;
+            break;
+
+        case OP_FOR_BEGIN: {
+            vm.loops = grow_array(vm.loops, &vm.loop_capacity, vm.loop_count, sizeof(LoopWords));
+            LoopWords *loop = &vm.loops[vm.loop_count++];
+
+            if (in->a >= 0) {
+                int count = expand_command(current, &current->commands[in->a], &args);
+                loop->words = copy_words(args, count);
+                loop->count = count;
+            } else {
+                // $1 onwards
+                char **positional = get_positional_args();
+                int count = count_words(positional) - 1;
+                if (count < 0) count = 0;
+                loop->words = copy_words(count > 0 ? positional + 1 : positional, count);
+                loop->count = count;
+            }
+            loop->next = 0;
+            command_done();
+            break;
+        }
+
+        case OP_WHILE_BEGIN: {
+            vm.loops = grow_array(vm.loops, &vm.loop_capacity, vm.loop_count, sizeof(LoopWords));
+            LoopWords *loop = &vm.loops[vm.loop_count++];
+            loop->words = NULL;
+            loop->count = 0;
+            loop->next = 0;
+            loop->status = 0;
+            pc = in->a;
+            break;
+        }
+
+        case OP_WHILE_NEXT:
+            vm.loops[vm.loop_count - 1].status = last_exit_status;
+            break;
+
+        case OP_WHILE_TEST:
+            // The loop ends with its last body's status, not the condition's
+            if ((last_exit_status == 0) == (in->b != 0)) {
+                last_exit_status = vm.loops[vm.loop_count - 1].status;
+                pc = in->a;
+            }
+            break;
+
+        case OP_FOR_NEXT: {
+            LoopWords *loop = &vm.loops[vm.loop_count - 1];
+            if (loop->next == loop->count) {
+                pc = in->a;
+                break;
+            }
+            if (loop->next > 0 && interrupted()) goto done;
+
+            cmd = &current->commands[in->b];
+            set_variable(current->tokens[cmd->first].start, loop->words[loop->next++]);
+            break;
+        }
+
+        case OP_LOOP_END:
+            // A for loop that never ran succeeds
+            if (vm.loops[vm.loop_count - 1].words != NULL && vm.loops[vm.loop_count - 1].count == 0) last_exit_status = 0;
+            end_loop(&vm);
+            break;
+
+        case OP_END:
+            goto done;
+        }
+    }
+
+done:
+    while (vm.frame_count > 0) return_from_function(&vm, &current, &pc);
+    while (vm.loop_count > 0) end_loop(&vm);
+    free(vm.frames);
+    free(vm.loops);
+
+    vm_depth--;
+    return last_exit_status;
+}